@@ -0,0 +1,718 @@
+/*
+ * Copyright (C) 2014 Sebastian Sontberg <sebastian@sontberg.de>
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser General
+ * Public License v2.1. See the file LICENSE in the top level directory for more
+ * details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hwtimer.h"
+#include "msg.h"
+#include "thread.h"
+#include "vtimer.h"
+#include "net/ng_netbase.h"
+#include "net/ng_ipv6/addr.h"
+
+#include "coap_client.h"
+#include "coap_thread.h"
+
+#define ENABLE_DEBUG (0)
+#include "debug.h"
+
+#define TOKEN_LEN       (4U)
+#define NO_EXCHANGE     (-1)
+
+/**
+ * @brief   One request/response exchange in flight
+ */
+typedef struct {
+    uint32_t token;
+    coap_client_req_t *req;     /**< NULL if unused */
+    uint32_t sent;              /**< in ms */
+    uint8_t block;
+    int8_t next;                /**< next exchange in the hash bucket */
+} exchange_t;
+
+unsigned coap_client_nstart = COAP_CLIENT_NSTART;
+
+static exchange_t exchanges[COAP_CLIENT_MAX_INFLIGHT];
+static int8_t buckets[COAP_CLIENT_HASH_SIZE];
+static unsigned inflight;
+static coap_client_req_t *active;
+static uint32_t next_token;
+static coap_context_t *handler_ctx;
+static kernel_pid_t client_coap_pid = KERNEL_PID_UNDEF;
+
+static uint32_t now_ms(void)
+{
+    coap_tick_t now;
+    coap_ticks(&now);
+    return (uint32_t)((uint64_t)now * 1000 / COAP_TICKS_PER_SECOND);
+}
+
+static exchange_t *exchange_find(uint32_t token)
+{
+    for (int i = buckets[token & (COAP_CLIENT_HASH_SIZE - 1)]; i != NO_EXCHANGE;
+         i = exchanges[i].next) {
+        if (exchanges[i].token == token) {
+            return &exchanges[i];
+        }
+    }
+
+    return NULL;
+}
+
+static exchange_t *exchange_add(coap_client_req_t *req, uint8_t block)
+{
+    for (int i = 0; i < (int)COAP_CLIENT_MAX_INFLIGHT; i++) {
+        exchange_t *x = &exchanges[i];
+
+        if (!x->req) {
+            int8_t *bucket;
+
+            x->token = next_token++;
+            x->req = req;
+            x->block = block;
+            x->sent = now_ms();
+            bucket = &buckets[x->token & (COAP_CLIENT_HASH_SIZE - 1)];
+            x->next = *bucket;
+            *bucket = i;
+            inflight++;
+            req->inflight++;
+            return x;
+        }
+    }
+
+    return NULL;
+}
+
+static void exchange_remove(exchange_t *x)
+{
+    int8_t *link = &buckets[x->token & (COAP_CLIENT_HASH_SIZE - 1)];
+
+    while (*link != NO_EXCHANGE && &exchanges[(int)*link] != x) {
+        link = &exchanges[(int)*link].next;
+    }
+
+    if (*link != NO_EXCHANGE) {
+        *link = x->next;
+    }
+
+    x->req->inflight--;
+    x->req = NULL;
+    inflight--;
+}
+
+static unsigned peer_inflight(const coap_address_t *peer)
+{
+    unsigned n = 0;
+
+    for (unsigned i = 0; i < COAP_CLIENT_MAX_INFLIGHT; i++) {
+        if (exchanges[i].req &&
+            ng_ipv6_addr_equal(&exchanges[i].req->peer.addr, &peer->addr)) {
+            n++;
+        }
+    }
+
+    return n;
+}
+
+static int send_block(coap_context_t *ctx, coap_client_req_t *req, uint8_t block)
+{
+    unsigned char opt[4];
+    uint8_t token[TOKEN_LEN];
+    const char *seg = req->path;
+    exchange_t *x = exchange_add(req, block);
+    coap_pdu_t *pdu;
+
+    if (!x) {
+        return -1;
+    }
+
+    pdu = coap_pdu_init(COAP_MESSAGE_CON, COAP_REQUEST_GET,
+                        coap_new_message_id(ctx), COAP_MAX_PDU_SIZE);
+
+    if (!pdu) {
+        exchange_remove(x);
+        return -1;
+    }
+
+    memcpy(token, &x->token, TOKEN_LEN);
+    coap_add_token(pdu, TOKEN_LEN, token);
+
+    while (*seg) {
+        const char *end = strchr(seg, '/');
+        size_t len = end ? (size_t)(end - seg) : strlen(seg);
+
+        if (len) {
+            coap_add_option(pdu, COAP_OPTION_URI_PATH, len, (unsigned char *)seg);
+        }
+
+        seg += len + (end ? 1 : 0);
+    }
+
+    coap_add_option(pdu, COAP_OPTION_BLOCK2,
+                    coap_encode_var_bytes(opt, (block << 4) | req->szx), opt);
+
+    if (coap_send_confirmed(ctx, ctx->endpoint, &req->peer, pdu) == COAP_INVALID_TID) {
+        coap_delete_pdu(pdu);
+        exchange_remove(x);
+        return -1;
+    }
+
+    DEBUG("client: GET %s block %u, token %lu\n", req->path, block,
+          (unsigned long)x->token);
+    return 0;
+}
+
+/* Number of blocks the buffer of @p req can take */
+static unsigned max_blocks(const coap_client_req_t *req)
+{
+    unsigned n = (req->size + (16U << req->szx) - 1) >> (req->szx + 4);
+    return (n < COAP_CLIENT_MAX_BLOCKS) ? n : COAP_CLIENT_MAX_BLOCKS;
+}
+
+static void finish(coap_client_req_t *req, uint8_t code)
+{
+    coap_client_req_t **link = &active;
+
+    for (unsigned i = 0; i < COAP_CLIENT_MAX_INFLIGHT; i++) {
+        if (exchanges[i].req == req) {
+            /* late responses are ignored */
+            exchange_remove(&exchanges[i]);
+        }
+    }
+
+    while (*link && *link != req) {
+        link = &(*link)->next;
+    }
+
+    if (*link) {
+        *link = req->next;
+    }
+
+    req->cb(req, code);
+}
+
+/* Sends as many blocks as the NSTART limits allow */
+static void schedule(coap_context_t *ctx)
+{
+    coap_client_req_t *req = active;
+
+    while (req && inflight < COAP_CLIENT_MAX_INFLIGHT) {
+        coap_client_req_t *next = req->next;
+        unsigned busy = peer_inflight(&req->peer);
+        unsigned room = (busy < coap_client_nstart) ? coap_client_nstart - busy : 0;
+
+        /* until block 0 told the block size, only one exchange */
+        while (room-- && req->next_block < req->end &&
+               (req->next_block == 0 || req->received & 1)) {
+            if (send_block(ctx, req, req->next_block) < 0) {
+                if (req->inflight == 0) {
+                    finish(req, 0);
+                }
+
+                break;
+            }
+
+            req->next_block++;
+        }
+
+        req = next;
+    }
+}
+
+static void response_handler(coap_context_t *ctx, const coap_endpoint_t *local_interface,
+                             const coap_address_t *remote, coap_pdu_t *sent,
+                             coap_pdu_t *received, const coap_tid_t id)
+{
+    (void)local_interface;
+    (void)remote;
+    (void)sent;
+    (void)id;
+
+    uint32_t token;
+    coap_block_t block = { 0, 0, 0 };
+    exchange_t *x;
+    coap_client_req_t *req;
+    size_t len;
+    unsigned char *data;
+
+    if (received->hdr->token_length != TOKEN_LEN) {
+        return;
+    }
+
+    memcpy(&token, received->hdr->token, TOKEN_LEN);
+    x = exchange_find(token);
+
+    if (!x) {
+        DEBUG("client: unknown token %lu\n", (unsigned long)token);
+        return;
+    }
+
+    req = x->req;
+
+    if (!coap_get_block(received, COAP_OPTION_BLOCK2, &block)) {
+        block.num = x->block;
+        block.szx = req->szx;
+    }
+
+    exchange_remove(x);
+
+    if (COAP_RESPONSE_CLASS(received->hdr->code) != 2) {
+        if (block.num == 0) {
+            finish(req, received->hdr->code);
+            schedule(ctx);
+            return;
+        }
+
+        /* asked beyond the end of the resource */
+        if (block.num < req->end) {
+            req->end = block.num;
+        }
+    }
+    else if (block.num < COAP_CLIENT_MAX_BLOCKS) {
+        size_t offset = block.num << (block.szx + 4);
+
+        if (block.num == 0) {
+            /* the server may have chosen a smaller block size */
+            req->szx = block.szx;
+            req->end = max_blocks(req);
+        }
+
+        if (coap_get_data(received, &len, &data) && offset < req->size) {
+            if (len > req->size - offset) {
+                len = req->size - offset;
+            }
+
+            memcpy(req->buf + offset, data, len);
+
+            if (offset + len > req->len) {
+                req->len = offset + len;
+            }
+        }
+
+        req->received |= 1UL << block.num;
+        req->code = received->hdr->code;
+
+        if (!block.m && block.num + 1U < req->end) {
+            req->end = block.num + 1;
+        }
+    }
+
+    if (req->end && req->received == (0xffffffffUL >> (32 - req->end))) {
+        finish(req, req->code);
+    }
+    else if (req->inflight == 0 && req->next_block >= req->end) {
+        /* nothing more to wait for, but blocks are missing */
+        finish(req, 0);
+    }
+
+    schedule(ctx);
+}
+
+void coap_client_init(kernel_pid_t coap_pid)
+{
+    client_coap_pid = coap_pid;
+}
+
+int coap_client_get(coap_context_t *ctx, coap_client_req_t *req)
+{
+    coap_client_req_t **link = &active;
+
+    if (!req->cb || !req->buf || !req->size) {
+        return -1;
+    }
+
+    if (handler_ctx != ctx) {
+        memset(buckets, NO_EXCHANGE, sizeof(buckets));
+        prng((unsigned char *)&next_token, sizeof(next_token));
+        coap_register_response_handler(ctx, response_handler);
+        handler_ctx = ctx;
+    }
+
+    req->len = 0;
+    req->received = 0;
+    req->inflight = 0;
+    req->szx = COAP_CLIENT_SZX;
+    req->next_block = 0;
+    req->end = max_blocks(req);
+    req->code = 0;
+    req->next = NULL;
+
+    /* first come, first served */
+    while (*link) {
+        link = &(*link)->next;
+    }
+
+    *link = req;
+    schedule(ctx);
+    return 0;
+}
+
+void coap_client_timeout(coap_context_t *ctx)
+{
+    uint32_t now = now_ms();
+
+    for (unsigned i = 0; i < COAP_CLIENT_MAX_INFLIGHT; i++) {
+        if (exchanges[i].req && now - exchanges[i].sent > COAP_CLIENT_TIMEOUT) {
+            finish(exchanges[i].req, 0);
+        }
+    }
+
+    schedule(ctx);
+}
+
+/*
+ * Polling simulated nodes
+ */
+
+#define SIM_MSG_DUE     (0x5344)
+#define SIM_QUEUE_SIZE  (64U)
+#define SIM_MSG_QUEUE   (16U)
+
+typedef struct {
+    unsigned nodes;
+    unsigned bytes;
+    uint32_t latency_us;
+} poll_params_t;
+
+typedef struct {
+    ng_pktsnip_t *pkt;
+    uint32_t due;
+} sim_rsp_t;
+
+static poll_params_t params;
+static bool sim_active;
+static char sim_stack[COAP_CLIENT_SIM_STACK_SIZE];
+static kernel_pid_t sim_pid = KERNEL_PID_UNDEF;
+static sim_rsp_t sim_queue[SIM_QUEUE_SIZE];
+static unsigned sim_head, sim_count, sim_dropped;
+static vtimer_t sim_timer;
+
+static coap_client_req_t poll_reqs[COAP_CLIENT_SIM_NODES];
+static uint8_t poll_buf[COAP_CLIENT_MAX_BLOCKS << (COAP_CLIENT_SZX + 4)];
+static unsigned poll_done, poll_failed;
+static uint32_t poll_bytes, poll_start;
+
+static void sim_wake(uint32_t us)
+{
+    timex_t t = timex_set(0, us);
+    timex_normalize(&t);
+    vtimer_set_msg(&sim_timer, t, sim_pid, SIM_MSG_DUE, NULL);
+}
+
+/* Answers a request to a simulated node with a piggybacked response */
+static void sim_answer(ng_pktsnip_t *pkt)
+{
+    ng_pktsnip_t *ip = NULL, *udp = NULL, *coap = NULL;
+    uint8_t rsp[4 + 8 + 1 + 3 + 1 + 1024];
+    uint8_t prefix[16];
+    ng_ipv6_addr_t sim_prefix;
+    unsigned num = 0, szx = COAP_CLIENT_SZX, pos, opt = 0;
+
+    for (ng_pktsnip_t *s = pkt; s; s = s->next) {
+        if (s->type == NG_NETTYPE_IPV6) {
+            ip = s;
+        }
+        else if (s->type == NG_NETTYPE_UDP) {
+            udp = s;
+        }
+        else if (s->type == NG_NETTYPE_UNDEF) {
+            coap = s;
+        }
+    }
+
+    ng_ipv6_addr_from_str(&sim_prefix, COAP_CLIENT_SIM_PREFIX);
+
+    if (!ip || !udp || !coap || coap->size < 4 ||
+        memcmp(((uint8_t *)ip->data) + 24, &sim_prefix, 8)) {
+        return;
+    }
+
+    const uint8_t *req = coap->data;
+    unsigned tkl = req[0] & 0x0f;
+
+    /* requests only */
+    if (req[1] == 0 || req[1] > 31 || 4 + tkl > coap->size) {
+        return;
+    }
+
+    /* the Block2 option, the client puts it after Uri-Path */
+    pos = 4 + tkl;
+
+    while (pos < coap->size && req[pos] != 0xff) {
+        unsigned delta = req[pos] >> 4, len = req[pos] & 0x0f;
+        pos++;
+
+        if (delta == 13) {
+            delta = 13 + req[pos++];
+        }
+
+        if (len == 13) {
+            len = 13 + req[pos++];
+        }
+
+        opt += delta;
+
+        if (opt == COAP_OPTION_BLOCK2 && len > 0 && len <= 3) {
+            uint32_t v = 0;
+
+            for (unsigned i = 0; i < len; i++) {
+                v = (v << 8) | req[pos + i];
+            }
+
+            num = v >> 4;
+            szx = (v & 0x07) < 6 ? (v & 0x07) : 6;
+        }
+
+        pos += len;
+    }
+
+    unsigned bs = 16U << szx;
+    unsigned offset = num * bs;
+    unsigned plen = (offset < params.bytes) ? params.bytes - offset : 0;
+    unsigned m = plen > bs;
+    uint32_t v = (num << 4) | (m << 3) | szx;
+
+    plen = m ? bs : plen;
+
+    rsp[0] = 0x60 | tkl;                                /* ACK */
+    rsp[1] = (plen || num == 0) ? 0x45 : 0x82;          /* 2.05 or 4.02 */
+    rsp[2] = req[2];
+    rsp[3] = req[3];
+    memcpy(rsp + 4, req + 4, tkl);
+    pos = 4 + tkl;
+
+    /* Block2 is option 23 = 13 + 10 */
+    rsp[pos++] = 0xd0 | ((v > 0xffff) ? 3 : ((v > 0xff) ? 2 : 1));
+    rsp[pos++] = 10;
+
+    if (v > 0xffff) {
+        rsp[pos++] = v >> 16;
+    }
+
+    if (v > 0xff) {
+        rsp[pos++] = v >> 8;
+    }
+
+    rsp[pos++] = v;
+
+    if (plen) {
+        rsp[pos++] = 0xff;
+        memset(rsp + pos, 'a' + (num % 26), plen);
+        pos += plen;
+    }
+
+    /* headers as ng_udp delivers them, with the addresses swapped */
+    uint8_t hdr[40 + 8];
+    const uint8_t *rip = ip->data, *rudp = udp->data;
+
+    memcpy(prefix, rip + 24, 16);
+    memset(hdr, 0, sizeof(hdr));
+    hdr[0] = 0x60;
+    hdr[4] = (8 + pos) >> 8;
+    hdr[5] = (8 + pos) & 0xff;
+    hdr[6] = 17;
+    hdr[7] = 64;
+    memcpy(hdr + 8, prefix, 16);
+    memcpy(hdr + 24, rip + 8, 16);
+    memcpy(hdr + 40, rudp + 2, 2);
+    memcpy(hdr + 42, rudp, 2);
+    hdr[44] = (8 + pos) >> 8;
+    hdr[45] = (8 + pos) & 0xff;
+
+    ng_pktsnip_t *rip6 = ng_pktbuf_add(NULL, hdr, 40, NG_NETTYPE_IPV6);
+    ng_pktsnip_t *rudp6 = rip6 ? ng_pktbuf_add(rip6, hdr + 40, 8, NG_NETTYPE_UDP) : NULL;
+    ng_pktsnip_t *payload = rudp6 ? ng_pktbuf_add(rudp6, rsp, pos, NG_NETTYPE_UNDEF) : NULL;
+
+    if (!payload || sim_count == SIM_QUEUE_SIZE) {
+        sim_dropped++;
+
+        if (payload || rudp6 || rip6) {
+            ng_pktbuf_release(payload ? payload : (rudp6 ? rudp6 : rip6));
+        }
+
+        return;
+    }
+
+    sim_queue[(sim_head + sim_count) % SIM_QUEUE_SIZE].pkt = payload;
+    sim_queue[(sim_head + sim_count) % SIM_QUEUE_SIZE].due =
+        HWTIMER_TICKS_TO_US(hwtimer_now()) + params.latency_us;
+
+    if (sim_count++ == 0) {
+        sim_wake(params.latency_us);
+    }
+}
+
+/* Hands due responses to the CoAP thread */
+static void sim_deliver(void)
+{
+    uint32_t now = HWTIMER_TICKS_TO_US(hwtimer_now());
+
+    while (sim_count && (int32_t)(sim_queue[sim_head].due - now) <= 0) {
+        if (ng_netapi_receive(client_coap_pid, sim_queue[sim_head].pkt) < 1) {
+            ng_pktbuf_release(sim_queue[sim_head].pkt);
+            sim_dropped++;
+        }
+
+        sim_head = (sim_head + 1) % SIM_QUEUE_SIZE;
+        sim_count--;
+    }
+
+    if (sim_count) {
+        sim_wake(sim_queue[sim_head].due - now);
+    }
+}
+
+/* Listens to everything sent over UDP and plays the simulated nodes */
+static void *sim(void *arg)
+{
+    (void)arg;
+    msg_t msg, msg_queue[SIM_MSG_QUEUE];
+    ng_netreg_entry_t entry;
+
+    msg_init_queue(msg_queue, SIM_MSG_QUEUE);
+
+    entry.pid = thread_getpid();
+    entry.demux_ctx = NG_NETREG_DEMUX_CTX_ALL;
+    ng_netreg_register(NG_NETTYPE_UDP, &entry);
+
+    while (1) {
+        msg_receive(&msg);
+
+        switch (msg.type) {
+            case NG_NETAPI_MSG_TYPE_SND:
+                if (sim_active) {
+                    sim_answer((ng_pktsnip_t *)msg.content.ptr);
+                }
+
+                ng_pktbuf_release((ng_pktsnip_t *)msg.content.ptr);
+                break;
+
+            case NG_NETAPI_MSG_TYPE_RCV:
+                ng_pktbuf_release((ng_pktsnip_t *)msg.content.ptr);
+                break;
+
+            case SIM_MSG_DUE:
+                sim_deliver();
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    /* never reached */
+    return NULL;
+}
+
+static void poll_complete(coap_client_req_t *req, uint8_t code)
+{
+    if (code == COAP_RESPONSE_CODE(205)) {
+        poll_done++;
+        poll_bytes += req->len;
+    }
+    else {
+        poll_failed++;
+    }
+
+    if (poll_done + poll_failed == params.nodes) {
+        uint32_t us = HWTIMER_TICKS_TO_US(hwtimer_now() - poll_start);
+
+        sim_active = false;
+        printf("coap_poll: %u nodes, NSTART %u: %u ok, %u failed in %lu ms\n",
+               params.nodes, coap_client_nstart, poll_done, poll_failed,
+               (unsigned long)(us / 1000));
+
+        if (us) {
+            printf("coap_poll: %lu requests/s, %lu bytes/s, %u responses dropped\n",
+                   (unsigned long)((uint64_t)poll_done * 1000000 / us),
+                   (unsigned long)((uint64_t)poll_bytes * 1000000 / us), sim_dropped);
+        }
+    }
+}
+
+void coap_client_poll(coap_context_t *ctx, void *arg)
+{
+    (void)arg;
+    ng_ipv6_addr_t base;
+
+    ng_ipv6_addr_from_str(&base, COAP_CLIENT_SIM_PREFIX);
+    poll_done = 0;
+    poll_failed = 0;
+    poll_bytes = 0;
+    sim_dropped = 0;
+    sim_active = true;
+    poll_start = hwtimer_now();
+
+    for (unsigned i = 0; i < params.nodes; i++) {
+        coap_client_req_t *req = &poll_reqs[i];
+
+        memset(req, 0, sizeof(*req));
+        memcpy(&req->peer.addr, &base, sizeof(base));
+        req->peer.addr.u8[14] = (i + 1) >> 8;
+        req->peer.addr.u8[15] = (i + 1) & 0xff;
+        req->peer.port = COAP_PORT;
+        req->path = "sensor";
+        /* the bodies are only counted, so all share one buffer */
+        req->buf = poll_buf;
+        req->size = sizeof(poll_buf);
+        req->cb = poll_complete;
+
+        if (coap_client_get(ctx, req) < 0) {
+            poll_complete(req, 0);
+        }
+    }
+}
+
+int coap_client_cmd(int argc, char **argv)
+{
+    msg_t msg;
+
+    if (argc < 2) {
+        printf("usage: %s <nodes> [nstart] [bytes] [latency ms]\n", argv[0]);
+        return 1;
+    }
+
+    if (client_coap_pid == KERNEL_PID_UNDEF) {
+        puts("coap_poll: CoAP thread not running");
+        return 1;
+    }
+
+    if (sim_active) {
+        puts("coap_poll: still polling");
+        return 1;
+    }
+
+    params.nodes = atoi(argv[1]);
+    params.bytes = (argc > 3) ? (unsigned)atoi(argv[3]) : 16;
+    params.latency_us = ((argc > 4) ? atoi(argv[4]) : 50) * 1000;
+
+    if (params.nodes == 0 || params.nodes > COAP_CLIENT_SIM_NODES) {
+        printf("coap_poll: 1 to %u nodes\n", COAP_CLIENT_SIM_NODES);
+        return 1;
+    }
+
+    if (params.bytes > sizeof(poll_buf)) {
+        params.bytes = sizeof(poll_buf);
+    }
+
+    if (argc > 2 && atoi(argv[2]) > 0) {
+        coap_client_nstart = atoi(argv[2]);
+    }
+
+    if (sim_pid == KERNEL_PID_UNDEF) {
+        sim_pid = thread_create(sim_stack, sizeof(sim_stack), COAP_CLIENT_SIM_PRIO,
+                                CREATE_STACKTEST, sim, NULL, "coap_sim");
+    }
+
+    msg.type = COAP_CLIENT_MSG_POLL;
+    msg.content.ptr = (char *)&params;
+    msg_send(&msg, client_coap_pid);
+    return 0;
+}
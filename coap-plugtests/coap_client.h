@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2014 Sebastian Sontberg <sebastian@sontberg.de>
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser General
+ * Public License v2.1. See the file LICENSE in the top level directory for more
+ * details.
+ */
+
+/**
+ * @file
+ * @brief       Pipelined CoAP client on the server's context
+ *
+ * Sends confirmable GET requests from the same coap_context_t the server
+ * runs on. Up to coap_client_nstart requests are in flight per peer
+ * (NSTART of RFC 7252, section 4.7) and COAP_CLIENT_MAX_INFLIGHT in
+ * total. Further requests wait until a slot frees up. Responses are
+ * matched to their request by token through a hash table, and each
+ * request gets a completion callback.
+ *
+ * Block-wise responses are downloaded pipelined. After the first block
+ * has told the block size, the following blocks are requested in
+ * parallel, as far as NSTART allows.
+ *
+ * All functions except coap_client_init() and coap_client_cmd() must be
+ * called from the CoAP thread.
+ */
+
+#ifndef COAP_CLIENT_H
+#define COAP_CLIENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kernel.h"
+#include "coap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief   Message type that starts a polling run in the CoAP thread
+ */
+#define COAP_CLIENT_MSG_POLL        (0x434c)
+
+/**
+ * @brief   Default number of outstanding requests per peer
+ */
+#ifndef COAP_CLIENT_NSTART
+#define COAP_CLIENT_NSTART          (1U)
+#endif
+
+/**
+ * @brief   Maximum number of outstanding requests over all peers
+ */
+#ifndef COAP_CLIENT_MAX_INFLIGHT
+#define COAP_CLIENT_MAX_INFLIGHT    (32U)
+#endif
+
+/**
+ * @brief   Buckets of the token hash table, must be a power of 2
+ */
+#ifndef COAP_CLIENT_HASH_SIZE
+#define COAP_CLIENT_HASH_SIZE       (16U)
+#endif
+
+/**
+ * @brief   Block size exponent asked for in Block2 (2 = 64 bytes)
+ */
+#ifndef COAP_CLIENT_SZX
+#define COAP_CLIENT_SZX             (2U)
+#endif
+
+/**
+ * @brief   Maximum number of blocks of one response
+ */
+#define COAP_CLIENT_MAX_BLOCKS      (32U)
+
+/**
+ * @brief   Time after which a request is given up, in ms (MAX_TRANSMIT_WAIT)
+ */
+#ifndef COAP_CLIENT_TIMEOUT
+#define COAP_CLIENT_TIMEOUT         (93000U)
+#endif
+
+/**
+ * @brief   Number of simulated nodes the poll command can address
+ */
+#ifndef COAP_CLIENT_SIM_NODES
+#define COAP_CLIENT_SIM_NODES       (100U)
+#endif
+
+/**
+ * @brief   Prefix of the simulated nodes, node n gets interface ID n
+ */
+#ifndef COAP_CLIENT_SIM_PREFIX
+#define COAP_CLIENT_SIM_PREFIX      "fd22:2626:476f:1::"
+#endif
+
+/**
+ * @brief   Priority of the thread answering for the simulated nodes
+ */
+#ifndef COAP_CLIENT_SIM_PRIO
+#define COAP_CLIENT_SIM_PRIO        (PRIORITY_MAIN - 2)
+#endif
+
+#ifndef COAP_CLIENT_SIM_STACK_SIZE
+#define COAP_CLIENT_SIM_STACK_SIZE  (KERNEL_CONF_STACKSIZE_DEFAULT)
+#endif
+
+typedef struct coap_client_req coap_client_req_t;
+
+/**
+ * @brief   Called once a request is complete
+ *
+ * @param[in] req   The request, req->len holds the length of the body.
+ * @param[in] code  Response code, or 0 if the request timed out or could
+ *                  not be sent.
+ */
+typedef void (*coap_client_cb_t)(coap_client_req_t *req, uint8_t code);
+
+/**
+ * @brief   A GET request, owned by the caller until the callback ran
+ */
+struct coap_client_req {
+    coap_address_t peer;        /**< server to ask */
+    const char *path;           /**< Uri-Path, segments separated by '/' */
+    uint8_t *buf;               /**< buffer for the response body */
+    size_t size;                /**< size of buf */
+    size_t len;                 /**< length of the received body */
+    coap_client_cb_t cb;        /**< completion callback */
+    void *arg;                  /**< for use by the callback */
+
+    /* internal state */
+    coap_client_req_t *next;    /**< next active request */
+    uint32_t received;          /**< bitmap of received blocks */
+    uint8_t inflight;           /**< exchanges in flight */
+    uint8_t szx;                /**< block size exponent */
+    uint8_t next_block;         /**< next block to ask for */
+    uint8_t end;                /**< number of blocks, if known */
+    uint8_t code;               /**< response code so far */
+};
+
+/**
+ * @brief   Outstanding requests per peer, NSTART
+ */
+extern unsigned coap_client_nstart;
+
+/**
+ * @brief   Remembers the CoAP thread for coap_client_cmd()
+ */
+void coap_client_init(kernel_pid_t coap_pid);
+
+/**
+ * @brief   Sends a GET request, or queues it until NSTART allows
+ *
+ * @return  0 on success
+ * @return  -1 if @p req has no callback or no buffer
+ */
+int coap_client_get(coap_context_t *ctx, coap_client_req_t *req);
+
+/**
+ * @brief   Gives up requests older than COAP_CLIENT_TIMEOUT, to be called
+ *          periodically by the CoAP thread
+ */
+void coap_client_timeout(coap_context_t *ctx);
+
+/**
+ * @brief   Starts a polling run, the CoAP thread calls this on
+ *          COAP_CLIENT_MSG_POLL
+ */
+void coap_client_poll(coap_context_t *ctx, void *arg);
+
+/**
+ * @brief   Shell command polling simulated nodes
+ *
+ *          `coap_poll <nodes> [nstart] [bytes] [latency ms]` lets the
+ *          client GET a body of @p bytes from each of @p nodes simulated
+ *          nodes, which answer after the given latency, and prints the
+ *          throughput once all requests completed.
+ */
+int coap_client_cmd(int argc, char **argv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COAP_CLIENT_H */
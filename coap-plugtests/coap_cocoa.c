@@ -0,0 +1,455 @@
+/*
+ * Copyright (C) 2014 Sebastian Sontberg <sebastian@sontberg.de>
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser General
+ * Public License v2.1. See the file LICENSE in the top level directory for more
+ * details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "byteorder.h"
+#include "net/ng_netbase.h"
+#include "net/ng_ipv6/addr.h"
+#include "net/ng_ipv6/hdr.h"
+
+#include "coap_cocoa.h"
+#ifdef COAP_CLIENT
+#include "coap_client.h"
+
+#if COAP_COCOA_PENDING < COAP_CLIENT_MAX_INFLIGHT
+#error "COAP_COCOA_PENDING must cover COAP_CLIENT_MAX_INFLIGHT"
+#endif
+#endif
+
+#define ENABLE_DEBUG (0)
+#include "debug.h"
+
+/* CoAP message types as found in the first header byte */
+#define TYPE_ACK        (2U)
+#define TYPE_RST        (3U)
+
+/* Weak samples are only taken up to this many retransmissions */
+#define WEAK_MAX_RETRANSMIT (2U)
+
+/**
+ * @brief   One RTT estimator (RFC 6298 with variable K)
+ */
+typedef struct {
+    uint32_t srtt;              /**< smoothed RTT in ms, 0 if unset */
+    uint32_t rttvar;            /**< RTT variation in ms */
+    uint32_t rto;               /**< RTO of this estimator in ms */
+} cocoa_est_t;
+
+typedef struct {
+    ng_ipv6_addr_t addr;
+    uint32_t rto;               /**< overall RTO in ms */
+    uint32_t updated;           /**< last change of rto */
+    uint32_t used;              /**< last exchange, for replacement */
+    cocoa_est_t strong;
+    cocoa_est_t weak;
+} cocoa_peer_t;
+
+/**
+ * @brief   A confirmable message waiting for its ACK
+ */
+typedef struct {
+    coap_tid_t id;              /**< transaction of the send queue node */
+    uint16_t msgid;
+    uint8_t retransmits;
+    uint8_t bf;                 /**< backoff factor in halves */
+    uint32_t sent;              /**< first transmission */
+    uint32_t initial;           /**< initial timeout in ms */
+    cocoa_peer_t *peer;
+} cocoa_pending_t;
+
+static cocoa_peer_t peers[COAP_COCOA_PEERS];
+static unsigned peers_numof;
+static cocoa_pending_t pending[COAP_COCOA_PENDING];
+static coap_tid_t seen[COAP_COCOA_SEEN];
+static unsigned seen_numof;
+static coap_cocoa_stats_t stats;
+
+static bool enabled = true;
+static unsigned loss_percent;
+static uint32_t rnd = 2463534242UL;
+
+static uint32_t now_ms(void)
+{
+    coap_tick_t now;
+    coap_ticks(&now);
+    return (uint32_t)((uint64_t)now * 1000 / COAP_TICKS_PER_SECOND);
+}
+
+static coap_tick_t ms_to_ticks(uint32_t ms)
+{
+    return (coap_tick_t)((uint64_t)ms * COAP_TICKS_PER_SECOND / 1000);
+}
+
+static uint32_t xorshift(void)
+{
+    rnd ^= rnd << 13;
+    rnd ^= rnd >> 17;
+    rnd ^= rnd << 5;
+    return rnd;
+}
+
+static cocoa_peer_t *peer_get(const ng_ipv6_addr_t *addr, bool create)
+{
+    cocoa_peer_t *lru = &peers[0];
+
+    for (unsigned i = 0; i < peers_numof; i++) {
+        if (ng_ipv6_addr_equal(&peers[i].addr, addr)) {
+            return &peers[i];
+        }
+
+        if (peers[i].used < lru->used) {
+            lru = &peers[i];
+        }
+    }
+
+    if (!create) {
+        return NULL;
+    }
+
+    if (peers_numof < COAP_COCOA_PEERS) {
+        lru = &peers[peers_numof++];
+    }
+
+    /* a pending exchange might still point to the replaced peer */
+    for (unsigned i = 0; i < COAP_COCOA_PENDING; i++) {
+        if (pending[i].peer == lru) {
+            pending[i].peer = NULL;
+        }
+    }
+
+    memset(lru, 0, sizeof(*lru));
+    memcpy(&lru->addr, addr, sizeof(*addr));
+    lru->rto = COAP_COCOA_INITIAL_RTO;
+    lru->updated = now_ms();
+    return lru;
+}
+
+/* Ages the RTO of a peer that was not updated for a while */
+static uint32_t peer_rto(cocoa_peer_t *p, uint32_t now)
+{
+    uint32_t idle = now - p->updated;
+
+    if (p->rto < 1000 && idle > 16 * p->rto) {
+        p->rto *= 2;
+        p->updated = now;
+    }
+    else if (p->rto > 3000 && idle > 4 * p->rto) {
+        p->rto = 1000 + p->rto / 2;
+        p->updated = now;
+    }
+
+    return p->rto;
+}
+
+/* Updates @p e with @p rtt and returns its new RTO */
+static uint32_t estimate(cocoa_est_t *e, uint32_t rtt, unsigned k)
+{
+    if (e->srtt == 0) {
+        e->srtt = rtt ? rtt : 1;
+        e->rttvar = rtt / 2;
+    }
+    else {
+        uint32_t diff = (e->srtt > rtt) ? e->srtt - rtt : rtt - e->srtt;
+        e->rttvar = (3 * e->rttvar + diff) / 4;
+        e->srtt = (7 * e->srtt + rtt) / 8;
+    }
+
+    e->rto = e->srtt + k * e->rttvar;
+
+    if (e->rto > COAP_COCOA_MAX_RTO) {
+        e->rto = COAP_COCOA_MAX_RTO;
+    }
+
+    return e->rto;
+}
+
+static void sample(cocoa_pending_t *pend, uint32_t now)
+{
+    uint32_t rtt = now - pend->sent;
+    cocoa_peer_t *p = pend->peer;
+
+    stats.completed++;
+    stats.completion_ms += rtt;
+
+    if (rtt > stats.completion_max) {
+        stats.completion_max = rtt;
+    }
+
+    if (!p) {
+        return;
+    }
+
+    if (pend->retransmits == 0) {
+        /* strong: RTO = 1/2 RTO_strong + 1/2 RTO */
+        p->rto = (estimate(&p->strong, rtt, 4) + p->rto) / 2;
+        stats.strong++;
+    }
+    else if (pend->retransmits <= WEAK_MAX_RETRANSMIT) {
+        /* weak, measured from the first transmission:
+         * RTO = 1/4 RTO_weak + 3/4 RTO */
+        p->rto = (estimate(&p->weak, rtt, 1) + 3 * p->rto) / 4;
+        stats.weak++;
+    }
+    else {
+        return;
+    }
+
+    p->updated = now;
+}
+
+static cocoa_pending_t *pending_get(coap_tid_t id)
+{
+    for (unsigned i = 0; i < COAP_COCOA_PENDING; i++) {
+        if (pending[i].sent && pending[i].id == id) {
+            return &pending[i];
+        }
+    }
+
+    return NULL;
+}
+
+int coap_cocoa_received(ng_pktsnip_t *pkt)
+{
+    const uint8_t *coap = pkt->data;
+    ng_pktsnip_t *ip = pkt;
+
+    if (loss_percent && (xorshift() % 100) < loss_percent) {
+        stats.dropped++;
+        ng_pktbuf_release(pkt);
+        return 1;
+    }
+
+    if (pkt->size < 4 || ((coap[0] >> 4) & 0x03) < TYPE_ACK) {
+        return 0;
+    }
+
+    while (ip && ip->type != NG_NETTYPE_IPV6) {
+        ip = ip->next;
+    }
+
+    if (!ip) {
+        return 0;
+    }
+
+    uint16_t msgid = (coap[2] << 8) | coap[3];
+    ng_ipv6_addr_t *src = &((ng_ipv6_hdr_t *)ip->data)->src;
+
+    for (unsigned i = 0; i < COAP_COCOA_PENDING; i++) {
+        cocoa_pending_t *pend = &pending[i];
+
+        if (pend->sent && pend->msgid == msgid &&
+            (!pend->peer || ng_ipv6_addr_equal(&pend->peer->addr, src))) {
+            DEBUG("cocoa: ACK for %u after %u retransmits\n", msgid, pend->retransmits);
+            sample(pend, now_ms());
+            pend->sent = 0;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+static bool was_seen(coap_tid_t id)
+{
+    for (unsigned i = 0; i < seen_numof; i++) {
+        if (seen[i] == id) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Takes a free entry for @p node, NULL if all are waiting for an ACK */
+static cocoa_pending_t *track(coap_queue_t *node, uint32_t now)
+{
+    cocoa_pending_t *pend = NULL;
+
+    for (unsigned i = 0; i < COAP_COCOA_PENDING; i++) {
+        if (!pending[i].sent) {
+            pend = &pending[i];
+            break;
+        }
+    }
+
+    if (!pend) {
+        return NULL;
+    }
+
+    pend->id = node->id;
+    pend->msgid = NTOHS(node->pdu->hdr->id);
+    pend->retransmits = 0;
+    pend->sent = now ? now : 1;
+    pend->peer = peer_get(&node->remote.addr, true);
+    pend->peer->used = now;
+    return pend;
+}
+
+void coap_cocoa_sent(coap_context_t *ctx)
+{
+    coap_tid_t fresh[COAP_COCOA_SEEN];
+    unsigned n = 0;
+    coap_queue_t *node;
+    uint32_t now = now_ms();
+
+    /* free the entries of messages libcoap dropped without an ACK we saw,
+     * e.g. after a RST */
+    for (unsigned i = 0; i < COAP_COCOA_PENDING; i++) {
+        if (pending[i].sent) {
+            LL_SEARCH_SCALAR(ctx->sendqueue, node, id, pending[i].id);
+
+            if (!node) {
+                pending[i].sent = 0;
+            }
+        }
+    }
+
+    LL_FOREACH(ctx->sendqueue, node) {
+        if (node->retransmit_cnt == 0 && !was_seen(node->id) && n < COAP_COCOA_SEEN) {
+            fresh[n++] = node->id;
+        }
+    }
+
+    /* the messages queued now are handled below, whether tracked or not */
+    seen_numof = 0;
+
+    LL_FOREACH(ctx->sendqueue, node) {
+        if (node->retransmit_cnt == 0 && seen_numof < COAP_COCOA_SEEN) {
+            seen[seen_numof++] = node->id;
+        }
+    }
+
+    for (unsigned i = 0; i < n; i++) {
+        coap_tick_t ticks;
+        cocoa_pending_t *pend;
+
+        LL_SEARCH_SCALAR(ctx->sendqueue, node, id, fresh[i]);
+
+        if (!node) {
+            continue;
+        }
+
+        stats.exchanges++;
+
+        if (!(pend = track(node, now))) {
+            /* no room, libcoap's timer stays */
+            stats.untracked++;
+            continue;
+        }
+
+        coap_remove_from_queue(&ctx->sendqueue, fresh[i], &node);
+
+        uint32_t rto = peer_rto(pend->peer, now);
+
+        /* variable backoff factor */
+        pend->bf = (rto < 1000) ? 6 : ((rto > 3000) ? 3 : 4);
+        /* dithering within [RTO, 1.5 RTO] */
+        pend->initial = rto + xorshift() % (rto / 2 + 1);
+
+        if (enabled) {
+            node->timeout = ms_to_ticks(pend->initial);
+            coap_ticks(&ticks);
+            node->t = (ticks - ctx->sendqueue_basetime) + node->timeout;
+        }
+
+        coap_insert_node(&ctx->sendqueue, node);
+    }
+}
+
+void coap_cocoa_retransmit(coap_queue_t *node)
+{
+    cocoa_pending_t *pend = pending_get(node->id);
+
+    if (!pend) {
+        return;
+    }
+
+    if (node->retransmit_cnt >= COAP_DEFAULT_MAX_RETRANSMIT) {
+        /* libcoap gives up on this one */
+        stats.failed++;
+        pend->sent = 0;
+        return;
+    }
+
+    pend->retransmits++;
+    stats.retransmissions++;
+
+    if (enabled) {
+        /* libcoap waits timeout << retransmit_cnt, so scale the timeout to
+         * get initial * (bf / 2) ^ retransmit_cnt instead */
+        unsigned cnt = node->retransmit_cnt + 1;
+        uint32_t interval = pend->initial;
+
+        for (unsigned i = 0; i < cnt && interval < COAP_COCOA_MAX_RTO; i++) {
+            interval = interval * pend->bf / 2;
+        }
+
+        if (interval > COAP_COCOA_MAX_RTO) {
+            interval = COAP_COCOA_MAX_RTO;
+        }
+
+        node->timeout = ms_to_ticks(interval) >> cnt;
+    }
+}
+
+const coap_cocoa_stats_t *coap_cocoa_stats(void)
+{
+    return &stats;
+}
+
+int coap_cocoa_cmd(int argc, char **argv)
+{
+    char addr[NG_IPV6_ADDR_MAX_STR_LEN];
+
+    if (argc > 1) {
+        if (!strcmp(argv[1], "on") || !strcmp(argv[1], "off")) {
+            enabled = (argv[1][1] == 'n');
+        }
+        else if (!strcmp(argv[1], "loss") && argc > 2) {
+            loss_percent = atoi(argv[2]) % 101;
+        }
+        else if (!strcmp(argv[1], "reset")) {
+            memset(&stats, 0, sizeof(stats));
+        }
+        else {
+            printf("usage: %s [on|off|loss <percent>|reset]\n", argv[0]);
+            return 1;
+        }
+
+        return 0;
+    }
+
+    printf("CoCoA %s, %u%% loss\n", enabled ? "on" : "off (fixed timeouts)", loss_percent);
+    printf("%-40s %7s %7s %7s\n", "peer", "RTO", "strong", "weak");
+
+    for (unsigned i = 0; i < peers_numof; i++) {
+        printf("%-40s %7lu %7lu %7lu\n",
+               ng_ipv6_addr_to_str(addr, &peers[i].addr, sizeof(addr)),
+               (unsigned long)peer_rto(&peers[i], now_ms()),
+               (unsigned long)peers[i].strong.rto, (unsigned long)peers[i].weak.rto);
+    }
+
+    printf("exchanges %lu (%lu untracked), retransmissions %lu, completed %lu, failed %lu\n",
+           (unsigned long)stats.exchanges, (unsigned long)stats.untracked,
+           (unsigned long)stats.retransmissions,
+           (unsigned long)stats.completed, (unsigned long)stats.failed);
+    printf("samples strong %lu, weak %lu, dropped rx %lu\n",
+           (unsigned long)stats.strong, (unsigned long)stats.weak,
+           (unsigned long)stats.dropped);
+
+    if (stats.completed) {
+        printf("completion avg %lu ms, max %lu ms\n",
+               (unsigned long)(stats.completion_ms / stats.completed),
+               (unsigned long)stats.completion_max);
+    }
+
+    return 0;
+}
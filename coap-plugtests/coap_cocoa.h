@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2014 Sebastian Sontberg <sebastian@sontberg.de>
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser General
+ * Public License v2.1. See the file LICENSE in the top level directory for more
+ * details.
+ */
+
+/**
+ * @file
+ * @brief       CoCoA adaptive retransmission timeouts per peer
+ *
+ * libcoap retransmits confirmable messages after ACK_TIMEOUT with binary
+ * exponential backoff, whatever the round trip time to the peer is. This
+ * module measures the RTT of every exchange and keeps a strong estimator
+ * (ACK of the first transmission) and a weak estimator (ACK after one or
+ * two retransmissions) per peer, as described in
+ * draft-ietf-core-cocoa. The CoAP thread hands every new confirmable
+ * message and every retransmission to this module, which rewrites the
+ * timeout of the send queue node accordingly.
+ *
+ * The peer table is bounded, the least recently used peer is replaced.
+ */
+
+#ifndef COAP_COCOA_H
+#define COAP_COCOA_H
+
+#include <stdint.h>
+
+#include "coap.h"
+#include "net/ng_pktbuf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief   Number of peers an RTO estimate is kept for
+ */
+#ifndef COAP_COCOA_PEERS
+#define COAP_COCOA_PEERS        (8U)
+#endif
+
+/**
+ * @brief   Number of confirmable messages tracked at the same time, at
+ *          least COAP_CLIENT_MAX_INFLIGHT plus a few separate responses
+ *
+ * Messages beyond this keep libcoap's fixed timeout.
+ */
+#ifndef COAP_COCOA_PENDING
+#define COAP_COCOA_PENDING      (40U)
+#endif
+
+/**
+ * @brief   Number of queued messages remembered as already handled, so
+ *          untracked ones aren't mistaken for new ones on the next call
+ */
+#ifndef COAP_COCOA_SEEN
+#define COAP_COCOA_SEEN         (2 * COAP_COCOA_PENDING)
+#endif
+
+/**
+ * @brief   RTO of a peer without measurements in ms
+ */
+#ifndef COAP_COCOA_INITIAL_RTO
+#define COAP_COCOA_INITIAL_RTO  (2000U)
+#endif
+
+/**
+ * @brief   Upper bound of the RTO in ms
+ */
+#ifndef COAP_COCOA_MAX_RTO
+#define COAP_COCOA_MAX_RTO      (60000U)
+#endif
+
+/**
+ * @brief   Counters of the confirmable exchanges
+ */
+typedef struct {
+    uint32_t exchanges;         /**< confirmable messages sent */
+    uint32_t untracked;         /**< of these left on the fixed timeout */
+    uint32_t retransmissions;   /**< retransmissions of these */
+    uint32_t completed;         /**< exchanges ended by an ACK or RST */
+    uint32_t failed;            /**< exchanges that ran out of retransmissions */
+    uint32_t strong;            /**< RTT samples fed to strong estimators */
+    uint32_t weak;              /**< RTT samples fed to weak estimators */
+    uint32_t dropped;           /**< received packets dropped for evaluation */
+    uint32_t completion_ms;     /**< sum of the completion times */
+    uint32_t completion_max;    /**< longest completion time */
+} coap_cocoa_stats_t;
+
+/**
+ * @brief   Inspects a received packet before libcoap handles it
+ *
+ *          Takes RTT samples from ACKs and RSTs. In evaluation mode it
+ *          drops the configured share of packets.
+ *
+ * @return  0 if the packet should be handled
+ * @return  1 if the packet was dropped (and released)
+ */
+int coap_cocoa_received(ng_pktsnip_t *pkt);
+
+/**
+ * @brief   Applies the RTO of the peer to confirmable messages libcoap
+ *          queued since the last call
+ */
+void coap_cocoa_sent(coap_context_t *ctx);
+
+/**
+ * @brief   Sets the backoff of @p node, to be called right before
+ *          coap_retransmit()
+ */
+void coap_cocoa_retransmit(coap_queue_t *node);
+
+/**
+ * @brief   Gets the counters
+ */
+const coap_cocoa_stats_t *coap_cocoa_stats(void);
+
+/**
+ * @brief   Shell command for the evaluation mode
+ *
+ *          `cocoa` prints the peer table and counters, `cocoa on|off`
+ *          switches between CoCoA and the fixed libcoap timeouts,
+ *          `cocoa loss <percent>` drops received packets at random and
+ *          `cocoa reset` clears the counters.
+ */
+int coap_cocoa_cmd(int argc, char **argv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COAP_COCOA_H */
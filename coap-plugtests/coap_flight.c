@@ -0,0 +1,459 @@
+/*
+ * Copyright (C) 2014 Sebastian Sontberg <sebastian@sontberg.de>
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser General
+ * Public License v2.1. See the file LICENSE in the top level directory for more
+ * details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hwtimer.h"
+#include "irq.h"
+#include "msg.h"
+#include "thread.h"
+#include "net/ng_netbase.h"
+#include "net/ng_ipv6/addr.h"
+#include "net/ng_ipv6/hdr.h"
+
+#include "coap_flight.h"
+#include "coap_thread.h"
+#include "pdu.h"
+#include "resource.h"
+
+#define ENABLE_DEBUG (0)
+#include "debug.h"
+
+#define NO_ACCEPT       (-1)
+
+/* libcoap expects the PDU buffer to directly follow the coap_pdu_t */
+typedef struct {
+    coap_pdu_t pdu;
+    unsigned char buf[COAP_FLIGHT_MAX_PDU];
+} flight_pdu_t;
+
+/**
+ * @brief   A client waiting for the result of a flight
+ */
+typedef struct {
+    coap_address_t peer;
+    uint8_t type;               /**< type of its request */
+    uint8_t tkl;
+    uint8_t token[8];
+} waiter_t;
+
+typedef struct {
+    coap_context_t *ctx;
+    coap_resource_t *r;         /**< NULL if the slot is unused */
+    int32_t accept;             /**< Accept value, NO_ACCEPT if none */
+    volatile bool done;         /**< handler returned, no more attaching */
+    unsigned waiters;
+    waiter_t waiter[COAP_FLIGHT_WAITERS];
+    flight_pdu_t req;           /**< first request, as NON */
+    flight_pdu_t rsp;           /**< response of the handler */
+} flight_t;
+
+/* updated by the CoAP thread only */
+typedef struct {
+    uint32_t requests;          /**< GETs of registered resources */
+    uint32_t invocations;       /**< handler runs for these */
+    uint32_t coalesced;         /**< requests attached to a running flight */
+} flight_stats_t;
+
+static coap_resource_t *registered[COAP_FLIGHT_RESOURCES];
+static flight_t flights[COAP_FLIGHT_MAX];
+static flight_stats_t stats;
+static bool enabled = true;
+
+static char worker_stack[COAP_FLIGHT_STACK_SIZE];
+static kernel_pid_t worker_pid = KERNEL_PID_UNDEF;
+static kernel_pid_t flight_coap_pid = KERNEL_PID_UNDEF;
+
+/* thundering herd run, see coap_flight_cmd() */
+static unsigned herd_expected, herd_answered;
+static bool herd_drained;
+static uint32_t herd_start;
+static flight_stats_t herd_base;
+
+static void herd_check(void)
+{
+    if (!herd_expected || !herd_drained || herd_answered < herd_expected) {
+        return;
+    }
+
+    uint32_t us = HWTIMER_TICKS_TO_US(hwtimer_now() - herd_start);
+    uint32_t req = stats.requests - herd_base.requests;
+    uint32_t inv = stats.invocations - herd_base.invocations;
+
+    printf("coap_flight: %lu requests, %lu handler runs in %lu ms (coalescing %s)\n",
+           (unsigned long)req, (unsigned long)inv, (unsigned long)(us / 1000),
+           enabled ? "on" : "off");
+
+    if (us) {
+        printf("coap_flight: %lu requests/s, %lu handler runs/s\n",
+               (unsigned long)((uint64_t)req * 1000000 / us),
+               (unsigned long)((uint64_t)inv * 1000000 / us));
+    }
+
+    herd_expected = 0;
+}
+
+static void *worker(void *arg)
+{
+    (void)arg;
+    msg_t msg, msg_queue[COAP_FLIGHT_MAX];
+
+    msg_init_queue(msg_queue, COAP_FLIGHT_MAX);
+
+    while (1) {
+        msg_receive(&msg);
+
+        flight_t *f = (flight_t *)msg.content.ptr;
+        coap_method_handler_t h = f->r->handler[COAP_REQUEST_GET - 1];
+        str token = { f->waiter[0].tkl, f->waiter[0].token };
+
+        coap_pdu_clear(&f->rsp.pdu, sizeof(f->rsp.buf));
+        f->rsp.pdu.hdr->type = COAP_MESSAGE_NON;
+        coap_add_token(&f->rsp.pdu, token.length, token.s);
+
+        /* the request is passed as NON, so handlers like the one of
+         * /separate leave the ACK to us and don't touch the context */
+        h(f->ctx, f->r, f->ctx->endpoint, &f->waiter[0].peer, &f->req.pdu,
+          &token, &f->rsp.pdu);
+        f->done = true;
+
+        msg.type = COAP_FLIGHT_MSG_DONE;
+        msg_send(&msg, flight_coap_pid);
+    }
+
+    /* never reached */
+    return NULL;
+}
+
+kernel_pid_t coap_flight_init(kernel_pid_t coap_pid)
+{
+    flight_coap_pid = coap_pid;
+
+    if (worker_pid == KERNEL_PID_UNDEF) {
+        worker_pid = thread_create(worker_stack, sizeof(worker_stack), COAP_FLIGHT_PRIO,
+                                   CREATE_STACKTEST, worker, NULL, "coap_flight");
+    }
+
+    return worker_pid;
+}
+
+int coap_flight_register(coap_resource_t *r)
+{
+    for (unsigned i = 0; i < COAP_FLIGHT_RESOURCES; i++) {
+        if (!registered[i] || registered[i] == r) {
+            registered[i] = r;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static bool is_registered(coap_resource_t *r)
+{
+    for (unsigned i = 0; i < COAP_FLIGHT_RESOURCES && registered[i]; i++) {
+        if (registered[i] == r) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static flight_t *flight_get(coap_context_t *ctx, coap_resource_t *r, int32_t accept)
+{
+    flight_t *slot = NULL;
+
+    for (unsigned i = 0; i < COAP_FLIGHT_MAX; i++) {
+        flight_t *f = &flights[i];
+
+        if (f->r == r && f->accept == accept && !f->done) {
+            return f;
+        }
+
+        if (!f->r && !slot) {
+            slot = f;
+        }
+    }
+
+    if (slot) {
+        slot->ctx = ctx;
+        slot->accept = accept;
+        slot->done = false;
+        slot->waiters = 0;
+    }
+
+    return slot;
+}
+
+int coap_flight_request(coap_context_t *ctx, ng_pktsnip_t *pkt)
+{
+    static flight_pdu_t in;
+    ng_pktsnip_t *ip = NULL, *udp = NULL;
+    coap_opt_iterator_t opt_iter;
+    coap_opt_t *opt;
+    coap_resource_t *r;
+    coap_key_t key;
+    int32_t accept = NO_ACCEPT;
+    flight_t *f;
+    waiter_t *w;
+    bool start;
+
+    if (!registered[0] || worker_pid == KERNEL_PID_UNDEF || pkt->size < 4 ||
+        pkt->size > sizeof(in.buf) || ((uint8_t *)pkt->data)[1] != COAP_REQUEST_GET) {
+        return 0;
+    }
+
+    for (ng_pktsnip_t *s = pkt; s; s = s->next) {
+        if (s->type == NG_NETTYPE_IPV6) {
+            ip = s;
+        }
+        else if (s->type == NG_NETTYPE_UDP) {
+            udp = s;
+        }
+    }
+
+    coap_pdu_clear(&in.pdu, sizeof(in.buf));
+
+    if (!ip || !udp || !coap_pdu_parse(pkt->data, pkt->size, &in.pdu)) {
+        return 0;
+    }
+
+    coap_hash_request_uri(&in.pdu, key);
+    r = coap_get_resource_from_key(ctx, key);
+
+    if (!r || !is_registered(r)) {
+        return 0;
+    }
+
+    stats.requests++;
+
+    if (!enabled) {
+        /* libcoap runs the handler for every request */
+        stats.invocations++;
+        herd_answered++;
+        return 0;
+    }
+
+    opt = coap_check_option(&in.pdu, COAP_OPTION_ACCEPT, &opt_iter);
+
+    if (opt) {
+        accept = coap_decode_var_bytes(COAP_OPT_VALUE(opt), COAP_OPT_LENGTH(opt));
+    }
+
+    f = flight_get(ctx, r, accept);
+
+    if (!f || f->waiters == COAP_FLIGHT_WAITERS) {
+        /* no room, libcoap runs the handler in the CoAP thread */
+        stats.invocations++;
+        herd_answered++;
+        return 0;
+    }
+
+    start = (f->r == NULL);
+    w = &f->waiter[f->waiters++];
+    memset(&w->peer, 0, sizeof(w->peer));
+    memcpy(&w->peer.addr, &((ng_ipv6_hdr_t *)ip->data)->src, sizeof(ng_ipv6_addr_t));
+    w->peer.port = (((uint8_t *)udp->data)[0] << 8) | ((uint8_t *)udp->data)[1];
+    w->type = in.pdu.hdr->type;
+    w->tkl = in.pdu.hdr->token_length;
+    memcpy(w->token, in.pdu.hdr->token, w->tkl);
+
+    if (w->type == COAP_MESSAGE_CON) {
+        /* the response will be a separate one */
+        coap_send_ack(ctx, ctx->endpoint, &w->peer, &in.pdu);
+    }
+
+    if (start) {
+        msg_t msg;
+
+        f->r = r;
+        memcpy(&f->req, &in, sizeof(in));
+        f->req.pdu.hdr = (coap_hdr_t *)f->req.buf;
+        f->req.pdu.hdr->type = COAP_MESSAGE_NON;
+
+        if (in.pdu.data) {
+            f->req.pdu.data = f->req.buf + (in.pdu.data - in.buf);
+        }
+
+        msg.type = 0;
+        msg.content.ptr = (char *)f;
+        msg_try_send(&msg, worker_pid);
+    }
+    else {
+        stats.coalesced++;
+        DEBUG("flight: attached request %u to running flight\n", f->waiters);
+    }
+
+    ng_pktbuf_release(pkt);
+    return 1;
+}
+
+void coap_flight_done(coap_context_t *ctx, void *flight)
+{
+    flight_t *f = (flight_t *)flight;
+    uint8_t buf[COAP_FLIGHT_MAX_PDU + 8];
+
+    if (!f) {
+        /* the herd's requests are all through the CoAP thread */
+        herd_drained = true;
+        herd_check();
+        return;
+    }
+
+    size_t skip = sizeof(coap_hdr_t) + f->rsp.pdu.hdr->token_length;
+    size_t rest = f->rsp.pdu.length - skip;
+
+    /* counted here, stats are only touched by the CoAP thread */
+    stats.invocations++;
+
+    for (unsigned i = 0; i < f->waiters; i++) {
+        waiter_t *w = &f->waiter[i];
+        unsigned short id = coap_new_message_id(ctx);
+        uint8_t type = (w->type == COAP_MESSAGE_CON) ? COAP_MESSAGE_CON : COAP_MESSAGE_NON;
+        coap_pdu_t *pdu = coap_pdu_init(0, 0, 0, COAP_MAX_PDU_SIZE);
+
+        if (!pdu) {
+            continue;
+        }
+
+        /* same options and payload, own token and message ID */
+        buf[0] = 0x40 | (type << 4) | w->tkl;
+        buf[1] = f->rsp.pdu.hdr->code;
+        memcpy(buf + 2, &id, 2);
+        memcpy(buf + 4, w->token, w->tkl);
+        memcpy(buf + 4 + w->tkl, (uint8_t *)f->rsp.pdu.hdr + skip, rest);
+
+        if (!coap_pdu_parse(buf, 4 + w->tkl + rest, pdu)) {
+            coap_delete_pdu(pdu);
+            continue;
+        }
+
+        if (type == COAP_MESSAGE_CON) {
+            if (coap_send_confirmed(ctx, ctx->endpoint, &w->peer, pdu) == COAP_INVALID_TID) {
+                coap_delete_pdu(pdu);
+            }
+        }
+        else {
+            coap_send(ctx, ctx->endpoint, &w->peer, pdu);
+            coap_delete_pdu(pdu);
+        }
+    }
+
+    herd_answered += f->waiters;
+    f->waiters = 0;
+    f->r = NULL;
+    herd_check();
+}
+
+/* Injects a NON GET of /separate from fd00::<n> as if ng_udp received it */
+static int herd_inject(unsigned n)
+{
+    static const uint8_t coap[] = {
+        0x52, COAP_REQUEST_GET, 0, 0, 0, 0,         /* NON, TKL 2 */
+        0xb8, 's', 'e', 'p', 'a', 'r', 'a', 't', 'e'
+    };
+    uint8_t hdr[40 + 8], msg[sizeof(coap)];
+    ng_pktsnip_t *ip, *udp, *payload;
+
+    memset(hdr, 0, sizeof(hdr));
+    hdr[0] = 0x60;
+    hdr[5] = 8 + sizeof(coap);
+    hdr[6] = 17;
+    hdr[7] = 64;
+    hdr[8] = 0xfd;
+    hdr[22] = n >> 8;
+    hdr[23] = n & 0xff;
+    hdr[24] = 0xfd;
+    hdr[39] = 1;
+    hdr[40] = 0xc0;
+    hdr[41] = n & 0xff;
+    hdr[42] = COAP_PORT >> 8;
+    hdr[43] = COAP_PORT & 0xff;
+    hdr[45] = 8 + sizeof(coap);
+
+    memcpy(msg, coap, sizeof(coap));
+    msg[2] = n >> 8;
+    msg[3] = n & 0xff;
+    msg[4] = n >> 8;
+    msg[5] = n & 0xff;
+
+    ip = ng_pktbuf_add(NULL, hdr, 40, NG_NETTYPE_IPV6);
+    udp = ip ? ng_pktbuf_add(ip, hdr + 40, 8, NG_NETTYPE_UDP) : NULL;
+    payload = udp ? ng_pktbuf_add(udp, msg, sizeof(msg), NG_NETTYPE_UNDEF) : NULL;
+
+    if (!payload) {
+        if (udp || ip) {
+            ng_pktbuf_release(udp ? udp : ip);
+        }
+
+        return -1;
+    }
+
+    if (ng_netapi_receive(flight_coap_pid, payload) < 1) {
+        ng_pktbuf_release(payload);
+        return -1;
+    }
+
+    return 0;
+}
+
+int coap_flight_cmd(int argc, char **argv)
+{
+    if (argc > 1) {
+        if (!strcmp(argv[1], "on") || !strcmp(argv[1], "off")) {
+            enabled = (argv[1][1] == 'n');
+        }
+        else if (!strcmp(argv[1], "reset")) {
+            /* the CoAP thread may preempt us */
+            unsigned state = disableIRQ();
+
+            memset(&stats, 0, sizeof(stats));
+            restoreIRQ(state);
+        }
+        else if (!strcmp(argv[1], "herd") && argc > 2) {
+            msg_t msg;
+            unsigned n = atoi(argv[2]);
+
+            if (flight_coap_pid == KERNEL_PID_UNDEF || herd_expected) {
+                puts("coap_flight: CoAP thread not running or herd still running");
+                return 1;
+            }
+
+            herd_base = stats;
+            herd_answered = 0;
+            herd_drained = false;
+            herd_expected = n;
+            herd_start = hwtimer_now();
+
+            for (unsigned i = 1; i <= n; i++) {
+                if (herd_inject(i) < 0) {
+                    herd_expected--;
+                }
+            }
+
+            /* marks the point where all requests went through */
+            msg.type = COAP_FLIGHT_MSG_DONE;
+            msg.content.ptr = NULL;
+            msg_send(&msg, flight_coap_pid);
+        }
+        else {
+            printf("usage: %s [on|off|reset|herd <n>]\n", argv[0]);
+            return 1;
+        }
+
+        return 0;
+    }
+
+    printf("coalescing %s: %lu requests, %lu handler runs, %lu coalesced\n",
+           enabled ? "on" : "off", (unsigned long)stats.requests,
+           (unsigned long)stats.invocations, (unsigned long)stats.coalesced);
+    return 0;
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2014 Sebastian Sontberg <sebastian@sontberg.de>
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser General
+ * Public License v2.1. See the file LICENSE in the top level directory for more
+ * details.
+ */
+
+/**
+ * @file
+ * @brief       Single-flight coalescing of identical GET requests
+ *
+ * GETs of resources registered with coap_flight_register() are taken
+ * out of libcoap's dispatch. The first request for a resource and Accept
+ * value starts the handler on a worker thread. Requests for the same
+ * resource and Accept value that arrive while it runs attach to this
+ * flight instead of running the handler again. Confirmable requests are
+ * acknowledged at once. When the handler is done, every attached client
+ * gets the same encoded response, patched with its own token and message
+ * ID, as a separate response.
+ *
+ * Only register resources whose GET handler is idempotent, doesn't use
+ * the context and doesn't depend on the requesting peer.
+ */
+
+#ifndef COAP_FLIGHT_H
+#define COAP_FLIGHT_H
+
+#include <stdint.h>
+
+#include "kernel.h"
+#include "coap.h"
+#include "net/ng_pktbuf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief   Message type the worker uses to report a finished flight
+ */
+#define COAP_FLIGHT_MSG_DONE        (0x464c)
+
+/**
+ * @brief   Maximum number of resources that can be registered
+ */
+#ifndef COAP_FLIGHT_RESOURCES
+#define COAP_FLIGHT_RESOURCES       (4U)
+#endif
+
+/**
+ * @brief   Maximum number of flights at the same time, a power of 2
+ */
+#ifndef COAP_FLIGHT_MAX
+#define COAP_FLIGHT_MAX             (4U)
+#endif
+
+/**
+ * @brief   Maximum number of requests attached to one flight
+ */
+#ifndef COAP_FLIGHT_WAITERS
+#define COAP_FLIGHT_WAITERS         (16U)
+#endif
+
+/**
+ * @brief   Largest request and response of a flight
+ */
+#ifndef COAP_FLIGHT_MAX_PDU
+#define COAP_FLIGHT_MAX_PDU         (256U)
+#endif
+
+/**
+ * @brief   Priority of the worker running the handlers
+ */
+#ifndef COAP_FLIGHT_PRIO
+#define COAP_FLIGHT_PRIO            (PRIORITY_MAIN - 1)
+#endif
+
+#ifndef COAP_FLIGHT_STACK_SIZE
+#define COAP_FLIGHT_STACK_SIZE      (KERNEL_CONF_STACKSIZE_DEFAULT)
+#endif
+
+/**
+ * @brief   Starts the worker thread
+ *
+ * @param[in] coap_pid  PID of the thread running coap_run_context().
+ *
+ * @return  PID of the worker
+ */
+kernel_pid_t coap_flight_init(kernel_pid_t coap_pid);
+
+/**
+ * @brief   Coalesces GET requests for @p r
+ *
+ * @return  0 on success
+ * @return  -1 if all COAP_FLIGHT_RESOURCES are taken
+ */
+int coap_flight_register(coap_resource_t *r);
+
+/**
+ * @brief   Takes a received request out of libcoap's dispatch if it can
+ *          be coalesced, called by the CoAP thread
+ *
+ * @return  1 if the request was taken, @p pkt is released then
+ * @return  0 if libcoap should handle it
+ */
+int coap_flight_request(coap_context_t *ctx, ng_pktsnip_t *pkt);
+
+/**
+ * @brief   Sends the response of a finished flight to all attached
+ *          clients, called by the CoAP thread on COAP_FLIGHT_MSG_DONE
+ */
+void coap_flight_done(coap_context_t *ctx, void *flight);
+
+/**
+ * @brief   Shell command printing handler and request rates
+ *
+ *          `coap_flight herd <n>` injects @p n GETs of /separate from
+ *          different peers at once, `coap_flight on|off` switches
+ *          coalescing and `coap_flight reset` clears the counters.
+ */
+int coap_flight_cmd(int argc, char **argv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COAP_FLIGHT_H */
@@ -9,6 +9,11 @@
 #include <stdio.h>
 
 #include "coap_handlers.h"
+#include "coap_flight.h"
+#include "coap_persist.h"
+#include "coap_stream.h"
+#include "coap_wkc.h"
+#include "hwtimer.h"
 #include "pdu.h"
 #include "str.h"
 #include "vtimer.h"
@@ -49,6 +54,7 @@
 
 static str *local_data = NULL;
 static coap_key_t local_key;
+static int create1;
 
 static inline void set_and_hash(size_t len, unsigned char *data)
 {
@@ -68,7 +74,29 @@ static inline void set_and_hash(size_t len, unsigned char *data)
 
 void init_local_data(void)
 {
-    set_and_hash(strlen(INDEX), (unsigned char *)INDEX);
+    uint8_t data[COAP_PERSIST_MAX_DATA];
+    size_t len;
+
+    /* rebuild the state from the journal of the last run */
+    switch (coap_persist_restore(coap_persist_default_backend, data, &len)) {
+        case 1:
+            set_and_hash(len, data);
+            break;
+
+        case 0:
+            /* deleted before the restart */
+            break;
+
+        default:
+            set_and_hash(strlen(INDEX), (unsigned char *)INDEX);
+            break;
+    }
+}
+
+void reset_handlers(void)
+{
+    create1 = 0;
+    init_local_data();
 }
 
 void index_handler(coap_context_t  *ctx, struct coap_resource_t *resource,
@@ -156,6 +184,7 @@ void td_coap_core_02(coap_context_t  *ctx, struct coap_resource_t *resource,
     if (local_data) {
         coap_delete_string(local_data);
         local_data = NULL;
+        coap_persist_delete();
     }
 
     response->hdr->code = COAP_RESPONSE_CODE(202);
@@ -200,6 +229,10 @@ void td_coap_core_03(coap_context_t  *ctx, struct coap_resource_t *resource,
         }
 
         set_and_hash(len, data);
+
+        if (coap_persist_set(data, len) < 0) {
+            printf("state of %u bytes too large to persist\n", (unsigned)len);
+        }
     }
     else {
         response->hdr->code = COAP_RESPONSE_CODE(500);
@@ -397,7 +430,6 @@ void td_coap_core_23(coap_context_t  *ctx, struct coap_resource_t *resource,
     (void) resource;
     (void) token;
 
-    static int create1;
     coap_opt_iterator_t opt_iter;
     coap_opt_t *none_match = coap_check_option(request, COAP_OPTION_IF_NONE_MATCH, &opt_iter);
 
@@ -441,7 +473,6 @@ void td_coap_block_01(coap_context_t  *ctx, struct coap_resource_t *resource,
 {
     /* see index_handler */
     (void) ctx;
-    (void) local_interface;
     (void) peer;
     (void) resource;
     (void) token;
@@ -454,12 +485,29 @@ void td_coap_block_01(coap_context_t  *ctx, struct coap_resource_t *resource,
     coap_add_option(response, COAP_OPTION_CONTENT_TYPE,
                     coap_encode_var_bytes(buf, COAP_MEDIATYPE_TEXT_PLAIN), buf);
 
+    if (local_interface->flags & COAP_ENDPOINT_STREAM &&
+        !coap_get_block(request, COAP_OPTION_BLOCK2, &block)) {
+        /* a stream carries the whole representation at once */
+        coap_add_data(response, strlen(LARGE), (unsigned char *)LARGE);
+        coap_transfer_done(&coap_stats_stream, strlen(LARGE));
+        return;
+    }
+
     if (coap_get_block(request, COAP_OPTION_BLOCK2, &block)) {
+        if (block.num == 0) {
+            coap_transfer_start(&coap_stats_udp, hwtimer_now());
+        }
+
         ret = coap_write_block_opt(&block, COAP_OPTION_BLOCK2, response, strlen(LARGE));
 
         coap_add_block(response, strlen(LARGE), (unsigned char *)LARGE, block.num, block.szx);
+
+        if (!block.m) {
+            coap_transfer_done(&coap_stats_udp, strlen(LARGE));
+        }
     }
     else {
+        coap_transfer_start(&coap_stats_udp, hwtimer_now());
         /* 2**(4+2) = 64 bytes block-size avoids 6LoWPan fragmentation */
         block.szx = 2;
         ret = coap_write_block_opt(&block, COAP_OPTION_BLOCK2, response, strlen(LARGE));
@@ -505,7 +553,7 @@ void register_handlers(coap_context_t *ctx)
 
     r = coap_resource_init(NULL, 0, 0);
     coap_register_handler(r, COAP_REQUEST_GET, (coap_method_handler_t)index_handler);
-    coap_add_resource(ctx, r);
+    coap_wkc_add_resource(ctx, r);
 
     /* TD_COAP_CORE_{01..08} */
     r = coap_resource_init((unsigned char *)"test", 4, 0);
@@ -515,77 +563,82 @@ void register_handlers(coap_context_t *ctx)
     coap_register_handler(r, COAP_REQUEST_POST, (coap_method_handler_t)td_coap_core_04);
     coap_add_attr(r, (unsigned char *)"rt", 2, (unsigned char *)"\"Type1 Type2\"", 13, 0);
     coap_add_attr(r, (unsigned char *)"if", 2, (unsigned char *)"\"If1\"", 5, 0);
-    coap_add_resource(ctx, r);
+    coap_wkc_add_resource(ctx, r);
 
     r = coap_resource_init((unsigned char *)"link1", 5, 0);
     coap_register_handler(r, COAP_REQUEST_GET, (coap_method_handler_t)td_coap_core_01);
-    coap_add_resource(ctx, r);
+    coap_wkc_add_resource(ctx, r);
 
     r = coap_resource_init((unsigned char *)"link2", 5, 0);
     coap_register_handler(r, COAP_REQUEST_GET, (coap_method_handler_t)td_coap_core_01);
-    coap_add_resource(ctx, r);
+    coap_wkc_add_resource(ctx, r);
 
     r = coap_resource_init((unsigned char *)"link3", 5, 0);
     coap_register_handler(r, COAP_REQUEST_GET, (coap_method_handler_t)td_coap_core_01);
-    coap_add_resource(ctx, r);
+    coap_wkc_add_resource(ctx, r);
 
     r = coap_resource_init((unsigned char *)"path", 4, 0);
     coap_register_handler(r, COAP_REQUEST_GET, (coap_method_handler_t)td_coap_link_09);
     coap_add_attr(r, (unsigned char *)"ct", 2, (unsigned char *)"40", 2, 0);
-    coap_add_resource(ctx, r);
+    coap_wkc_add_resource(ctx, r);
 
     r = coap_resource_init((unsigned char *)"path/sub1", 9, 0);
     coap_register_handler(r, COAP_REQUEST_GET, (coap_method_handler_t)td_coap_core_01);
-    coap_add_resource(ctx, r);
+    coap_wkc_add_resource(ctx, r);
 
     /* TD_COAP_CORE_09 */
     r = coap_resource_init((unsigned char *)"separate", 8, 0);
     coap_register_handler(r, COAP_REQUEST_GET, (coap_method_handler_t)td_coap_core_09);
     coap_add_attr(r, (unsigned char *)"rt", 2, (unsigned char *)"\"Type2 Type3\"", 13, 0);
     coap_add_attr(r, (unsigned char *)"if", 2, (unsigned char *)"\"If2\"", 5, 0);
-    coap_add_resource(ctx, r);
+    coap_wkc_add_resource(ctx, r);
+    coap_flight_register(r);
 
     /* TD_COAP_CORE_13 */
     r = coap_resource_init((unsigned char *)"seg1/seg2/seg3", 14, 0);
     coap_register_handler(r, COAP_REQUEST_GET, (coap_method_handler_t)td_coap_core_01);
     coap_add_attr(r, (unsigned char *)"rt", 2, (unsigned char *)"\"Type1 Type3\"", 13, 0);
     coap_add_attr(r, (unsigned char *)"if", 2, (unsigned char *)"\"foo\"", 5, 0);
-    coap_add_resource(ctx, r);
+    coap_wkc_add_resource(ctx, r);
 
     /* TD_COAP_CORE_14 */
     r = coap_resource_init((unsigned char *)"query", 5, 0);
     coap_register_handler(r, COAP_REQUEST_GET, (coap_method_handler_t)td_coap_core_01);
-    coap_add_resource(ctx, r);
+    coap_wkc_add_resource(ctx, r);
 
     /* TD_COAP_CORE_19 */
     r = coap_resource_init((unsigned char *)"location-query", 14, 0);
     coap_register_handler(r, COAP_REQUEST_POST, (coap_method_handler_t)td_coap_core_19);
-    coap_add_resource(ctx, r);
+    coap_wkc_add_resource(ctx, r);
 
     /* TD_COAP_CORE_20 */
     r = coap_resource_init((unsigned char *)"multi-format", 12, 0);
     coap_register_handler(r, COAP_REQUEST_GET, (coap_method_handler_t)td_coap_core_20);
-    coap_add_resource(ctx, r);
+    coap_wkc_add_resource(ctx, r);
 
     /* TD_COAP_CORE_21 */
     r = coap_resource_init((unsigned char *)"validate", 8, 0);
     coap_register_handler(r, COAP_REQUEST_GET, (coap_method_handler_t)td_coap_core_21);
     coap_register_handler(r, COAP_REQUEST_PUT, (coap_method_handler_t)td_coap_core_03);
-    coap_add_resource(ctx, r);
+    coap_wkc_add_resource(ctx, r);
 
     /* TD_COAP_CORE_23 */
     r = coap_resource_init((unsigned char *)"create1", 7, 0);
     coap_register_handler(r, COAP_REQUEST_PUT, (coap_method_handler_t)td_coap_core_23);
-    coap_add_resource(ctx, r);
+    coap_wkc_add_resource(ctx, r);
 
     /* TD_COAP_BLOCK_01 */
     r = coap_resource_init((unsigned char *)"large", 5, 0);
     coap_register_handler(r, COAP_REQUEST_GET, (coap_method_handler_t)td_coap_block_01);
-    coap_add_resource(ctx, r);
+    coap_wkc_add_resource(ctx, r);
 
     r = coap_resource_init((unsigned char *)"threads", 7, 0);
     coap_register_handler(r, COAP_REQUEST_GET, (coap_method_handler_t)threads_handler);
-    coap_add_resource(ctx, r);
+    coap_wkc_add_resource(ctx, r);
+
+    /* Discovery, answered from a document rendered after the last
+     * change to the resources above */
+    coap_wkc_register(ctx);
 
     init_local_data();
 }
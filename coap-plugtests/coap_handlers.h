@@ -87,6 +87,9 @@ void td_coap_block_01(coap_context_t  *ctx, struct coap_resource_t *resource,
 
 void init_local_data(void);
 
+/* Returns the resources to the state init_local_data() leaves them in */
+void reset_handlers(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,348 @@
+/*
+ * Copyright (C) 2014 Sebastian Sontberg <sebastian@sontberg.de>
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser General
+ * Public License v2.1. See the file LICENSE in the top level directory for more
+ * details.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "irq.h"
+#include "kernel.h"
+#include "msg.h"
+#include "thread.h"
+#include "vtimer.h"
+
+#include "coap_persist.h"
+
+#define ENABLE_DEBUG (0)
+#include "debug.h"
+
+#define MSG_FLUSH       (0x5053)
+
+/* Record layout: magic, op, length (little endian), data, fletcher16 */
+#define REC_MAGIC       (0xc5)
+#define REC_OP_SET      (1)
+#define REC_OP_DELETE   (2)
+#define REC_HDR_LEN     (4)
+#define REC_TRL_LEN     (2)
+#define REC_MAX_LEN     (REC_HDR_LEN + COAP_PERSIST_MAX_DATA + REC_TRL_LEN)
+
+/**
+ * @brief   Time the writer lets updates accumulate before flushing
+ */
+#ifndef COAP_PERSIST_BATCH_US
+#define COAP_PERSIST_BATCH_US   (100U * 1000U)
+#endif
+
+static char writer_stack[COAP_PERSIST_STACK_SIZE];
+static kernel_pid_t writer_pid = KERNEL_PID_UNDEF;
+static const coap_persist_backend_t *persist;
+
+/* Handlers write into stage[cur]. The writer flips cur with interrupts
+ * disabled and does the I/O from the other stage, so the CoAP thread never
+ * waits for the low priority writer, which a mutex would make it do as
+ * soon as a thread in between preempts the writer holding it. */
+static uint8_t stage[2][COAP_PERSIST_STAGE_SIZE];
+static size_t stage_len[2];
+static unsigned cur;
+
+static size_t log_size;
+
+static uint16_t fletcher16(const uint8_t *data, size_t len)
+{
+    uint16_t a = 0, b = 0;
+
+    while (len--) {
+        a = (a + *data++) % 255;
+        b = (b + a) % 255;
+    }
+
+    return (b << 8) | a;
+}
+
+static size_t encode(uint8_t *rec, uint8_t op, const uint8_t *data, size_t len)
+{
+    uint16_t sum;
+
+    rec[0] = REC_MAGIC;
+    rec[1] = op;
+    rec[2] = len & 0xff;
+    rec[3] = len >> 8;
+    memcpy(rec + REC_HDR_LEN, data, len);
+    sum = fletcher16(rec + 1, REC_HDR_LEN - 1 + len);
+    rec[REC_HDR_LEN + len] = sum & 0xff;
+    rec[REC_HDR_LEN + len + 1] = sum >> 8;
+
+    return REC_HDR_LEN + len + REC_TRL_LEN;
+}
+
+static void stage_record(uint8_t op, const uint8_t *data, size_t len)
+{
+    /* a record is at most REC_MAX_LEN bytes, short enough to encode with
+     * interrupts off */
+    unsigned state = disableIRQ();
+
+    /* every record carries the full state, so once the stage is full the
+     * pending ones are superseded by the new record anyway */
+    if (stage_len[cur] + REC_HDR_LEN + len + REC_TRL_LEN > sizeof(stage[cur])) {
+        DEBUG("coap_persist: stage full, coalescing\n");
+        stage_len[cur] = 0;
+    }
+
+    stage_len[cur] += encode(stage[cur] + stage_len[cur], op, data, len);
+
+    restoreIRQ(state);
+
+    if (writer_pid != KERNEL_PID_UNDEF) {
+        msg_t m;
+        m.type = MSG_FLUSH;
+        /* a flush already pending covers this record, too */
+        msg_try_send(&m, writer_pid);
+    }
+}
+
+int coap_persist_set(const uint8_t *data, size_t len)
+{
+    if (len > COAP_PERSIST_MAX_DATA) {
+        return -1;
+    }
+
+    stage_record(REC_OP_SET, data, len);
+    return 0;
+}
+
+void coap_persist_delete(void)
+{
+    stage_record(REC_OP_DELETE, NULL, 0);
+}
+
+/* Returns the offset of the last record in the batch */
+static size_t last_record(const uint8_t *buf, size_t len)
+{
+    size_t pos = 0, last = 0;
+
+    while (pos < len) {
+        last = pos;
+        pos += REC_HDR_LEN + (buf[pos + 2] | (buf[pos + 3] << 8)) + REC_TRL_LEN;
+    }
+
+    return last;
+}
+
+static void *writer(void *arg)
+{
+    (void)arg;
+    msg_t m, msg_q[2];
+
+    msg_init_queue(msg_q, 2);
+
+    while (1) {
+        uint8_t *batch;
+        size_t len;
+        unsigned state;
+
+        msg_receive(&m);
+
+        if (m.type != MSG_FLUSH) {
+            continue;
+        }
+
+        /* let a burst of updates pile up and write them in one go */
+        vtimer_usleep(COAP_PERSIST_BATCH_US);
+
+        /* the other stage was written out before, handlers continue there */
+        state = disableIRQ();
+        batch = stage[cur];
+        len = stage_len[cur];
+        cur ^= 1;
+        stage_len[cur] = 0;
+        restoreIRQ(state);
+
+        if (len == 0) {
+            continue;
+        }
+
+        if (log_size + len > COAP_PERSIST_COMPACT_SIZE) {
+            size_t last = last_record(batch, len);
+
+            if (persist->replace(batch + last, len - last) == 0) {
+                DEBUG("coap_persist: compacted %u bytes to %u\n",
+                      (unsigned)(log_size + len), (unsigned)(len - last));
+                log_size = len - last;
+                continue;
+            }
+        }
+
+        if (persist->append(batch, len) == 0) {
+            log_size += len;
+        }
+        else {
+            printf("coap_persist: writing %u bytes failed\n", (unsigned)len);
+        }
+    }
+
+    /* never reached */
+    return NULL;
+}
+
+int coap_persist_restore(const coap_persist_backend_t *backend,
+                         uint8_t *data, size_t *len)
+{
+    uint8_t rec[REC_MAX_LEN];
+    uint8_t last[REC_MAX_LEN];
+    size_t offset = 0;
+    size_t last_len = 0;
+    unsigned count = 0;
+    int res = -1;
+
+    if (!backend) {
+        return -1;
+    }
+
+    while (1) {
+        ssize_t n = backend->read(offset, rec, REC_HDR_LEN);
+        size_t dlen;
+        uint16_t sum;
+
+        if (n < REC_HDR_LEN || rec[0] != REC_MAGIC) {
+            break;
+        }
+
+        dlen = rec[2] | (rec[3] << 8);
+
+        if (dlen > COAP_PERSIST_MAX_DATA ||
+            backend->read(offset + REC_HDR_LEN, rec + REC_HDR_LEN,
+                          dlen + REC_TRL_LEN) < (ssize_t)(dlen + REC_TRL_LEN)) {
+            break;
+        }
+
+        sum = rec[REC_HDR_LEN + dlen] | (rec[REC_HDR_LEN + dlen + 1] << 8);
+
+        if (sum != fletcher16(rec + 1, REC_HDR_LEN - 1 + dlen)) {
+            break;
+        }
+
+        if (rec[1] == REC_OP_SET) {
+            memcpy(data, rec + REC_HDR_LEN, dlen);
+            *len = dlen;
+            res = 1;
+        }
+        else {
+            res = 0;
+        }
+
+        last_len = REC_HDR_LEN + dlen + REC_TRL_LEN;
+        memcpy(last, rec, last_len);
+        offset += last_len;
+        count++;
+    }
+
+    log_size = offset;
+
+    /* Anything behind the last intact record is a torn write from a
+     * crash. Appending behind it would hide all further records from the
+     * next replay, so start over from the last good state. */
+    if (backend->read(offset, rec, 1) > 0 || offset > COAP_PERSIST_COMPACT_SIZE) {
+        if (backend->replace(last, last_len) == 0) {
+            log_size = last_len;
+        }
+    }
+
+    DEBUG("coap_persist: replayed %u records\n", count);
+    return res;
+}
+
+kernel_pid_t coap_persist_init(const coap_persist_backend_t *backend)
+{
+    if (!backend) {
+        puts("coap_persist: no storage backend, state won't survive reboots");
+        return KERNEL_PID_UNDEF;
+    }
+
+    persist = backend;
+    writer_pid = thread_create(writer_stack, sizeof(writer_stack),
+                               COAP_PERSIST_PRIO, CREATE_STACKTEST,
+                               writer, NULL, "coap_persist");
+
+    /* flush what was staged before the writer existed */
+    if (writer_pid != KERNEL_PID_UNDEF && stage_len[cur]) {
+        msg_t m;
+        m.type = MSG_FLUSH;
+        msg_try_send(&m, writer_pid);
+    }
+
+    return writer_pid;
+}
+
+/* a replay starts from a fresh state */
+#if defined(BOARD_NATIVE) && !defined(COAP_REPLAY)
+#include "native_internal.h"
+
+/* Host stdio must not be interrupted by the native scheduler */
+
+static int file_append(const uint8_t *data, size_t len)
+{
+    int res = -1;
+    _native_syscall_enter();
+    FILE *f = fopen(COAP_PERSIST_FILE, "ab");
+
+    if (f) {
+        res = (fwrite(data, 1, len, f) == len && fflush(f) == 0) ? 0 : -1;
+        fclose(f);
+    }
+
+    _native_syscall_leave();
+    return res;
+}
+
+static ssize_t file_read(size_t offset, uint8_t *data, size_t len)
+{
+    ssize_t res = -1;
+    _native_syscall_enter();
+    FILE *f = fopen(COAP_PERSIST_FILE, "rb");
+
+    if (f) {
+        if (fseek(f, offset, SEEK_SET) == 0) {
+            res = fread(data, 1, len, f);
+        }
+
+        fclose(f);
+    }
+
+    _native_syscall_leave();
+    return res;
+}
+
+static int file_replace(const uint8_t *data, size_t len)
+{
+    int res = -1;
+    _native_syscall_enter();
+    FILE *f = fopen(COAP_PERSIST_FILE ".tmp", "wb");
+
+    if (f) {
+        res = (fwrite(data, 1, len, f) == len && fflush(f) == 0) ? 0 : -1;
+        fclose(f);
+
+        if (res == 0) {
+            res = rename(COAP_PERSIST_FILE ".tmp", COAP_PERSIST_FILE);
+        }
+    }
+
+    _native_syscall_leave();
+    return res;
+}
+
+static const coap_persist_backend_t file_backend = {
+    .append = file_append,
+    .read = file_read,
+    .replace = file_replace,
+};
+
+const coap_persist_backend_t *coap_persist_default_backend = &file_backend;
+#else
+const coap_persist_backend_t *coap_persist_default_backend = NULL;
+#endif
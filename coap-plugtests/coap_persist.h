@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2014 Sebastian Sontberg <sebastian@sontberg.de>
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser General
+ * Public License v2.1. See the file LICENSE in the top level directory for more
+ * details.
+ */
+
+/**
+ * @file
+ * @brief       Write-behind journal for the state of the /test resource
+ *
+ * Every update is staged in RAM and appended to an append-only log by a
+ * low priority writer thread, so request handlers never wait for storage.
+ * Each record carries the complete state, so replaying the log means
+ * taking the last intact record, and compaction means rewriting the log
+ * with just that record.
+ */
+
+#ifndef COAP_PERSIST_H
+#define COAP_PERSIST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "kernel.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief   Largest state that is persisted
+ */
+#ifndef COAP_PERSIST_MAX_DATA
+#define COAP_PERSIST_MAX_DATA       (256U)
+#endif
+
+/**
+ * @brief   Size of the RAM staging area between handlers and writer
+ */
+#ifndef COAP_PERSIST_STAGE_SIZE
+#define COAP_PERSIST_STAGE_SIZE     (1024U)
+#endif
+
+/**
+ * @brief   The log gets compacted once it grows beyond this many bytes
+ */
+#ifndef COAP_PERSIST_COMPACT_SIZE
+#define COAP_PERSIST_COMPACT_SIZE   (4096U)
+#endif
+
+/**
+ * @brief   Priority of the writer thread
+ */
+#ifndef COAP_PERSIST_PRIO
+#define COAP_PERSIST_PRIO           (PRIORITY_MIN - 1)
+#endif
+
+/**
+ * @brief   Stack size of the writer thread
+ */
+#ifndef COAP_PERSIST_STACK_SIZE
+#define COAP_PERSIST_STACK_SIZE     (KERNEL_CONF_STACKSIZE_DEFAULT)
+#endif
+
+/**
+ * @brief   Path of the log on the native board
+ */
+#ifndef COAP_PERSIST_FILE
+#define COAP_PERSIST_FILE           "coap_state.log"
+#endif
+
+/**
+ * @brief   Storage the log is kept in
+ *
+ *          The native board stores the log in a file. Boards with flash
+ *          provide these operations on a dedicated flash region.
+ */
+typedef struct {
+    /** Appends @p len bytes, returns 0 on success */
+    int (*append)(const uint8_t *data, size_t len);
+    /** Reads up to @p len bytes at @p offset, returns bytes read or -1 */
+    ssize_t (*read)(size_t offset, uint8_t *data, size_t len);
+    /** Atomically replaces the whole log by @p data, returns 0 on success */
+    int (*replace)(const uint8_t *data, size_t len);
+} coap_persist_backend_t;
+
+/**
+ * @brief   Backend used when no other was configured
+ *
+ *          The file backend on native, NULL (persistence disabled)
+ *          elsewhere.
+ */
+extern const coap_persist_backend_t *coap_persist_default_backend;
+
+/**
+ * @brief   Replays the log into @p data
+ *
+ *          Called once on boot, before coap_persist_init().
+ *
+ * @param[in] backend   The storage to read from.
+ * @param[out] data     Buffer of COAP_PERSIST_MAX_DATA bytes.
+ * @param[out] len      Length of the restored state.
+ *
+ * @return  1 if a state was restored
+ * @return  0 if the last record was a delete
+ * @return  -1 if the log is empty or missing
+ */
+int coap_persist_restore(const coap_persist_backend_t *backend,
+                         uint8_t *data, size_t *len);
+
+/**
+ * @brief   Starts the writer thread
+ *
+ * @return  PID of the writer thread
+ * @return  KERNEL_PID_UNDEF if no backend is available
+ */
+kernel_pid_t coap_persist_init(const coap_persist_backend_t *backend);
+
+/**
+ * @brief   Journals the new state @p data of @p len bytes
+ *
+ *          Copies into the staging area and returns without waiting for
+ *          the writer.
+ *
+ * @return  0 on success
+ * @return  -1 if @p len exceeds COAP_PERSIST_MAX_DATA
+ */
+int coap_persist_set(const uint8_t *data, size_t len);
+
+/**
+ * @brief   Journals that the state was deleted
+ */
+void coap_persist_delete(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COAP_PERSIST_H */
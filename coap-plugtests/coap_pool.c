@@ -0,0 +1,365 @@
+/*
+ * Copyright (C) 2014 Sebastian Sontberg <sebastian@sontberg.de>
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser General
+ * Public License v2.1. See the file LICENSE in the top level directory for more
+ * details.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "irq.h"
+
+#include "coap_pool.h"
+#include "pdu.h"
+#include "net.h"
+
+#define ENABLE_DEBUG (0)
+#include "debug.h"
+
+/* Every slot must be able to carry the free list link and keep the
+ * alignment of the structures libcoap puts into it. */
+#define SLOT_ALIGN(x) (((x) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+#define SMALL_SLOT SLOT_ALIGN(COAP_POOL_SMALL_SIZE)
+#define LARGE_SLOT SLOT_ALIGN(COAP_POOL_LARGE_SIZE)
+#define NODE_SLOT  SLOT_ALIGN(sizeof(coap_queue_t))
+
+/**
+ * @brief   Number of live allocations the soak test juggles with
+ */
+#define SOAK_HELD (COAP_POOL_SMALL_NUMOF + COAP_POOL_LARGE_NUMOF + \
+                   COAP_POOL_NODE_NUMOF)
+
+typedef struct slot {
+    struct slot *next;
+} slot_t;
+
+typedef struct {
+    uint8_t *start;             /**< first byte of the slab */
+    uint8_t *inuse;             /**< bit per slot, set while handed out */
+    uint8_t *end;               /**< one past the last byte of the slab */
+    size_t slot_size;           /**< size of one slot */
+    slot_t *free;               /**< head of the free list */
+    coap_pool_stats_t stats;
+} slab_t;
+
+static void *small_mem[COAP_POOL_SMALL_NUMOF * SMALL_SLOT / sizeof(void *)];
+static void *large_mem[COAP_POOL_LARGE_NUMOF * LARGE_SLOT / sizeof(void *)];
+static void *node_mem[COAP_POOL_NODE_NUMOF * NODE_SLOT / sizeof(void *)];
+
+#define BITMAP_SIZE(n) (((n) + 7) / 8)
+
+static uint8_t small_inuse[BITMAP_SIZE(COAP_POOL_SMALL_NUMOF)];
+static uint8_t large_inuse[BITMAP_SIZE(COAP_POOL_LARGE_NUMOF)];
+static uint8_t node_inuse[BITMAP_SIZE(COAP_POOL_NODE_NUMOF)];
+
+static slab_t slabs[COAP_POOL_NUMOF];
+
+static const char *class_names[COAP_POOL_NUMOF] = { "small", "large", "node" };
+
+static void slab_init(slab_t *slab, void *mem, uint8_t *inuse, size_t slot_size,
+                      uint16_t numof)
+{
+    slab->start = mem;
+    slab->inuse = inuse;
+    memset(inuse, 0, BITMAP_SIZE(numof));
+    slab->end = slab->start + slot_size * numof;
+    slab->slot_size = slot_size;
+    slab->free = NULL;
+
+    /* thread the free list back to front so slots get handed out in
+     * ascending address order */
+    for (int i = numof - 1; i >= 0; i--) {
+        slot_t *s = (slot_t *)(slab->start + i * slot_size);
+        s->next = slab->free;
+        slab->free = s;
+    }
+
+    memset(&slab->stats, 0, sizeof(slab->stats));
+    slab->stats.numof = numof;
+}
+
+void coap_pool_init(void)
+{
+    slab_init(&slabs[COAP_POOL_SMALL], small_mem, small_inuse, SMALL_SLOT,
+              COAP_POOL_SMALL_NUMOF);
+    slab_init(&slabs[COAP_POOL_LARGE], large_mem, large_inuse, LARGE_SLOT,
+              COAP_POOL_LARGE_NUMOF);
+    slab_init(&slabs[COAP_POOL_NODE], node_mem, node_inuse, NODE_SLOT,
+              COAP_POOL_NODE_NUMOF);
+}
+
+void *coap_pool_alloc(coap_pool_class_t cls, size_t size)
+{
+    slab_t *slab = &slabs[cls];
+    slot_t *s = NULL;
+    unsigned state = disableIRQ();
+
+    if (size <= slab->slot_size && slab->free) {
+        size_t idx;
+
+        s = slab->free;
+        slab->free = s->next;
+        idx = ((uint8_t *)s - slab->start) / slab->slot_size;
+        slab->inuse[idx / 8] |= 1 << (idx % 8);
+
+        if (++slab->stats.used > slab->stats.peak) {
+            slab->stats.peak = slab->stats.used;
+        }
+
+        slab->stats.allocs++;
+    }
+    else {
+        slab->stats.fails++;
+    }
+
+    restoreIRQ(state);
+
+    if (!s) {
+        DEBUG("coap_pool: %s class exhausted (%u bytes requested)\n",
+              class_names[cls], (unsigned)size);
+    }
+
+    return s;
+}
+
+int coap_pool_free(void *ptr)
+{
+    if (!ptr) {
+        return 0;
+    }
+
+    for (int i = 0; i < COAP_POOL_NUMOF; i++) {
+        slab_t *slab = &slabs[i];
+
+        if ((uint8_t *)ptr >= slab->start && (uint8_t *)ptr < slab->end) {
+            size_t offset = (uint8_t *)ptr - slab->start;
+            size_t idx = offset / slab->slot_size;
+            uint8_t bit = 1 << (idx % 8);
+            slot_t *s = ptr;
+            unsigned state;
+
+            if (offset % slab->slot_size) {
+                DEBUG("coap_pool: %p is inside a %s slot\n", ptr, class_names[i]);
+                return -1;
+            }
+
+            state = disableIRQ();
+
+            /* a double free would put the slot on the free list twice */
+            if (!(slab->inuse[idx / 8] & bit)) {
+                restoreIRQ(state);
+                DEBUG("coap_pool: %p is not in use\n", ptr);
+                return -1;
+            }
+
+            slab->inuse[idx / 8] &= ~bit;
+            s->next = slab->free;
+            slab->free = s;
+            slab->stats.used--;
+            restoreIRQ(state);
+            return 0;
+        }
+    }
+
+    DEBUG("coap_pool: %p is not a pool slot\n", ptr);
+    return -1;
+}
+
+const coap_pool_stats_t *coap_pool_stats(coap_pool_class_t cls)
+{
+    return &slabs[cls].stats;
+}
+
+#ifdef COAP_POOL
+/* libcoap's own allocator, reached through the linker's --wrap */
+void *__real_coap_malloc_type(coap_memory_tag_t type, size_t size);
+void __real_coap_free_type(coap_memory_tag_t type, void *p);
+
+/* Stands in for the heap backed allocator of the libcoap package, the
+ * Makefile links with --wrap=coap_malloc_type. PDUs go to the smallest
+ * class they fit into, queue nodes to their own class, and everything
+ * that is only allocated once at startup (resources, attributes,
+ * strings) stays on the heap. */
+void *__wrap_coap_malloc_type(coap_memory_tag_t type, size_t size)
+{
+    switch (type) {
+        case COAP_PDU:
+        case COAP_PDU_BUF:
+        case COAP_PACKET:
+            if (size <= SMALL_SLOT) {
+                void *p = coap_pool_alloc(COAP_POOL_SMALL, size);
+
+                if (p) {
+                    return p;
+                }
+            }
+
+            return coap_pool_alloc(COAP_POOL_LARGE, size);
+
+        case COAP_NODE:
+            return coap_pool_alloc(COAP_POOL_NODE, size);
+
+        default:
+            return __real_coap_malloc_type(type, size);
+    }
+}
+
+void __wrap_coap_free_type(coap_memory_tag_t type, void *p)
+{
+    switch (type) {
+        case COAP_PDU:
+        case COAP_PDU_BUF:
+        case COAP_PACKET:
+        case COAP_NODE:
+            coap_pool_free(p);
+            break;
+
+        default:
+            __real_coap_free_type(type, p);
+            break;
+    }
+}
+#endif
+
+static unsigned free_slots(const slab_t *slab)
+{
+    unsigned n = 0;
+
+    for (slot_t *s = slab->free; s; s = s->next) {
+        n++;
+    }
+
+    return n;
+}
+
+static void print_stats(void)
+{
+    printf("class  slots  used  peak      allocs   fails  free\n");
+
+    for (int i = 0; i < COAP_POOL_NUMOF; i++) {
+        const slab_t *slab = &slabs[i];
+        printf("%-5s  %5u  %4u  %4u  %10lu  %6lu  %4u\n", class_names[i],
+               slab->stats.numof, slab->stats.used, slab->stats.peak,
+               (unsigned long)slab->stats.allocs,
+               (unsigned long)slab->stats.fails, free_slots(slab));
+    }
+}
+
+/* Creates and deletes PDUs of random size and send queue nodes, some
+ * carrying a PDU, in random order through libcoap, holding up to
+ * SOAK_HELD of them at a time. Since all slots of a class are equally
+ * sized the pool can't fragment, which this verifies by checking that
+ * every slot taken is back on its free list afterwards. */
+static int soak(unsigned long rounds)
+{
+    void *held[SOAK_HELD];
+    bool is_node[SOAK_HELD];
+    uint16_t used[COAP_POOL_NUMOF];
+    uint32_t allocs = 0;
+    uint32_t x = 0x2545f491;
+    unsigned long failed = 0;
+    int res = 0;
+
+    memset(held, 0, sizeof(held));
+
+    /* the server may hold slots of its own while we run */
+    for (int i = 0; i < COAP_POOL_NUMOF; i++) {
+        used[i] = slabs[i].stats.used;
+        allocs += slabs[i].stats.allocs;
+    }
+
+    for (unsigned long r = 0; r < rounds; r++) {
+        /* xorshift32 */
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+
+        unsigned i = x % SOAK_HELD;
+
+        if (held[i]) {
+            if (is_node[i]) {
+                coap_delete_node(held[i]);
+            }
+            else {
+                coap_delete_pdu(held[i]);
+            }
+
+            held[i] = NULL;
+            continue;
+        }
+
+        size_t size = (x >> 12) % COAP_MAX_PDU_SIZE + 1;
+
+        is_node[i] = (x >> 8) & 1;
+
+        if (is_node[i]) {
+            coap_queue_t *node = coap_new_node();
+
+            /* a retransmission waiting with its PDU */
+            if (node && (x >> 9) & 1) {
+                node->pdu = coap_pdu_init(COAP_MESSAGE_CON, COAP_REQUEST_GET, r, size);
+            }
+
+            held[i] = node;
+        }
+        else {
+            held[i] = coap_pdu_init(COAP_MESSAGE_NON, COAP_REQUEST_GET, r, size);
+        }
+
+        if (!held[i]) {
+            failed++;
+        }
+    }
+
+    for (unsigned i = 0; i < SOAK_HELD; i++) {
+        if (!held[i]) {
+            continue;
+        }
+
+        if (is_node[i]) {
+            coap_delete_node(held[i]);
+        }
+        else {
+            coap_delete_pdu(held[i]);
+        }
+    }
+
+    for (int i = 0; i < COAP_POOL_NUMOF; i++) {
+        if (slabs[i].stats.used != used[i] ||
+            free_slots(&slabs[i]) != (unsigned)(slabs[i].stats.numof - used[i])) {
+            printf("soak: %s class lost slots\n", class_names[i]);
+            res = 1;
+        }
+
+        allocs -= slabs[i].stats.allocs;
+    }
+
+    if (allocs == 0 && rounds) {
+        puts("soak: libcoap didn't allocate from the pool, build with POOL=1");
+        res = 1;
+    }
+
+    printf("soak: %lu rounds, %lu allocations rejected, %s\n", rounds, failed,
+           res ? "FAILED" : "ok");
+    return res;
+}
+
+int coap_pool_cmd(int argc, char **argv)
+{
+    if (argc == 1) {
+        print_stats();
+        return 0;
+    }
+
+    if (argc == 3 && !strcmp(argv[1], "soak")) {
+        return soak(strtoul(argv[2], NULL, 10));
+    }
+
+    printf("usage: %s [soak <rounds>]\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2014 Sebastian Sontberg <sebastian@sontberg.de>
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser General
+ * Public License v2.1. See the file LICENSE in the top level directory for more
+ * details.
+ */
+
+/**
+ * @file
+ * @brief       Static slab pools for libcoap PDUs and send queue nodes
+ *
+ * libcoap requests its memory through coap_malloc_type() and releases it
+ * through coap_free_type(). With COAP_POOL enabled the application links
+ * with --wrap for both, so PDUs and send queue nodes of the stock libcoap
+ * package are served from fixed size slabs that are reserved at compile
+ * time, and the server never touches the heap while handling requests.
+ */
+
+#ifndef COAP_POOL_H
+#define COAP_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mem.h"
+#include "pdu.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief   Size of a slot in the small PDU class
+ *
+ *          Big enough for a coap_pdu_t plus requests and piggybacked
+ *          responses of the plugtest resources.
+ */
+#ifndef COAP_POOL_SMALL_SIZE
+#define COAP_POOL_SMALL_SIZE    (256U)
+#endif
+
+/**
+ * @brief   Number of slots in the small PDU class
+ */
+#ifndef COAP_POOL_SMALL_NUMOF
+#define COAP_POOL_SMALL_NUMOF   (16U)
+#endif
+
+/**
+ * @brief   Size of a slot in the large PDU class
+ *
+ *          Holds a coap_pdu_t of the largest PDU libcoap builds or
+ *          accepts, COAP_MAX_PDU_SIZE bytes.
+ */
+#ifndef COAP_POOL_LARGE_SIZE
+#define COAP_POOL_LARGE_SIZE    (sizeof(coap_pdu_t) + COAP_MAX_PDU_SIZE)
+#endif
+
+/**
+ * @brief   Number of slots in the large PDU class
+ */
+#ifndef COAP_POOL_LARGE_NUMOF
+#define COAP_POOL_LARGE_NUMOF   (4U)
+#endif
+
+/**
+ * @brief   Number of coap_queue_t nodes (pending retransmissions)
+ */
+#ifndef COAP_POOL_NODE_NUMOF
+#define COAP_POOL_NODE_NUMOF    (16U)
+#endif
+
+/**
+ * @brief   Slab classes managed by the pool
+ */
+typedef enum {
+    COAP_POOL_SMALL = 0,        /**< small PDUs */
+    COAP_POOL_LARGE,            /**< Block2 sized PDUs */
+    COAP_POOL_NODE,             /**< send queue nodes */
+    COAP_POOL_NUMOF             /**< number of classes */
+} coap_pool_class_t;
+
+/**
+ * @brief   Usage statistics of one slab class
+ */
+typedef struct {
+    uint16_t numof;             /**< number of slots */
+    uint16_t used;              /**< slots currently handed out */
+    uint16_t peak;              /**< highest value of used ever seen */
+    uint32_t allocs;            /**< successful allocations */
+    uint32_t fails;             /**< allocations rejected on exhaustion */
+} coap_pool_stats_t;
+
+/**
+ * @brief   Initializes all slab classes
+ *
+ *          Must be called before libcoap allocates its first PDU.
+ */
+void coap_pool_init(void);
+
+/**
+ * @brief   Takes a slot of class @p cls that can hold @p size bytes
+ *
+ * @param[in] cls   The slab class to allocate from.
+ * @param[in] size  Number of bytes needed.
+ *
+ * @return  Pointer to the slot
+ * @return  NULL if @p size doesn't fit or the class is exhausted
+ */
+void *coap_pool_alloc(coap_pool_class_t cls, size_t size);
+
+/**
+ * @brief   Returns @p ptr to the slab it was taken from
+ *
+ * @param[in] ptr   A pointer returned by coap_pool_alloc() or NULL.
+ *
+ * @return  0 on success
+ * @return  -1 if @p ptr isn't the start of a slot that is in use
+ */
+int coap_pool_free(void *ptr);
+
+/**
+ * @brief   Gets the usage statistics of class @p cls
+ */
+const coap_pool_stats_t *coap_pool_stats(coap_pool_class_t cls);
+
+/**
+ * @brief   Shell command to print pool statistics and run a soak test
+ *
+ *          `coap_pool` prints the statistics, `coap_pool soak <n>` runs
+ *          @p n rounds of randomly creating and deleting PDUs and send
+ *          queue nodes through libcoap and checks that every class ends up
+ *          with all of its slots free again.
+ */
+int coap_pool_cmd(int argc, char **argv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COAP_POOL_H */
@@ -0,0 +1,545 @@
+/*
+ * Copyright (C) 2014 Sebastian Sontberg <sebastian@sontberg.de>
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser General
+ * Public License v2.1. See the file LICENSE in the top level directory for more
+ * details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hwtimer.h"
+#include "msg.h"
+#include "thread.h"
+#include "net/ng_netbase.h"
+
+#include "coap.h"
+#include "coap_thread.h"
+#include "coap_handlers.h"
+#include "coap_replay.h"
+
+#define ENABLE_DEBUG (0)
+#include "debug.h"
+
+#ifdef BOARD_NATIVE
+#include "native_internal.h"
+
+#define PCAP_MAGIC          (0xa1b2c3d4)
+#define PCAP_MAGIC_SWAPPED  (0xd4c3b2a1)
+#define PCAP_HDR_LEN        (24U)
+#define PCAP_REC_HDR_LEN    (16U)
+
+#define LINKTYPE_ETHERNET   (1U)
+#define LINKTYPE_RAW        (101U)
+#define LINKTYPE_LINUX_SLL  (113U)
+#define LINKTYPE_IPV6       (229U)
+
+#define ETHERTYPE_IPV6      (0x86dd)
+#define IPV6_HDR_LEN        (40U)
+#define UDP_HDR_LEN         (8U)
+#define PROTNUM_UDP         (17U)
+
+#define SINK_PRIO           (PRIORITY_MAIN - 2)
+#define SINK_MSG_QUEUE_SIZE (8U)
+#define MAX_RESPONSE        (1280U)
+#define MAX_PATH            (32U)
+#define MAX_BYPASSED        (4U)
+
+#define ANY_TYPE            (0xff)
+
+/**
+ * @brief   A plugtest case, identified by message type, method and path
+ */
+typedef struct {
+    uint8_t type;
+    uint8_t code;
+    const char *path;
+    const char *name;
+    uint32_t count;
+    uint64_t ticks;
+} replay_case_t;
+
+/**
+ * @brief   A request found in the pcap file
+ */
+typedef struct {
+    const uint8_t *ipv6;        /**< IPv6 header, UDP header and CoAP follow */
+    size_t coap_len;
+    replay_case_t *tc;
+} replay_req_t;
+
+static replay_case_t cases[] = {
+    { COAP_MESSAGE_CON, COAP_REQUEST_GET, "test", "TD_COAP_CORE_01", 0, 0 },
+    { COAP_MESSAGE_CON, COAP_REQUEST_DELETE, "test", "TD_COAP_CORE_02", 0, 0 },
+    { COAP_MESSAGE_CON, COAP_REQUEST_PUT, "test", "TD_COAP_CORE_03", 0, 0 },
+    { COAP_MESSAGE_CON, COAP_REQUEST_POST, "test", "TD_COAP_CORE_04", 0, 0 },
+    { COAP_MESSAGE_NON, COAP_REQUEST_GET, "test", "TD_COAP_CORE_05", 0, 0 },
+    { COAP_MESSAGE_NON, COAP_REQUEST_DELETE, "test", "TD_COAP_CORE_06", 0, 0 },
+    { COAP_MESSAGE_NON, COAP_REQUEST_PUT, "test", "TD_COAP_CORE_07", 0, 0 },
+    { COAP_MESSAGE_NON, COAP_REQUEST_POST, "test", "TD_COAP_CORE_08", 0, 0 },
+    { ANY_TYPE, COAP_REQUEST_GET, "separate", "TD_COAP_CORE_09", 0, 0 },
+    { ANY_TYPE, COAP_REQUEST_GET, "seg1/seg2/seg3", "TD_COAP_CORE_13", 0, 0 },
+    { ANY_TYPE, COAP_REQUEST_GET, "query", "TD_COAP_CORE_14", 0, 0 },
+    { ANY_TYPE, COAP_REQUEST_POST, "location-query", "TD_COAP_CORE_19", 0, 0 },
+    { ANY_TYPE, COAP_REQUEST_GET, "multi-format", "TD_COAP_CORE_20", 0, 0 },
+    { ANY_TYPE, COAP_REQUEST_GET, "validate", "TD_COAP_CORE_21", 0, 0 },
+    { ANY_TYPE, COAP_REQUEST_PUT, "validate", "TD_COAP_CORE_22", 0, 0 },
+    { ANY_TYPE, COAP_REQUEST_PUT, "create1", "TD_COAP_CORE_23", 0, 0 },
+    { ANY_TYPE, COAP_REQUEST_GET, ".well-known/core", "TD_COAP_LINK_01", 0, 0 },
+    { ANY_TYPE, COAP_REQUEST_GET, "path", "TD_COAP_LINK_09", 0, 0 },
+    { ANY_TYPE, COAP_REQUEST_GET, "large", "TD_COAP_BLOCK_01", 0, 0 },
+    { ANY_TYPE, 0, NULL, "other", 0, 0 },
+};
+
+#define CASES_NUMOF (sizeof(cases) / sizeof(cases[0]))
+
+static uint8_t pcap[COAP_REPLAY_MAX_PCAP];
+static replay_req_t reqs[COAP_REPLAY_MAX_REQ];
+
+static char sink_stack[KERNEL_CONF_STACKSIZE_DEFAULT];
+static kernel_pid_t sink_pid = KERNEL_PID_UNDEF;
+static uint8_t response[MAX_RESPONSE];
+static size_t response_len;
+static unsigned responses;
+static ng_netreg_entry_t *bypassed[MAX_BYPASSED];
+static unsigned bypassed_numof;
+
+static size_t load(const char *name, uint8_t *buf, size_t size)
+{
+    size_t len = 0;
+
+    _native_syscall_enter();
+    FILE *f = fopen(name, "rb");
+
+    if (f) {
+        len = fread(buf, 1, size, f);
+        fclose(f);
+    }
+
+    _native_syscall_leave();
+    return len;
+}
+
+static uint32_t rd32(const uint8_t *b, int swapped)
+{
+    return swapped ? ((uint32_t)b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3]
+                   : ((uint32_t)b[3] << 24) | (b[2] << 16) | (b[1] << 8) | b[0];
+}
+
+/* Joins the Uri-Path options of @p coap into @p path */
+static void uri_path(const uint8_t *coap, size_t len, char *path)
+{
+    size_t pos = 4 + (coap[0] & 0x0f);
+    size_t plen = 0;
+    unsigned last = 0;
+
+    path[0] = '\0';
+
+    while (pos < len && coap[pos] != 0xff) {
+        unsigned delta = coap[pos] >> 4;
+        unsigned olen = coap[pos] & 0x0f;
+        pos++;
+
+        if (delta == 13) {
+            delta = 13 + coap[pos++];
+        }
+        else if (delta == 14) {
+            delta = 269 + ((coap[pos] << 8) | coap[pos + 1]);
+            pos += 2;
+        }
+
+        if (olen == 13) {
+            olen = 13 + coap[pos++];
+        }
+        else if (olen == 14) {
+            olen = 269 + ((coap[pos] << 8) | coap[pos + 1]);
+            pos += 2;
+        }
+
+        if (delta > 15 || pos + olen > len) {
+            /* truncated or invalid, the handlers will judge */
+            return;
+        }
+
+        last += delta;
+
+        if (last == COAP_OPTION_URI_PATH && plen + olen + 2 < MAX_PATH) {
+            if (plen) {
+                path[plen++] = '/';
+            }
+
+            memcpy(path + plen, coap + pos, olen);
+            plen += olen;
+            path[plen] = '\0';
+        }
+
+        pos += olen;
+    }
+}
+
+static replay_case_t *classify(const uint8_t *coap, size_t len)
+{
+    char path[MAX_PATH];
+    uint8_t type = (coap[0] >> 4) & 0x03;
+
+    uri_path(coap, len, path);
+
+    for (unsigned i = 0; i < CASES_NUMOF - 1; i++) {
+        if ((cases[i].type == ANY_TYPE || cases[i].type == type) &&
+            cases[i].code == coap[1] && !strcmp(cases[i].path, path)) {
+            return &cases[i];
+        }
+    }
+
+    return &cases[CASES_NUMOF - 1];
+}
+
+/* Collects the IPv6/UDP datagrams to the CoAP port */
+static unsigned extract(size_t len)
+{
+    unsigned n = 0;
+    size_t pos = PCAP_HDR_LEN;
+    uint32_t magic, linktype;
+    int swapped;
+
+    if (len < PCAP_HDR_LEN) {
+        return 0;
+    }
+
+    magic = rd32(pcap, 0);
+
+    if (magic != PCAP_MAGIC && magic != PCAP_MAGIC_SWAPPED) {
+        puts("replay: not a pcap file");
+        return 0;
+    }
+
+    swapped = (magic == PCAP_MAGIC_SWAPPED);
+    linktype = rd32(pcap + 20, swapped);
+
+    while (pos + PCAP_REC_HDR_LEN <= len && n < COAP_REPLAY_MAX_REQ) {
+        size_t caplen = rd32(pcap + pos + 8, swapped);
+        const uint8_t *p = pcap + pos + PCAP_REC_HDR_LEN;
+        size_t plen = caplen;
+
+        pos += PCAP_REC_HDR_LEN + caplen;
+
+        if (pos > len) {
+            break;
+        }
+
+        switch (linktype) {
+            case LINKTYPE_ETHERNET:
+                if (plen < 14 || ((p[12] << 8) | p[13]) != ETHERTYPE_IPV6) {
+                    continue;
+                }
+
+                p += 14;
+                plen -= 14;
+                break;
+
+            case LINKTYPE_LINUX_SLL:
+                if (plen < 16 || ((p[14] << 8) | p[15]) != ETHERTYPE_IPV6) {
+                    continue;
+                }
+
+                p += 16;
+                plen -= 16;
+                break;
+
+            case LINKTYPE_RAW:
+            case LINKTYPE_IPV6:
+                break;
+
+            default:
+                printf("replay: unsupported link type %lu\n", (unsigned long)linktype);
+                return 0;
+        }
+
+        if (plen < IPV6_HDR_LEN + UDP_HDR_LEN + 4 || (p[0] >> 4) != 6 ||
+            p[6] != PROTNUM_UDP ||
+            ((p[IPV6_HDR_LEN + 2] << 8) | p[IPV6_HDR_LEN + 3]) != COAP_PORT) {
+            continue;
+        }
+
+        reqs[n].ipv6 = p;
+        reqs[n].coap_len = ((p[IPV6_HDR_LEN + 4] << 8) | p[IPV6_HDR_LEN + 5]) - UDP_HDR_LEN;
+
+        if (reqs[n].coap_len > plen - IPV6_HDR_LEN - UDP_HDR_LEN) {
+            continue;
+        }
+
+        reqs[n].tc = classify(p + IPV6_HDR_LEN + UDP_HDR_LEN, reqs[n].coap_len);
+        n++;
+    }
+
+    return n;
+}
+
+/* Takes the place of ng_udp and keeps the CoAP part of what is sent */
+static void *sink(void *arg)
+{
+    (void)arg;
+    msg_t msg, msg_queue[SINK_MSG_QUEUE_SIZE];
+    ng_netreg_entry_t entry;
+
+    msg_init_queue(msg_queue, SINK_MSG_QUEUE_SIZE);
+
+    entry.pid = thread_getpid();
+    entry.demux_ctx = NG_NETREG_DEMUX_CTX_ALL;
+    ng_netreg_register(NG_NETTYPE_UDP, &entry);
+
+    while (1) {
+        msg_receive(&msg);
+
+        if (msg.type == NG_NETAPI_MSG_TYPE_SND) {
+            ng_pktsnip_t *pkt = (ng_pktsnip_t *)msg.content.ptr;
+
+            for (ng_pktsnip_t *s = pkt; s; s = s->next) {
+                if (s->type == NG_NETTYPE_UNDEF) {
+                    response_len = (s->size < sizeof(response)) ? s->size : sizeof(response);
+                    memcpy(response, s->data, response_len);
+                    responses++;
+                    break;
+                }
+            }
+
+            ng_pktbuf_release(pkt);
+        }
+    }
+
+    /* never reached */
+    return NULL;
+}
+
+/*
+ * auto_init still starts ng_udp and ng_ipv6, and ng_udp sits next to the
+ * sink: take it off the registry for the run so the responses don't go
+ * down the stack within the timed window.
+ */
+static void bypass(void)
+{
+    ng_netreg_entry_t *entry = ng_netreg_lookup(NG_NETTYPE_UDP, NG_NETREG_DEMUX_CTX_ALL);
+
+    bypassed_numof = 0;
+
+    while (entry && bypassed_numof < MAX_BYPASSED) {
+        if (entry->pid != sink_pid) {
+            bypassed[bypassed_numof++] = entry;
+        }
+
+        entry = ng_netreg_getnext(entry);
+    }
+
+    for (unsigned i = 0; i < bypassed_numof; i++) {
+        ng_netreg_unregister(NG_NETTYPE_UDP, bypassed[i]);
+    }
+}
+
+static void unbypass(void)
+{
+    for (unsigned i = 0; i < bypassed_numof; i++) {
+        ng_netreg_register(NG_NETTYPE_UDP, bypassed[i]);
+    }
+
+    bypassed_numof = 0;
+}
+
+/* Builds the snips ng_udp would deliver: payload, UDP header, IPv6 header */
+static ng_pktsnip_t *wrap(const replay_req_t *req)
+{
+    ng_pktsnip_t *ipv6, *udp, *payload;
+
+    ipv6 = ng_pktbuf_add(NULL, (void *)req->ipv6, IPV6_HDR_LEN, NG_NETTYPE_IPV6);
+    udp = ng_pktbuf_add(ipv6, (void *)(req->ipv6 + IPV6_HDR_LEN), UDP_HDR_LEN,
+                        NG_NETTYPE_UDP);
+    payload = ng_pktbuf_add(udp, (void *)(req->ipv6 + IPV6_HDR_LEN + UDP_HDR_LEN),
+                            req->coap_len, NG_NETTYPE_UNDEF);
+
+    if (!ipv6 || !udp || !payload) {
+        ng_pktbuf_release(payload ? payload : (udp ? udp : ipv6));
+        return NULL;
+    }
+
+    return payload;
+}
+
+static void to_hex(char *out, const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        sprintf(out + 2 * i, "%02x", data[i]);
+    }
+
+    out[2 * len] = '\0';
+}
+
+int coap_replay_cmd(int argc, char **argv)
+{
+    static coap_endpoint_t ep;
+    static coap_context_t ctx;
+    static char line[2 * MAX_RESPONSE + 32];
+    static char golden[COAP_REPLAY_MAX_PCAP];
+    unsigned rounds = 1, n, mismatches = 0;
+    size_t golden_len = 0, golden_pos = 0;
+    const char *mode = NULL;
+    FILE *out = NULL;
+
+    if (argc < 2) {
+        printf("usage: %s <pcap> [rounds] [record|check <golden>]\n", argv[0]);
+        return 1;
+    }
+
+    if (argc > 2 && argv[2][0] >= '0' && argv[2][0] <= '9') {
+        rounds = atoi(argv[2]);
+        argv++;
+        argc--;
+    }
+
+    if (argc == 4) {
+        mode = argv[2];
+
+        if (!strcmp(mode, "check")) {
+            golden_len = load(argv[3], (uint8_t *)golden, sizeof(golden) - 1);
+            golden[golden_len] = '\0';
+        }
+        else if (!strcmp(mode, "record")) {
+            _native_syscall_enter();
+            out = fopen(argv[3], "w");
+            _native_syscall_leave();
+
+            if (!out) {
+                printf("replay: can't write %s\n", argv[3]);
+                return 1;
+            }
+        }
+        else {
+            printf("replay: unknown mode %s\n", mode);
+            return 1;
+        }
+    }
+
+    n = extract(load(argv[1], pcap, sizeof(pcap)));
+
+    if (n == 0) {
+        puts("replay: no CoAP requests found");
+        return 1;
+    }
+
+    if (sink_pid == KERNEL_PID_UNDEF) {
+        sink_pid = thread_create(sink_stack, sizeof(sink_stack), SINK_PRIO,
+                                 CREATE_STACKTEST, sink, NULL, "replay_sink");
+    }
+
+    /* the server is set up once, its resources live on between runs */
+    if (ctx.endpoint == NULL) {
+        coap_init_endpoint(&ep, ipv6_addr_any, COAP_PORT, thread_getpid());
+        coap_init_context(&ctx, &ep, 1);
+        register_handlers(&ctx);
+    }
+
+    for (unsigned i = 0; i < CASES_NUMOF; i++) {
+        cases[i].count = 0;
+        cases[i].ticks = 0;
+    }
+
+    bypass();
+
+    for (unsigned r = 0; r < rounds; r++) {
+        /* every round sees the same resources, as after a fresh boot,
+         * and a fixed first message ID for reproducible separate
+         * responses */
+        reset_handlers();
+        ctx.message_id = 1;
+
+        for (unsigned i = 0; i < n; i++) {
+            ng_pktsnip_t *pkt = wrap(&reqs[i]);
+            unsigned before = responses;
+            uint32_t start;
+
+            if (!pkt) {
+                puts("replay: pktbuf full");
+                unbypass();
+                return 1;
+            }
+
+            start = hwtimer_now();
+            coap_handle_message(&ctx, ctx.endpoint, (coap_packet_t *)pkt);
+            reqs[i].tc->ticks += hwtimer_now() - start;
+            reqs[i].tc->count++;
+
+            if (r > 0 || !mode) {
+                continue;
+            }
+
+            if (responses == before) {
+                response_len = 0;
+            }
+
+            snprintf(line, sizeof(line), "%s ", reqs[i].tc->name);
+            to_hex(line + strlen(line), response, response_len);
+
+            if (out) {
+                _native_syscall_enter();
+                fprintf(out, "%s\n", line);
+                _native_syscall_leave();
+            }
+            else {
+                size_t len = strlen(line);
+
+                if (golden_pos + len > golden_len ||
+                    strncmp(golden + golden_pos, line, len) ||
+                    golden[golden_pos + len] != '\n') {
+                    printf("replay: request %u (%s) differs from golden output\n",
+                           i, reqs[i].tc->name);
+                    mismatches++;
+                }
+
+                /* on to the next golden line */
+                while (golden_pos < golden_len && golden[golden_pos] != '\n') {
+                    golden_pos++;
+                }
+
+                golden_pos++;
+            }
+        }
+
+        /* nobody ACKs separate responses here */
+        coap_delete_all(ctx.sendqueue);
+        ctx.sendqueue = NULL;
+    }
+
+    unbypass();
+
+    if (out) {
+        _native_syscall_enter();
+        fclose(out);
+        _native_syscall_leave();
+    }
+
+    printf("%-18s %8s %12s\n", "case", "requests", "ns/request");
+
+    for (unsigned i = 0; i < CASES_NUMOF; i++) {
+        if (cases[i].count) {
+            printf("%-18s %8lu %12lu\n", cases[i].name, (unsigned long)cases[i].count,
+                   (unsigned long)(cases[i].ticks * 1000000000 / HWTIMER_SPEED /
+                                   cases[i].count));
+        }
+    }
+
+    if (mode && !strcmp(mode, "check")) {
+        printf("replay: %u of %u responses match\n", n - mismatches, n);
+    }
+
+    return mismatches ? 1 : 0;
+}
+#else
+int coap_replay_cmd(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    puts("replay: only available on native");
+    return 1;
+}
+#endif
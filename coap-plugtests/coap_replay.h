@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2014 Sebastian Sontberg <sebastian@sontberg.de>
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser General
+ * Public License v2.1. See the file LICENSE in the top level directory for more
+ * details.
+ */
+
+/**
+ * @file
+ * @brief       Offline replay of recorded plugtest traffic (native only)
+ *
+ * Reads the CoAP requests from a pcap file, wraps each one into pktsnips
+ * the way ng_udp delivers them and hands them to coap_handle_message()
+ * with all handlers of register_handlers() in place. A sink registered as
+ * UDP layer captures the responses, which can be recorded to or checked
+ * against a golden file. Needs no tap device, bridge or root and reports
+ * the time per request for each plugtest case.
+ *
+ * Build with `make REPLAY=1` to skip the network setup and start from a
+ * fresh resource state.
+ */
+
+#ifndef COAP_REPLAY_H
+#define COAP_REPLAY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief   Largest pcap file that is loaded
+ */
+#ifndef COAP_REPLAY_MAX_PCAP
+#define COAP_REPLAY_MAX_PCAP    (256U * 1024U)
+#endif
+
+/**
+ * @brief   Maximum number of requests replayed from one file
+ */
+#ifndef COAP_REPLAY_MAX_REQ
+#define COAP_REPLAY_MAX_REQ     (256U)
+#endif
+
+/**
+ * @brief   Shell command running the replay
+ *
+ *          `replay <pcap> [rounds] [record|check <golden>]`
+ *
+ *          Replays all requests @p rounds times and prints the time per
+ *          request of every case. Responses of the first round are written
+ *          to or compared with @p golden.
+ *
+ * @return  0 on success
+ * @return  1 on usage error, unreadable files or mismatching responses
+ */
+int coap_replay_cmd(int argc, char **argv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COAP_REPLAY_H */
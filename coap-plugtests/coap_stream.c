@@ -0,0 +1,507 @@
+/*
+ * Copyright (C) 2014 Sebastian Sontberg <sebastian@sontberg.de>
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser General
+ * Public License v2.1. See the file LICENSE in the top level directory for more
+ * details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hwtimer.h"
+#include "thread.h"
+
+#include "coap_stream.h"
+#include "pdu.h"
+#include "resource.h"
+
+#define ENABLE_DEBUG (0)
+#include "debug.h"
+
+/* Signaling codes (RFC 8323, section 5) */
+#define SIG_CSM         (0xe1)  /* 7.01 */
+#define SIG_PING        (0xe2)  /* 7.02 */
+#define SIG_PONG        (0xe3)  /* 7.03 */
+#define SIG_RELEASE     (0xe4)  /* 7.04 */
+#define SIG_ABORT       (0xe5)  /* 7.05 */
+
+/* Option 2 of a CSM: Max-Message-Size */
+#define CSM_OPT_MAX_MSG (0x22)
+
+/* Len/TKL byte, up to 4 byte extended length, code */
+#define FRAME_HDR_MAX   (6)
+
+coap_transport_stats_t coap_stats_udp;
+coap_transport_stats_t coap_stats_stream;
+
+/* libcoap expects the PDU buffer to directly follow the coap_pdu_t */
+typedef struct {
+    coap_pdu_t pdu;
+    unsigned char buf[COAP_STREAM_MAX_PDU];
+} stream_pdu_t;
+
+void coap_transfer_start(coap_transport_stats_t *s, uint32_t start)
+{
+    s->transfer_start = start;
+}
+
+void coap_transfer_done(coap_transport_stats_t *s, size_t bytes)
+{
+    uint32_t us = HWTIMER_TICKS_TO_US(hwtimer_now() - s->transfer_start);
+
+    s->transfers++;
+    s->transfer_bytes += bytes;
+    s->transfer_us += us;
+
+    if (us > s->transfer_max_us) {
+        s->transfer_max_us = us;
+    }
+}
+
+void coap_stream_dispatch(coap_context_t *ctx, coap_stream_req_t *req)
+{
+    static coap_endpoint_t ep;
+    coap_pdu_t *request = req->request;
+    coap_pdu_t *response = req->response;
+    coap_resource_t *r;
+    coap_method_handler_t h = NULL;
+    coap_key_t key;
+    str token = { request->hdr->token_length, request->hdr->token };
+
+    /* the UDP endpoint plus the flag that tells handlers about the
+     * stream, so they may skip block-wise transfer */
+    memcpy(&ep, ctx->endpoint, sizeof(ep));
+    ep.flags |= COAP_ENDPOINT_STREAM;
+
+    coap_add_token(response, token.length, token.s);
+
+    coap_hash_request_uri(request, key);
+    r = coap_get_resource_from_key(ctx, key);
+
+    if (r && request->hdr->code > 0 && request->hdr->code <= 4) {
+        h = r->handler[request->hdr->code - 1];
+    }
+
+    if (!r) {
+        response->hdr->code = COAP_RESPONSE_CODE(404);
+    }
+    else if (!h) {
+        response->hdr->code = COAP_RESPONSE_CODE(405);
+    }
+    else {
+        h(ctx, r, &ep, &req->peer, request, &token, response);
+    }
+}
+
+#ifdef BOARD_NATIVE
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "native_internal.h"
+
+typedef struct {
+    int fd;                                 /**< -1 if unused */
+    size_t rx_len;                          /**< bytes in rx */
+    uint32_t rx_start;                      /**< hwtimer ticks of rx[0] */
+    uint8_t rx[COAP_STREAM_MAX_PDU + FRAME_HDR_MAX];
+} conn_t;
+
+static char stream_stack[COAP_STREAM_STACK_SIZE];
+static kernel_pid_t stream_coap_pid;
+static conn_t conns[COAP_STREAM_MAX_CONN];
+static stream_pdu_t req_pdu, rsp_pdu;
+static uint8_t udp_buf[COAP_STREAM_MAX_PDU];
+static uint8_t tx[COAP_STREAM_MAX_PDU + FRAME_HDR_MAX];
+
+static int set_nonblocking(int fd)
+{
+    _native_syscall_enter();
+    int res = fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    _native_syscall_leave();
+    return res;
+}
+
+static void conn_close(conn_t *c)
+{
+    _native_syscall_enter();
+    real_close(c->fd);
+    _native_syscall_leave();
+    c->fd = -1;
+    c->rx_len = 0;
+}
+
+static int write_all(conn_t *c, const uint8_t *data, size_t len)
+{
+    while (len) {
+        ssize_t n;
+        int err;
+
+        _native_syscall_enter();
+        n = real_write(c->fd, data, len);
+        err = errno;
+        _native_syscall_leave();
+
+        if (n < 0) {
+            if (err == EAGAIN || err == EWOULDBLOCK) {
+                vtimer_usleep(COAP_STREAM_POLL_US);
+                continue;
+            }
+
+            return -1;
+        }
+
+        data += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/* Writes the Len/TKL byte, extended length and code to @p buf */
+static size_t frame_hdr(uint8_t *buf, size_t body_len, uint8_t tkl, uint8_t code)
+{
+    size_t n = 1;
+
+    if (body_len < 13) {
+        buf[0] = (body_len << 4);
+    }
+    else if (body_len < 269) {
+        buf[0] = (13 << 4);
+        buf[n++] = body_len - 13;
+    }
+    else if (body_len < 65805) {
+        buf[0] = (14 << 4);
+        buf[n++] = (body_len - 269) >> 8;
+        buf[n++] = (body_len - 269) & 0xff;
+    }
+    else {
+        buf[0] = (15 << 4);
+        buf[n++] = (body_len - 65805) >> 24;
+        buf[n++] = ((body_len - 65805) >> 16) & 0xff;
+        buf[n++] = ((body_len - 65805) >> 8) & 0xff;
+        buf[n++] = (body_len - 65805) & 0xff;
+    }
+
+    buf[0] |= tkl;
+    buf[n++] = code;
+
+    return n;
+}
+
+static int send_frame(conn_t *c, uint8_t code, const uint8_t *token, uint8_t tkl,
+                      const uint8_t *body, size_t body_len)
+{
+    size_t n = frame_hdr(tx, body_len, tkl, code);
+
+    memcpy(tx + n, token, tkl);
+    n += tkl;
+    memcpy(tx + n, body, body_len);
+    n += body_len;
+
+    coap_stats_stream.tx_bytes += n;
+    return write_all(c, tx, n);
+}
+
+static int send_csm(conn_t *c)
+{
+    const uint8_t opt[] = { CSM_OPT_MAX_MSG, COAP_STREAM_MAX_PDU >> 8,
+                            COAP_STREAM_MAX_PDU & 0xff };
+
+    return send_frame(c, SIG_CSM, NULL, 0, opt, sizeof(opt));
+}
+
+/**
+ * @brief   Checks for a complete frame at the start of @p c->rx
+ *
+ * @return  Length of the frame if complete
+ * @return  0 if more data is needed
+ * @return  -1 if the frame can never fit
+ */
+static ssize_t frame_complete(const conn_t *c, size_t *hdr_len, size_t *body_len)
+{
+    const uint8_t *p = c->rx;
+    size_t ext, len;
+
+    if (c->rx_len < 1) {
+        return 0;
+    }
+
+    len = p[0] >> 4;
+    ext = (len == 13) ? 1 : (len == 14) ? 2 : (len == 15) ? 4 : 0;
+
+    if (c->rx_len < 1 + ext + 1) {
+        return 0;
+    }
+
+    switch (ext) {
+        case 1:
+            len = 13 + p[1];
+            break;
+
+        case 2:
+            len = 269 + ((p[1] << 8) | p[2]);
+            break;
+
+        case 4:
+            len = 65805 + (((uint32_t)p[1] << 24) | ((uint32_t)p[2] << 16) |
+                           (p[3] << 8) | p[4]);
+            break;
+    }
+
+    *hdr_len = 1 + ext + 1;
+    *body_len = len;
+    len += *hdr_len + (p[0] & 0x0f);
+
+    if (len > sizeof(c->rx)) {
+        return -1;
+    }
+
+    return (c->rx_len >= len) ? (ssize_t)len : 0;
+}
+
+static int handle_frame(conn_t *c, size_t hdr_len, size_t body_len)
+{
+    uint8_t tkl = c->rx[0] & 0x0f;
+    uint8_t code = c->rx[hdr_len - 1];
+    const uint8_t *token = c->rx + hdr_len;
+    const uint8_t *body = token + tkl;
+    coap_stream_req_t req;
+    msg_t m, reply;
+    size_t udp_len;
+    uint32_t start;
+
+    switch (code) {
+        case SIG_CSM:
+        case SIG_PONG:
+            return 0;
+
+        case SIG_PING:
+            return send_frame(c, SIG_PONG, token, tkl, NULL, 0);
+
+        case SIG_RELEASE:
+        case SIG_ABORT:
+            return -1;
+    }
+
+    if (tkl > 8 || 4 + tkl + body_len > sizeof(udp_buf)) {
+        return -1;
+    }
+
+    start = hwtimer_now();
+    coap_stats_stream.requests++;
+
+    /* Rebuild the request in UDP layout so libcoap can parse it. Type and
+     * message ID carry no meaning on a stream. */
+    udp_buf[0] = (COAP_DEFAULT_VERSION << 6) | (COAP_MESSAGE_CON << 4) | tkl;
+    udp_buf[1] = code;
+    udp_buf[2] = 0;
+    udp_buf[3] = 0;
+    memcpy(udp_buf + 4, token, tkl + body_len);
+    udp_len = 4 + tkl + body_len;
+
+    coap_pdu_clear(&req_pdu.pdu, sizeof(req_pdu.buf));
+
+    if (!coap_pdu_parse(udp_buf, udp_len, &req_pdu.pdu)) {
+        return send_frame(c, COAP_RESPONSE_CODE(400), token, tkl, NULL, 0);
+    }
+
+    coap_pdu_clear(&rsp_pdu.pdu, sizeof(rsp_pdu.buf));
+    rsp_pdu.pdu.hdr->type = COAP_MESSAGE_ACK;
+
+    /* the handler of the compared resource ends the transfer */
+    coap_transfer_start(&coap_stats_stream, c->rx_start);
+
+    req.request = &req_pdu.pdu;
+    req.response = &rsp_pdu.pdu;
+    memset(&req.peer, 0, sizeof(req.peer));
+
+    /* the handler runs on the CoAP thread */
+    m.type = COAP_STREAM_MSG_REQUEST;
+    m.content.ptr = (char *)&req;
+    msg_send_receive(&m, &reply, stream_coap_pid);
+
+    /* options and payload are framed unchanged */
+    tkl = rsp_pdu.pdu.hdr->token_length;
+    body = (uint8_t *)rsp_pdu.pdu.hdr + sizeof(coap_hdr_t) + tkl;
+    body_len = rsp_pdu.pdu.length - sizeof(coap_hdr_t) - tkl;
+
+    int res = send_frame(c, rsp_pdu.pdu.hdr->code, rsp_pdu.pdu.hdr->token,
+                         tkl, body, body_len);
+
+    coap_stats_stream.busy_us += HWTIMER_TICKS_TO_US(hwtimer_now() - start);
+    return res;
+}
+
+static void conn_poll(conn_t *c)
+{
+    ssize_t n, flen;
+    size_t hdr_len, body_len;
+    int err;
+
+    _native_syscall_enter();
+    n = real_read(c->fd, c->rx + c->rx_len, sizeof(c->rx) - c->rx_len);
+    err = errno;
+    _native_syscall_leave();
+
+    if (n == 0 || (n < 0 && err != EAGAIN && err != EWOULDBLOCK)) {
+        DEBUG("coap_stream: connection closed\n");
+        conn_close(c);
+        return;
+    }
+
+    if (n < 0) {
+        return;
+    }
+
+    if (c->rx_len == 0) {
+        c->rx_start = hwtimer_now();
+    }
+
+    c->rx_len += n;
+    coap_stats_stream.rx_bytes += n;
+
+    while ((flen = frame_complete(c, &hdr_len, &body_len)) != 0) {
+        if (flen < 0 || handle_frame(c, hdr_len, body_len) < 0) {
+            conn_close(c);
+            return;
+        }
+
+        c->rx_len -= flen;
+        memmove(c->rx, c->rx + flen, c->rx_len);
+
+        if (c->rx_len) {
+            /* the next frame was read in the same go */
+            c->rx_start = hwtimer_now();
+        }
+    }
+}
+
+static void *stream_loop(void *arg)
+{
+    (void)arg;
+    struct sockaddr_in6 sa;
+    int one = 1;
+    int lfd, res;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin6_family = AF_INET6;
+    sa.sin6_addr = in6addr_any;
+    sa.sin6_port = htons(COAP_STREAM_PORT);
+
+    _native_syscall_enter();
+    lfd = real_socket(AF_INET6, SOCK_STREAM, 0);
+    res = (lfd < 0) ? -1 : 0;
+
+    if (res == 0) {
+        real_setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        res = real_bind(lfd, (struct sockaddr *)&sa, sizeof(sa));
+    }
+
+    if (res == 0) {
+        res = real_listen(lfd, COAP_STREAM_MAX_CONN);
+    }
+
+    _native_syscall_leave();
+
+    if (res < 0 || set_nonblocking(lfd) < 0) {
+        printf("coap_stream: can't listen on port %u\n", COAP_STREAM_PORT);
+        return NULL;
+    }
+
+    for (unsigned i = 0; i < COAP_STREAM_MAX_CONN; i++) {
+        conns[i].fd = -1;
+    }
+
+    DEBUG("coap_stream: listening on port %u\n", COAP_STREAM_PORT);
+
+    while (1) {
+        int fd;
+
+        _native_syscall_enter();
+        fd = real_accept(lfd, NULL, NULL);
+        _native_syscall_leave();
+
+        if (fd >= 0) {
+            conn_t *c = NULL;
+
+            for (unsigned i = 0; i < COAP_STREAM_MAX_CONN; i++) {
+                if (conns[i].fd < 0) {
+                    c = &conns[i];
+                    break;
+                }
+            }
+
+            if (!c || set_nonblocking(fd) < 0) {
+                _native_syscall_enter();
+                real_close(fd);
+                _native_syscall_leave();
+            }
+            else {
+                c->fd = fd;
+                c->rx_len = 0;
+
+                if (send_csm(c) < 0) {
+                    conn_close(c);
+                }
+            }
+        }
+
+        for (unsigned i = 0; i < COAP_STREAM_MAX_CONN; i++) {
+            if (conns[i].fd >= 0) {
+                conn_poll(&conns[i]);
+            }
+        }
+
+        /* the native host blocks the whole process on I/O, so poll */
+        vtimer_usleep(COAP_STREAM_POLL_US);
+    }
+
+    /* never reached */
+    return NULL;
+}
+
+kernel_pid_t coap_stream_init(kernel_pid_t coap_pid)
+{
+    stream_coap_pid = coap_pid;
+
+    return thread_create(stream_stack, sizeof(stream_stack), COAP_STREAM_PRIO,
+                         CREATE_STACKTEST, stream_loop, NULL, "coap_stream");
+}
+#else
+kernel_pid_t coap_stream_init(kernel_pid_t coap_pid)
+{
+    (void)coap_pid;
+
+    puts("coap_stream: no stream transport on this board");
+    return KERNEL_PID_UNDEF;
+}
+#endif
+
+static void print_stats(const char *name, const coap_transport_stats_t *s)
+{
+    printf("%-6s  %8lu  %10lu  %10lu  %8lu  %9lu  %8lu  %8lu  %9lu\n", name,
+           (unsigned long)s->requests, (unsigned long)s->rx_bytes,
+           (unsigned long)s->tx_bytes,
+           (unsigned long)(s->requests ? s->busy_us / s->requests : 0),
+           (unsigned long)s->transfers,
+           (unsigned long)(s->transfers ? s->transfer_us / s->transfers : 0),
+           (unsigned long)s->transfer_max_us,
+           (unsigned long)(s->transfer_us ?
+                           (uint64_t)s->transfer_bytes * 1000000 / s->transfer_us : 0));
+}
+
+int coap_stream_cmd(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    printf("        requests    rx bytes    tx bytes    us/req  transfers"
+           "   us/xfer    max us    bytes/s\n");
+    print_stats("udp", &coap_stats_udp);
+    print_stats("stream", &coap_stats_stream);
+
+    return 0;
+}
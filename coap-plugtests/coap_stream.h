@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2014 Sebastian Sontberg <sebastian@sontberg.de>
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser General
+ * Public License v2.1. See the file LICENSE in the top level directory for more
+ * details.
+ */
+
+/**
+ * @file
+ * @brief       CoAP over a reliable stream transport (RFC 8323 framing)
+ *
+ * A listener thread accepts stream connections and unframes requests.
+ * Each request is handed to the CoAP thread, which runs the handler that
+ * register_handlers() set up for the UDP endpoint, so resources are
+ * shared and handlers never run concurrently. Responses are not limited
+ * by a datagram size, so large representations go out in one message
+ * instead of one Block2 round trip per block.
+ */
+
+#ifndef COAP_STREAM_H
+#define COAP_STREAM_H
+
+#include <stdint.h>
+
+#include "kernel.h"
+#include "msg.h"
+#include "coap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief   Marks the endpoint of requests that arrived over a stream
+ *
+ *          Handlers can test local_interface->flags for it to skip
+ *          block-wise transfer.
+ */
+#define COAP_ENDPOINT_STREAM        (0x80)
+
+/**
+ * @brief   Message type used to pass requests to the CoAP thread
+ */
+#define COAP_STREAM_MSG_REQUEST     (0x5354)
+
+/**
+ * @brief   TCP port of the stream endpoint
+ */
+#ifndef COAP_STREAM_PORT
+#define COAP_STREAM_PORT            (5683U)
+#endif
+
+/**
+ * @brief   Largest message accepted or sent over a stream
+ */
+#ifndef COAP_STREAM_MAX_PDU
+#define COAP_STREAM_MAX_PDU         (2048U)
+#endif
+
+/**
+ * @brief   Maximum number of simultaneous connections
+ */
+#ifndef COAP_STREAM_MAX_CONN
+#define COAP_STREAM_MAX_CONN        (4U)
+#endif
+
+/**
+ * @brief   Interval of polling the connections for data
+ */
+#ifndef COAP_STREAM_POLL_US
+#define COAP_STREAM_POLL_US         (1000U)
+#endif
+
+/**
+ * @brief   Priority of the stream listener thread
+ */
+#ifndef COAP_STREAM_PRIO
+#define COAP_STREAM_PRIO            (PRIORITY_MAIN - 1)
+#endif
+
+#ifndef COAP_STREAM_STACK_SIZE
+#define COAP_STREAM_STACK_SIZE      (KERNEL_CONF_STACKSIZE_DEFAULT)
+#endif
+
+/**
+ * @brief   Per transport counters to compare UDP and stream
+ */
+typedef struct {
+    uint32_t requests;          /**< requests handled */
+    uint32_t rx_bytes;          /**< bytes of received messages */
+    uint32_t tx_bytes;          /**< bytes of sent messages */
+    uint32_t busy_us;           /**< time spent handling requests */
+    uint32_t transfers;         /**< representations transferred */
+    uint32_t transfer_bytes;    /**< bytes of these representations */
+    uint32_t transfer_us;       /**< first request to last response, summed */
+    uint32_t transfer_max_us;   /**< longest transfer */
+    uint32_t transfer_start;    /**< hwtimer ticks the current one started */
+} coap_transport_stats_t;
+
+extern coap_transport_stats_t coap_stats_udp;
+extern coap_transport_stats_t coap_stats_stream;
+
+/**
+ * @brief   Starts timing the transfer of a representation at @p start
+ *
+ *          A transfer runs from the arrival of its first request to the
+ *          last response, over all Block2 round trips on UDP. Only one
+ *          transfer per transport is timed at a time.
+ *
+ * @param[in] s     Counters of the transport.
+ * @param[in] start hwtimer ticks when the first request arrived.
+ */
+void coap_transfer_start(coap_transport_stats_t *s, uint32_t start);
+
+/**
+ * @brief   Ends the transfer started last, after @p bytes of representation
+ */
+void coap_transfer_done(coap_transport_stats_t *s, size_t bytes);
+
+/**
+ * @brief   A request handed from the listener to the CoAP thread
+ */
+typedef struct {
+    coap_pdu_t *request;        /**< the unframed request */
+    coap_pdu_t *response;       /**< the response to fill in */
+    coap_address_t peer;        /**< address of the client */
+} coap_stream_req_t;
+
+/**
+ * @brief   Starts listening for stream connections
+ *
+ * @param[in] coap_pid  PID of the thread running coap_run_context(), whose
+ *                      context provides the resources.
+ *
+ * @return  PID of the listener thread
+ * @return  KERNEL_PID_UNDEF if streams are not available on this board
+ */
+kernel_pid_t coap_stream_init(kernel_pid_t coap_pid);
+
+/**
+ * @brief   Runs the handler for @p req, called by the CoAP thread
+ */
+void coap_stream_dispatch(coap_context_t *ctx, coap_stream_req_t *req);
+
+/**
+ * @brief   Shell command printing the per transport counters
+ */
+int coap_stream_cmd(int argc, char **argv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COAP_STREAM_H */
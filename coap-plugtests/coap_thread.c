@@ -1,6 +1,7 @@
 #include <stdio.h>
 
 #include "byteorder.h"
+#include "hwtimer.h"
 #include "kernel.h"
 #include "periph/random.h"
 #include "net/ng_pktbuf.h"
@@ -9,6 +10,11 @@
 #include "net/ng_ipv6/hdr.h"
 
 #include "coap_thread.h"
+#include "coap_stream.h"
+#include "coap_cocoa.h"
+#include "coap_client.h"
+#include "coap_flight.h"
+#include "coap_view.h"
 #include "coap.h"
 
 
@@ -62,6 +68,7 @@ void *coap_run_context(void *arg)
     /* libcoap-specific variables */
     coap_tick_t now;
     coap_queue_t *nextpdu;
+    uint32_t start;
 
     /* Timers */
     timex_t retrans_time, check_time;
@@ -99,7 +106,41 @@ void *coap_run_context(void *arg)
         switch (msg.type) {
             case NG_NETAPI_MSG_TYPE_RCV:
                 DEBUG("coap: NG_NETAPI_MSG_TYPE_RCV\n");
-                coap_handle_message(ctx, ctx->endpoint, (coap_packet_t *)msg.content.ptr);
+
+                if (coap_cocoa_received((ng_pktsnip_t *)msg.content.ptr)) {
+                    break;
+                }
+
+                /* identical GETs of slow resources share one handler run */
+                if (coap_flight_request(ctx, (ng_pktsnip_t *)msg.content.ptr)) {
+                    break;
+                }
+
+                start = hwtimer_now();
+                coap_stats_udp.requests++;
+                coap_stats_udp.rx_bytes += ng_pkt_len((ng_pktsnip_t *)msg.content.ptr);
+
+                /* requests are handled in place, without libcoap's copy */
+                if (!coap_view_handle(ctx, (ng_pktsnip_t *)msg.content.ptr)) {
+                    coap_handle_message(ctx, ctx->endpoint, (coap_packet_t *)msg.content.ptr);
+                }
+
+                coap_stats_udp.busy_us += HWTIMER_TICKS_TO_US(hwtimer_now() - start);
+                break;
+
+            case COAP_STREAM_MSG_REQUEST:
+                /* requests unframed by the stream listener, handled here
+                 * so handlers never run concurrently */
+                coap_stream_dispatch(ctx, (coap_stream_req_t *)msg.content.ptr);
+                msg_reply(&msg, &msg);
+                break;
+
+            case COAP_FLIGHT_MSG_DONE:
+                coap_flight_done(ctx, msg.content.ptr);
+                break;
+
+            case COAP_CLIENT_MSG_POLL:
+                coap_client_poll(ctx, msg.content.ptr);
                 break;
 
             case MSG_RETRANSMIT:
@@ -107,13 +148,17 @@ void *coap_run_context(void *arg)
 
                 /* Loops over all pdus scheduled to send */
                 while (nextpdu && nextpdu->t <= now - ctx->sendqueue_basetime) {
-                    coap_retransmit(ctx, coap_pop_next(ctx));
+                    nextpdu = coap_pop_next(ctx);
+                    coap_cocoa_retransmit(nextpdu);
+                    coap_retransmit(ctx, nextpdu);
+                    nextpdu = coap_peek_next(ctx);
                 }
 
                 break;
 
             case MSG_CHECKASYNC:
                 /* DEBUG("coap: MSG_CHECKASYNC\n"); */
+                coap_client_timeout(ctx);
                 vtimer_set_msg(&check_notify, check_time,
                                sched_active_pid, MSG_CHECKASYNC, NULL);
                 break;
@@ -123,6 +168,10 @@ void *coap_run_context(void *arg)
                 break;
         }
 
+        /* Confirmable messages sent while handling this message get
+         * the RTO of their peer */
+        coap_cocoa_sent(ctx);
+
         /* Returns the next pdu to retransmit without removing from
            sendqeue. */
         nextpdu = coap_peek_next(ctx);
@@ -0,0 +1,242 @@
+/*
+ * Copyright (C) 2014 Sebastian Sontberg <sebastian@sontberg.de>
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser General
+ * Public License v2.1. See the file LICENSE in the top level directory for more
+ * details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "net/ng_netbase.h"
+#include "net/ng_ipv6/hdr.h"
+
+#include "coap_view.h"
+#include "pdu.h"
+#include "resource.h"
+
+#define ENABLE_DEBUG (0)
+#include "debug.h"
+
+#define PAYLOAD_MARKER  (0xff)
+
+static coap_view_stats_t stats;
+static bool enabled = true;
+
+int coap_view_init(coap_pdu_t *pdu, uint8_t *data, size_t len)
+{
+    coap_hdr_t *hdr = (coap_hdr_t *)data;
+    size_t pos;
+    unsigned opt = 0;
+
+    if (len < sizeof(coap_hdr_t) || hdr->version != COAP_DEFAULT_VERSION ||
+        hdr->token_length > 8) {
+        return -1;
+    }
+
+    pos = sizeof(coap_hdr_t) + hdr->token_length;
+
+    if (pos > len) {
+        return -1;
+    }
+
+    pdu->hdr = hdr;
+    pdu->length = len;
+    pdu->max_size = len;
+    pdu->data = NULL;
+
+    while (pos < len) {
+        unsigned delta = data[pos] >> 4;
+        unsigned olen = data[pos] & 0x0f;
+
+        if (data[pos] == PAYLOAD_MARKER) {
+            /* a marker must be followed by payload */
+            if (pos + 1 == len) {
+                return -1;
+            }
+
+            pdu->data = data + pos + 1;
+            break;
+        }
+
+        if (delta == 15 || olen == 15) {
+            return -1;
+        }
+
+        pos++;
+
+        if (delta >= 13) {
+            if (pos + delta - 12 > len) {
+                return -1;
+            }
+
+            delta = (delta == 13) ? 13 + data[pos] : 269 + ((data[pos] << 8) | data[pos + 1]);
+            pos += (delta < 269) ? 1 : 2;
+        }
+
+        if (olen >= 13) {
+            if (pos + olen - 12 > len) {
+                return -1;
+            }
+
+            olen = (olen == 13) ? 13 + data[pos] : 269 + ((data[pos] << 8) | data[pos + 1]);
+            pos += (olen < 269) ? 1 : 2;
+        }
+
+        if (pos + olen > len) {
+            return -1;
+        }
+
+        opt += delta;
+        pos += olen;
+    }
+
+    pdu->max_delta = opt;
+    return 0;
+}
+
+/* The peer as ng_udp and ng_ipv6 left it in the snips below the payload */
+static int view_peer(ng_pktsnip_t *pkt, coap_address_t *peer)
+{
+    ng_pktsnip_t *ip = NULL, *udp = NULL;
+
+    for (ng_pktsnip_t *s = pkt; s; s = s->next) {
+        if (s->type == NG_NETTYPE_IPV6) {
+            ip = s;
+        }
+        else if (s->type == NG_NETTYPE_UDP) {
+            udp = s;
+        }
+    }
+
+    if (!ip || !udp) {
+        return -1;
+    }
+
+    memset(peer, 0, sizeof(*peer));
+    memcpy(&peer->addr, &((ng_ipv6_hdr_t *)ip->data)->src, sizeof(ng_ipv6_addr_t));
+    peer->port = (((uint8_t *)udp->data)[0] << 8) | ((uint8_t *)udp->data)[1];
+    return 0;
+}
+
+static int copied(ng_pktsnip_t *pkt)
+{
+    /* libcoap copies the message into its packet buffer and from there
+     * into a PDU; count the first one */
+    stats.copied++;
+    stats.bytes_copied += pkt->size;
+    return 0;
+}
+
+int coap_view_handle(coap_context_t *ctx, ng_pktsnip_t *pkt)
+{
+    coap_pdu_t request, *response;
+    coap_address_t peer;
+    coap_opt_filter_t unknown;
+    coap_resource_t *r;
+    coap_method_handler_t h = NULL;
+    coap_key_t key;
+    uint8_t *data = pkt->data;
+    str token;
+
+    if (!enabled || pkt->size < sizeof(coap_hdr_t)) {
+        return copied(pkt);
+    }
+
+    /* requests only, anything else concerns libcoap's send queue */
+    if (data[1] == 0 || data[1] >= 32 || ((data[0] >> 4) & 0x03) > COAP_MESSAGE_NON) {
+        return copied(pkt);
+    }
+
+    /* libcoap answers malformed messages */
+    if (coap_view_init(&request, data, pkt->size) < 0 || view_peer(pkt, &peer) < 0) {
+        return copied(pkt);
+    }
+
+    response = coap_pdu_init(request.hdr->type == COAP_MESSAGE_CON ?
+                             COAP_MESSAGE_ACK : COAP_MESSAGE_NON,
+                             0, request.hdr->id, COAP_MAX_PDU_SIZE);
+
+    if (!response) {
+        return copied(pkt);
+    }
+
+    token.length = request.hdr->token_length;
+    token.s = request.hdr->token;
+    coap_add_token(response, token.length, token.s);
+
+    coap_option_filter_clear(unknown);
+
+    if (!coap_option_check_critical(ctx, &request, unknown)) {
+        response->hdr->code = COAP_RESPONSE_CODE(402);
+    }
+    else {
+        coap_hash_request_uri(&request, key);
+        r = coap_get_resource_from_key(ctx, key);
+
+        if (r && request.hdr->code <= 4) {
+            h = r->handler[request.hdr->code - 1];
+        }
+
+        if (!r) {
+            response->hdr->code = COAP_RESPONSE_CODE(404);
+        }
+        else if (!h) {
+            response->hdr->code = COAP_RESPONSE_CODE(405);
+        }
+        else {
+            h(ctx, r, ctx->endpoint, &peer, &request, &token, response);
+        }
+    }
+
+    /* like libcoap: NON requests only get a response if there is one */
+    if (response->hdr->type != COAP_MESSAGE_NON || response->hdr->code >= 64) {
+        if (coap_send(ctx, ctx->endpoint, &peer, response) == COAP_INVALID_TID) {
+            DEBUG("coap_view: sending response failed\n");
+        }
+    }
+
+    coap_delete_pdu(response);
+
+    /* the request is only referenced until here */
+    ng_pktbuf_release(pkt);
+    stats.viewed++;
+    return 1;
+}
+
+const coap_view_stats_t *coap_view_stats(void)
+{
+    return &stats;
+}
+
+int coap_view_cmd(int argc, char **argv)
+{
+    uint32_t total = stats.viewed + stats.copied;
+
+    if (argc > 1) {
+        if (!strcmp(argv[1], "on") || !strcmp(argv[1], "off")) {
+            enabled = (argv[1][1] == 'n');
+        }
+        else if (!strcmp(argv[1], "reset")) {
+            memset(&stats, 0, sizeof(stats));
+        }
+        else {
+            printf("usage: %s [on|off|reset]\n", argv[0]);
+            return 1;
+        }
+
+        return 0;
+    }
+
+    printf("in place %s: %lu messages viewed, %lu copied, %lu bytes copied",
+           enabled ? "on" : "off", (unsigned long)stats.viewed,
+           (unsigned long)stats.copied, (unsigned long)stats.bytes_copied);
+
+    if (total) {
+        printf(" (%lu per message)", (unsigned long)(stats.bytes_copied / total));
+    }
+
+    puts("");
+    return 0;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2014 Sebastian Sontberg <sebastian@sontberg.de>
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser General
+ * Public License v2.1. See the file LICENSE in the top level directory for more
+ * details.
+ */
+
+/**
+ * @file
+ * @brief       Requests as in-place views over received pktsnips
+ *
+ * coap_handle_message() copies every received message into libcoap's
+ * own buffers before it is parsed. For requests, the CoAP thread instead
+ * validates the message where it lies in the packet buffer and
+ * points the request PDU's header, options and payload at the pktsnip.
+ * Handlers and option iterators read the snip directly. The snip is
+ * released after the handler has returned and the response is sent.
+ *
+ * Responses, ACKs and RSTs still take libcoap's path, since they have to
+ * be matched against its send queue.
+ */
+
+#ifndef COAP_VIEW_H
+#define COAP_VIEW_H
+
+#include <stdint.h>
+
+#include "coap.h"
+#include "net/ng_pktbuf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief   Counters of the request paths
+ */
+typedef struct {
+    uint32_t viewed;            /**< requests handled in place */
+    uint32_t copied;            /**< messages given to coap_handle_message() */
+    uint32_t bytes_copied;      /**< at least copied by libcoap for these */
+} coap_view_stats_t;
+
+/**
+ * @brief   Sets up @p pdu as a view over the message @p data
+ *
+ *          Validates header and options like coap_pdu_parse(), but
+ *          doesn't copy.
+ *
+ * @return  0 on success
+ * @return  -1 if @p data is not a well formed CoAP message
+ */
+int coap_view_init(coap_pdu_t *pdu, uint8_t *data, size_t len);
+
+/**
+ * @brief   Handles a received request in place, called by the CoAP thread
+ *
+ * @return  1 if the request was handled, @p pkt is released then
+ * @return  0 if coap_handle_message() has to take it
+ */
+int coap_view_handle(coap_context_t *ctx, ng_pktsnip_t *pkt);
+
+/**
+ * @brief   Gets the counters
+ */
+const coap_view_stats_t *coap_view_stats(void);
+
+/**
+ * @brief   Shell command printing the bytes copied per request
+ *
+ *          `coap_view on|off` switches between in-place handling and
+ *          libcoap's copying path for comparison, `coap_view reset` clears
+ *          the counters.
+ */
+int coap_view_cmd(int argc, char **argv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COAP_VIEW_H */
@@ -0,0 +1,339 @@
+/*
+ * Copyright (C) 2014 Sebastian Sontberg <sebastian@sontberg.de>
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser General
+ * Public License v2.1. See the file LICENSE in the top level directory for more
+ * details.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "coap_wkc.h"
+#include "pdu.h"
+#include "resource.h"
+#include "utlist.h"
+
+#define ENABLE_DEBUG (0)
+#include "debug.h"
+
+#define WKC_URI ".well-known/core"
+
+#if COAP_WKC_MAX_LINKS > 32
+#error "COAP_WKC_MAX_LINKS must fit into the 32 bit link sets"
+#endif
+
+/**
+ * @brief   One rendered link, e.g. `</test>;rt="Type1 Type2";if="If1"`
+ */
+typedef struct {
+    uint16_t offset;            /**< start of the link in doc */
+    uint16_t len;               /**< length of the link without separator */
+    const str *uri;             /**< the resource's path, for href filters */
+} wkc_link_t;
+
+/**
+ * @brief   One attribute token and the links that carry it
+ */
+typedef struct {
+    const str *name;            /**< attribute name, e.g. rt */
+    const unsigned char *val;   /**< token within the attribute value */
+    size_t len;                 /**< length of the token */
+    uint32_t links;             /**< bit i set if links[i] has the token */
+} wkc_token_t;
+
+static unsigned char doc[COAP_WKC_BUFSIZE];
+static size_t doc_len;
+static bool doc_valid;
+
+static wkc_link_t links[COAP_WKC_MAX_LINKS];
+static unsigned links_numof;
+
+static wkc_token_t tokens[COAP_WKC_MAX_TOKENS];
+static unsigned tokens_numof;
+
+/* Filtered answers are assembled here, the coap thread is the only user */
+static unsigned char filtered[COAP_WKC_BUFSIZE];
+
+static void index_token(const str *name, const unsigned char *val, size_t len,
+                        unsigned link)
+{
+    for (unsigned i = 0; i < tokens_numof; i++) {
+        wkc_token_t *t = &tokens[i];
+
+        if (t->name->length == name->length &&
+            !memcmp(t->name->s, name->s, name->length) &&
+            t->len == len && !memcmp(t->val, val, len)) {
+            t->links |= (1UL << link);
+            return;
+        }
+    }
+
+    if (tokens_numof == COAP_WKC_MAX_TOKENS) {
+        DEBUG("coap_wkc: token index full\n");
+        return;
+    }
+
+    tokens[tokens_numof].name = name;
+    tokens[tokens_numof].val = val;
+    tokens[tokens_numof].len = len;
+    tokens[tokens_numof].links = (1UL << link);
+    tokens_numof++;
+}
+
+/* Splits a (possibly quoted) attribute value into space separated tokens
+ * as described in RFC 6690 section 4.1 */
+static void index_attr(const coap_attr_t *attr, unsigned link)
+{
+    const unsigned char *p = attr->value.s;
+    const unsigned char *end = p + attr->value.length;
+
+    if (p < end && *p == '"') {
+        p++;
+    }
+
+    if (end > p && end[-1] == '"') {
+        end--;
+    }
+
+    while (p < end) {
+        const unsigned char *tok = p;
+
+        while (p < end && *p != ' ') {
+            p++;
+        }
+
+        if (p > tok) {
+            index_token(&attr->name, tok, p - tok, link);
+        }
+
+        p++;
+    }
+}
+
+static void render(coap_context_t *ctx)
+{
+    coap_resource_t *r;
+
+    doc_len = 0;
+    links_numof = 0;
+    tokens_numof = 0;
+
+    RESOURCES_ITER(ctx->resources, r) {
+        size_t len;
+        size_t skip = 0;
+        coap_attr_t *attr;
+
+        if (r->uri.length == strlen(WKC_URI) &&
+            !memcmp(r->uri.s, WKC_URI, r->uri.length)) {
+            continue;
+        }
+
+        if (links_numof == COAP_WKC_MAX_LINKS) {
+            DEBUG("coap_wkc: too many links, document truncated\n");
+            break;
+        }
+
+        if (doc_len > 0) {
+            if (doc_len + 1 > sizeof(doc)) {
+                break;
+            }
+
+            doc[doc_len++] = ',';
+        }
+
+        len = sizeof(doc) - doc_len;
+
+        if (coap_print_link(r, doc + doc_len, &len, &skip) & COAP_PRINT_STATUS_ERROR ||
+            doc_len + len >= sizeof(doc)) {
+            DEBUG("coap_wkc: document exceeds COAP_WKC_BUFSIZE\n");
+            doc_len -= (doc_len > 0);
+            break;
+        }
+
+        links[links_numof].offset = doc_len;
+        links[links_numof].len = len;
+        links[links_numof].uri = &r->uri;
+
+        LL_FOREACH(r->link_attr, attr) {
+            index_attr(attr, links_numof);
+        }
+
+        doc_len += len;
+        links_numof++;
+    }
+
+    doc_valid = true;
+
+    DEBUG("coap_wkc: rendered %u links, %u tokens, %u bytes\n",
+          links_numof, tokens_numof, (unsigned)doc_len);
+}
+
+/* Evaluates a single query filter `name=value` or `name=prefix*` and
+ * returns the set of matching links */
+static uint32_t match(const unsigned char *q, size_t qlen)
+{
+    const unsigned char *eq = memchr(q, '=', qlen);
+    size_t nlen, vlen;
+    const unsigned char *val;
+    bool prefix = false;
+    uint32_t set = 0;
+
+    if (!eq) {
+        return 0;
+    }
+
+    nlen = eq - q;
+    val = eq + 1;
+    vlen = qlen - nlen - 1;
+
+    if (vlen > 0 && val[vlen - 1] == '*') {
+        prefix = true;
+        vlen--;
+    }
+
+    if (nlen == 4 && !memcmp(q, "href", 4)) {
+        /* hrefs start with a slash, libcoap's uris don't */
+        if (vlen > 0 && *val == '/') {
+            val++;
+            vlen--;
+        }
+
+        for (unsigned i = 0; i < links_numof; i++) {
+            const str *uri = links[i].uri;
+
+            if ((prefix ? uri->length >= vlen : uri->length == vlen) &&
+                !memcmp(uri->s, val, vlen)) {
+                set |= (1UL << i);
+            }
+        }
+
+        return set;
+    }
+
+    for (unsigned i = 0; i < tokens_numof; i++) {
+        const wkc_token_t *t = &tokens[i];
+
+        if (t->name->length == nlen && !memcmp(t->name->s, q, nlen) &&
+            (prefix ? t->len >= vlen : t->len == vlen) &&
+            !memcmp(t->val, val, vlen)) {
+            set |= t->links;
+        }
+    }
+
+    return set;
+}
+
+static size_t assemble(uint32_t set)
+{
+    size_t len = 0;
+
+    for (unsigned i = 0; i < links_numof; i++) {
+        if (set & (1UL << i)) {
+            if (len > 0) {
+                filtered[len++] = ',';
+            }
+
+            memcpy(filtered + len, doc + links[i].offset, links[i].len);
+            len += links[i].len;
+        }
+    }
+
+    return len;
+}
+
+void coap_wkc_invalidate(void)
+{
+    doc_valid = false;
+}
+
+void coap_wkc_add_resource(coap_context_t *ctx, coap_resource_t *resource)
+{
+    coap_add_resource(ctx, resource);
+    coap_wkc_invalidate();
+}
+
+int coap_wkc_delete_resource(coap_context_t *ctx, coap_key_t key)
+{
+    int res = coap_delete_resource(ctx, key);
+
+    if (res) {
+        coap_wkc_invalidate();
+    }
+
+    return res;
+}
+
+void coap_wkc_handler(coap_context_t  *ctx, struct coap_resource_t *resource,
+                      const coap_endpoint_t *local_interface,
+                      coap_address_t *peer, coap_pdu_t *request, str *token,
+                      coap_pdu_t *response)
+{
+    /* see index_handler */
+    (void) local_interface;
+    (void) peer;
+    (void) resource;
+    (void) token;
+
+    unsigned char buf[3];
+    unsigned char *data = doc;
+    size_t len;
+    coap_block_t block;
+    coap_opt_iterator_t opt_iter;
+    coap_opt_t *query;
+
+    if (!doc_valid) {
+        render(ctx);
+    }
+
+    len = doc_len;
+
+    /* RFC 6690 allows only one filter per query */
+    query = coap_check_option(request, COAP_OPTION_URI_QUERY, &opt_iter);
+
+    if (query) {
+        len = assemble(match(coap_opt_value(query), coap_opt_length(query)));
+        data = filtered;
+    }
+
+    if (len == 0 && query) {
+        /* nothing matched, RFC 6690 says answer with 4.04 */
+        response->hdr->code = COAP_RESPONSE_CODE(404);
+        return;
+    }
+
+    response->hdr->code = COAP_RESPONSE_CODE(205);
+
+    coap_add_option(response, COAP_OPTION_CONTENT_TYPE,
+                    coap_encode_var_bytes(buf, COAP_MEDIATYPE_APPLICATION_LINK_FORMAT), buf);
+
+    if (!coap_get_block(request, COAP_OPTION_BLOCK2, &block)) {
+        /* leave room for the Block2 option itself */
+        if (response->length + len + 5 <= response->max_size) {
+            coap_add_data(response, len, data);
+            return;
+        }
+
+        block.num = 0;
+        block.m = 0;
+        block.szx = COAP_WKC_SZX;
+    }
+
+    if (coap_write_block_opt(&block, COAP_OPTION_BLOCK2, response, len) < 0) {
+        response->hdr->code = COAP_RESPONSE_CODE(400);
+        return;
+    }
+
+    /* the block is copied straight out of the rendered document */
+    coap_add_block(response, len, data, block.num, block.szx);
+}
+
+void coap_wkc_register(coap_context_t *ctx)
+{
+    coap_resource_t *r;
+
+    r = coap_resource_init((unsigned char *)WKC_URI, strlen(WKC_URI), 0);
+    coap_register_handler(r, COAP_REQUEST_GET, (coap_method_handler_t)coap_wkc_handler);
+    coap_wkc_add_resource(ctx, r);
+}
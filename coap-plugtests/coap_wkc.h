@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2014 Sebastian Sontberg <sebastian@sontberg.de>
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser General
+ * Public License v2.1. See the file LICENSE in the top level directory for more
+ * details.
+ */
+
+/**
+ * @file
+ * @brief       Precomputed /.well-known/core with an attribute index
+ *
+ * The link-format document is rendered once into a static buffer and
+ * only rendered again after coap_wkc_invalidate(). While rendering, the
+ * offset of every link is recorded together with an index that maps
+ * each attribute token (e.g. `rt=Type1`) to the set of links carrying
+ * it, so filtered queries are answered by concatenating prebuilt
+ * fragments instead of walking all resources.
+ */
+
+#ifndef COAP_WKC_H
+#define COAP_WKC_H
+
+#include "coap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief   Size of the buffer holding the rendered document
+ */
+#ifndef COAP_WKC_BUFSIZE
+#define COAP_WKC_BUFSIZE    (512U)
+#endif
+
+/**
+ * @brief   Maximum number of links in the document (at most 32)
+ */
+#ifndef COAP_WKC_MAX_LINKS
+#define COAP_WKC_MAX_LINKS  (32U)
+#endif
+
+/**
+ * @brief   Maximum number of distinct attribute tokens in the index
+ */
+#ifndef COAP_WKC_MAX_TOKENS
+#define COAP_WKC_MAX_TOKENS (32U)
+#endif
+
+/**
+ * @brief   Block size exponent used when the client didn't ask for one
+ *          and the document doesn't fit into the response
+ *
+ *          2**(4+2) = 64 bytes, the same as for /large.
+ */
+#ifndef COAP_WKC_SZX
+#define COAP_WKC_SZX        (2U)
+#endif
+
+/**
+ * @brief   Registers the /.well-known/core resource with @p ctx
+ *
+ *          Resources registered by libcoap take precedence over its built
+ *          in discovery handler, so this replaces it.
+ */
+void coap_wkc_register(coap_context_t *ctx);
+
+/**
+ * @brief   Marks the document as stale
+ *
+ *          Must be called whenever resources or their attributes are added
+ *          to or removed from the context. The document is rendered again
+ *          on the next discovery request.
+ */
+void coap_wkc_invalidate(void);
+
+/**
+ * @brief   Adds @p resource to @p ctx and marks the document as stale
+ *
+ *          Use this instead of coap_add_resource(), after the attributes
+ *          of @p resource are set.
+ */
+void coap_wkc_add_resource(coap_context_t *ctx, coap_resource_t *resource);
+
+/**
+ * @brief   Deletes the resource with @p key from @p ctx and marks the
+ *          document as stale
+ *
+ * @return  1 if the resource was found and deleted, 0 otherwise
+ */
+int coap_wkc_delete_resource(coap_context_t *ctx, coap_key_t key);
+
+void coap_wkc_handler(coap_context_t  *ctx, struct coap_resource_t *resource,
+                      const coap_endpoint_t *local_interface,
+                      coap_address_t *peer, coap_pdu_t *request, str *token,
+                      coap_pdu_t *response);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COAP_WKC_H */
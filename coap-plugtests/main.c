@@ -30,6 +30,16 @@
 #include "coap.h"
 #include "coap_thread.h"
 #include "coap_handlers.h"
+#include "coap_pool.h"
+#include "coap_persist.h"
+#include "coap_stream.h"
+#include "coap_replay.h"
+#include "coap_cocoa.h"
+#include "coap_client.h"
+#include "coap_flight.h"
+#include "coap_view.h"
+#include "netreg_hash.h"
+#include "schc.h"
 
 #define ENABLE_DEBUG (1)
 #include "debug.h"
@@ -114,7 +124,6 @@ int udp_send(int argc, char **argv)
 {
     ng_pktsnip_t *data_snip, *udp_snip, *ip_snip;
     ng_ipv6_addr_t dest_addr;
-    ng_netreg_entry_t *sendto;
     kernel_pid_t iface;
     uint16_t src_port = 0;
     uint16_t dst_port = 0;
@@ -162,24 +171,14 @@ int udp_send(int argc, char **argv)
                                   NULL, 0,
                                   (uint8_t *)&dest_addr.u8, sizeof(ng_ipv6_addr_t));
 
-    /* and forward packet to the network layer */
-    sendto = ng_netreg_lookup(NG_NETTYPE_UDP, NG_NETREG_DEMUX_CTX_ALL);
-
-    /* throw away packet if no one is interested */
-    if (sendto == NULL) {
+    /* and forward packet to the network layer, the packet is thrown away
+     * if no one is interested */
+    if (netreg_hash_dispatch(NG_NETTYPE_UDP, NG_NETREG_DEMUX_CTX_ALL, ip_snip,
+                             NG_NETAPI_MSG_TYPE_SND) == 0) {
         printf("netcat: cannot send packet because network layer not found\n");
-        ng_pktbuf_release(ip_snip);
         return -1;
     }
 
-    /* send packet to network layer */
-    ng_pktbuf_hold(ip_snip, ng_netreg_num(NG_NETTYPE_UDP, NG_NETREG_DEMUX_CTX_ALL) - 1);
-
-    while (sendto != NULL) {
-        ng_netapi_send(sendto->pid, ip_snip);
-        sendto = ng_netreg_getnext(sendto);
-    }
-
     return 0;
 }
 
@@ -273,6 +272,7 @@ static int init_ipv6_linklocal(kernel_pid_t net_if, uint8_t *mac)
         error_with("ULA initialization failed", res, 1);
     }
     else {
+        schc_set_local(&ula_addr);
         DEBUG("unicast address (ULA): %s\n",
               ng_ipv6_addr_to_str(&addr_buf[0],
                                   &ula_addr,
@@ -296,6 +296,10 @@ int main(void)
     kernel_pid_t netif, coap;
     size_t num_netif;
 
+    /* PDUs and send queue nodes come from static slabs */
+    coap_pool_init();
+
+#ifndef COAP_REPLAY
     /* initialize network module(s) */
     ng_netif_init();
 
@@ -349,6 +353,7 @@ int main(void)
         remote_mac[5] -= 1;
 #endif  /* REMOTE_MAC */
         res = ng_ipv6_nc_add(netif, &remote_addr, &remote_mac[0], 6, 0);
+        schc_set_remote(&remote_addr);
 
         if (res < 0) {
             error_with("setup of neighbour cache failed", res, 0);
@@ -371,35 +376,89 @@ int main(void)
     }
 
     ng_netreg_register(NG_NETTYPE_IPV6, &dump);
+
+    /* account bytes on air of received CoAP requests with and without SCHC */
+    schc_monitor_init(COAP_PORT);
+
+    /* udp_send dispatches through the hashed registry, let it find ng_udp
+     * and the SCHC monitor there */
+    netreg_hash_mirror(NG_NETTYPE_UDP, NG_NETREG_DEMUX_CTX_ALL);
+#else
+    /* replay feeds recorded requests to the handlers, no network needed */
+    (void)res;
+    (void)netif;
+    (void)num_netif;
+    (void)nomac_stack;
+    (void)error_with;
+    (void)init_ipv6_linklocal;
+#endif
     
-    /* coap_endpoint_t ep; */
-    /* coap_context_t ctx; */
+#if defined(COAP_SERVER) && !defined(COAP_REPLAY)
+    static coap_endpoint_t ep;
+    static coap_context_t ctx;
 
     /* Setup an endpoint for CoAP (::/5683) on netif */
-    /* coap_init_endpoint(&ep, */
-    /*                    ipv6_addr_any, */
-    /*                    COAP_DEFAULT_PORT, */
-    /*                    netif); */
+    if (coap_init_endpoint(&ep, ipv6_addr_any, COAP_DEFAULT_PORT, netif) < 0) {
+        error_with("coap endpoint initialization failed", -1, 1);
+    }
 
     /* You put that into a "context", libcoaps state struct */
-    /* coap_init_context(&ctx, &ep, 0); */
+    coap_init_context(&ctx, &ep, 0);
+
+    /* Register handlers for resources, which restores their state from
+     * the journal */
+    register_handlers(&ctx);
 
-    /* Register handlers for resources */
-    /* register_handlers(&ctx); */
+    /* start the writer that journals resource state in the background,
+     * once the restore is done with the log */
+    coap_persist_init(coap_persist_default_backend);
 
     /* Run it with with coap_run_context */
-    /* coap = thread_create(coap_stack, sizeof(coap_stack), COAP_PRIO, */
-    /*                      CREATE_STACKTEST, &coap_run_context, &ctx, "coap"); */
+    coap = thread_create(coap_stack, sizeof(coap_stack), COAP_PRIO,
+                         CREATE_STACKTEST, &coap_run_context, &ctx, "coap");
 
-    /* if (coap <= KERNEL_PID_UNDEF) { */
-    /*     error_with("starting coap thread failed", coap, 1); */
-    /* } */
+    if (coap <= KERNEL_PID_UNDEF) {
+        error_with("starting coap thread failed", coap, 1);
+    }
+
+    /* Serve the same resources over a stream (RFC 8323 framing) */
+    res = coap_stream_init(coap);
+
+    if (res <= KERNEL_PID_UNDEF) {
+        error_with("starting coap stream thread failed", res, 0);
+    }
+
+#ifdef COAP_FLIGHT
+    /* Run slow GET handlers once for all identical concurrent requests */
+    res = coap_flight_init(coap);
+
+    if (res <= KERNEL_PID_UNDEF) {
+        error_with("starting coap flight worker failed", res, 0);
+    }
+#endif
+
+#ifdef COAP_CLIENT
+    /* Let the shell start client polling runs on the coap thread */
+    coap_client_init(coap);
+#endif
+#else
+    (void)coap;
+#endif
 
     /* now coap is running and you can't stop it gracefully */
 
     /* start the shell */
     const shell_command_t shell_commands[] = {
         {"udp_send", "Send arbitrary UDP packets", udp_send},
+        {"coap_pool", "Show CoAP PDU pool statistics", coap_pool_cmd},
+        {"coap_stats", "Compare CoAP over UDP and stream", coap_stream_cmd},
+        {"schc", "SCHC statistics, or compress a hex IPv6 packet", schc_cmd},
+        {"cocoa", "CoCoA RTO per peer and loss evaluation", coap_cocoa_cmd},
+        {"coap_poll", "Poll simulated nodes with the pipelined client", coap_client_cmd},
+        {"coap_flight", "Single-flight statistics and thundering herd test", coap_flight_cmd},
+        {"coap_view", "Bytes copied per received CoAP message", coap_view_cmd},
+        {"netreg_bench", "Compare ng_netreg and hashed demux per packet", netreg_hash_cmd},
+        {"replay", "Replay CoAP requests from a pcap file", coap_replay_cmd},
         {NULL, NULL, NULL}
     };
     
@@ -0,0 +1,350 @@
+/*
+ * Copyright (C) 2014 Sebastian Sontberg <sebastian@sontberg.de>
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser General
+ * Public License v2.1. See the file LICENSE in the top level directory for more
+ * details.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hwtimer.h"
+#include "irq.h"
+#include "msg.h"
+#include "thread.h"
+#include "net/ng_netapi.h"
+#include "net/ng_pktbuf.h"
+
+#include "netreg_hash.h"
+
+#define ENABLE_DEBUG (0)
+#include "debug.h"
+
+#define INVALID_TYPE(type)  (((type) < NG_NETTYPE_UNDEF) || ((type) >= NG_NETTYPE_NUMOF))
+
+/* The benchmark keeps its entries out of ng_netreg, whose UNDEF entries
+ * get packets e.g. from ng_netdev_eth in raw mode, and uses a type
+ * nothing is mirrored to in the hashed registry. */
+#define BENCH_TYPE          (NG_NETTYPE_UNDEF)
+#define BENCH_CTX_BASE      (1000U)
+#define BENCH_ITERATIONS    (10000U)
+#define BENCH_PRIO          (PRIORITY_MAIN - 1)
+#define BENCH_MSG_QUEUE_SIZE (8U)
+
+static ng_netreg_entry_t *buckets[NG_NETTYPE_NUMOF][NETREG_HASH_BUCKETS];
+static ng_netreg_entry_t *all[NG_NETTYPE_NUMOF];
+static ng_netreg_entry_t mirrored[NETREG_HASH_MIRROR_MAX];
+static unsigned mirrored_numof;
+
+static ng_netreg_entry_t **chain(ng_nettype_t type, uint32_t demux_ctx)
+{
+    if (demux_ctx == NG_NETREG_DEMUX_CTX_ALL) {
+        return &all[type];
+    }
+
+    /* Fibonacci hashing, ports are often consecutive */
+    return &buckets[type][((uint32_t)(demux_ctx * 2654435761UL) >> 16) & (NETREG_HASH_BUCKETS - 1)];
+}
+
+int netreg_hash_register(ng_nettype_t type, ng_netreg_entry_t *entry)
+{
+    ng_netreg_entry_t **head;
+
+    if (INVALID_TYPE(type)) {
+        return -EINVAL;
+    }
+
+    unsigned state = disableIRQ();
+    head = chain(type, entry->demux_ctx);
+    entry->next = *head;
+    *head = entry;
+    restoreIRQ(state);
+    return 0;
+}
+
+void netreg_hash_unregister(ng_nettype_t type, ng_netreg_entry_t *entry)
+{
+    ng_netreg_entry_t **link;
+
+    if (INVALID_TYPE(type)) {
+        return;
+    }
+
+    unsigned state = disableIRQ();
+    link = chain(type, entry->demux_ctx);
+
+    while (*link && *link != entry) {
+        link = &(*link)->next;
+    }
+
+    if (*link) {
+        *link = entry->next;
+    }
+
+    restoreIRQ(state);
+}
+
+static ng_netreg_entry_t *first(ng_netreg_entry_t *e, uint32_t demux_ctx)
+{
+    while (e && e->demux_ctx != demux_ctx) {
+        e = e->next;
+    }
+
+    return e;
+}
+
+ng_netreg_entry_t *netreg_hash_lookup(ng_nettype_t type, uint32_t demux_ctx)
+{
+    if (INVALID_TYPE(type)) {
+        return NULL;
+    }
+
+    return first(*chain(type, demux_ctx), demux_ctx);
+}
+
+ng_netreg_entry_t *netreg_hash_getnext(ng_netreg_entry_t *entry)
+{
+    /* the bucket may hold other contexts of the same type */
+    return first(entry->next, entry->demux_ctx);
+}
+
+int netreg_hash_num(ng_nettype_t type, uint32_t demux_ctx)
+{
+    int n = 0;
+
+    for (ng_netreg_entry_t *e = netreg_hash_lookup(type, demux_ctx); e;
+         e = netreg_hash_getnext(e)) {
+        n++;
+    }
+
+    return n;
+}
+
+static void send_all(ng_netreg_entry_t *e, ng_pktsnip_t *pkt, uint16_t msg_type)
+{
+    for (; e; e = netreg_hash_getnext(e)) {
+        int res = (msg_type == NG_NETAPI_MSG_TYPE_SND) ?
+                  ng_netapi_send(e->pid, pkt) : ng_netapi_receive(e->pid, pkt);
+
+        if (res < 1) {
+            /* drop the reference held for this receiver */
+            ng_pktbuf_release(pkt);
+        }
+    }
+}
+
+int netreg_hash_dispatch(ng_nettype_t type, uint32_t demux_ctx, ng_pktsnip_t *pkt,
+                         uint16_t msg_type)
+{
+    int n = netreg_hash_num(type, demux_ctx);
+
+    if (demux_ctx != NG_NETREG_DEMUX_CTX_ALL) {
+        n += netreg_hash_num(type, NG_NETREG_DEMUX_CTX_ALL);
+    }
+
+    if (n == 0) {
+        ng_pktbuf_release(pkt);
+        return 0;
+    }
+
+    ng_pktbuf_hold(pkt, n - 1);
+    send_all(netreg_hash_lookup(type, demux_ctx), pkt, msg_type);
+
+    if (demux_ctx != NG_NETREG_DEMUX_CTX_ALL) {
+        send_all(netreg_hash_lookup(type, NG_NETREG_DEMUX_CTX_ALL), pkt, msg_type);
+    }
+
+    return n;
+}
+
+int netreg_hash_mirror(ng_nettype_t type, uint32_t demux_ctx)
+{
+    int n = 0;
+
+    if (INVALID_TYPE(type)) {
+        return -EINVAL;
+    }
+
+    for (ng_netreg_entry_t *e = ng_netreg_lookup(type, demux_ctx); e;
+         e = ng_netreg_getnext(e)) {
+        /* the entry itself is linked into ng_netreg's list */
+        if (mirrored_numof == NETREG_HASH_MIRROR_MAX) {
+            return -ENOMEM;
+        }
+
+        mirrored[mirrored_numof].pid = e->pid;
+        mirrored[mirrored_numof].demux_ctx = e->demux_ctx;
+        netreg_hash_register(type, &mirrored[mirrored_numof++]);
+        n++;
+    }
+
+    return n;
+}
+
+/*
+ * Benchmark
+ */
+
+static ng_netreg_entry_t bench_list[NETREG_HASH_BENCH_MAX + 1];
+static ng_netreg_entry_t bench_hash[NETREG_HASH_BENCH_MAX + 1];
+static ng_netreg_entry_t *bench_head;
+static char bench_stack[KERNEL_CONF_STACKSIZE_DEFAULT];
+static kernel_pid_t bench_pid = KERNEL_PID_UNDEF;
+static unsigned bench_received;
+
+/* Stands in for every registered port, takes the packets and releases them */
+static void *receiver(void *arg)
+{
+    (void)arg;
+    msg_t msg, msg_queue[BENCH_MSG_QUEUE_SIZE];
+
+    msg_init_queue(msg_queue, BENCH_MSG_QUEUE_SIZE);
+
+    while (1) {
+        msg_receive(&msg);
+
+        if (msg.type == NG_NETAPI_MSG_TYPE_RCV) {
+            bench_received++;
+            ng_pktbuf_release((ng_pktsnip_t *)msg.content.ptr);
+        }
+    }
+
+    /* never reached */
+    return NULL;
+}
+
+/* First entry for @p demux_ctx from @p e on, as ng_netreg_getnext() does */
+static ng_netreg_entry_t *list_first(ng_netreg_entry_t *e, uint32_t demux_ctx)
+{
+    while (e && e->demux_ctx != demux_ctx) {
+        e = e->next;
+    }
+
+    return e;
+}
+
+static int list_num(uint32_t demux_ctx)
+{
+    int n = 0;
+
+    for (ng_netreg_entry_t *e = list_first(bench_head, demux_ctx); e;
+         e = list_first(e->next, demux_ctx)) {
+        n++;
+    }
+
+    return n;
+}
+
+/* What ng_ipv6 does with ng_netreg for a received datagram: count the
+ * receivers, hold the packet for them, look them up again and send */
+static int dispatch_list(uint32_t demux_ctx, ng_pktsnip_t *pkt)
+{
+    int n = list_num(demux_ctx) + list_num(NG_NETREG_DEMUX_CTX_ALL);
+
+    if (n == 0) {
+        ng_pktbuf_release(pkt);
+        return 0;
+    }
+
+    ng_pktbuf_hold(pkt, n - 1);
+
+    for (ng_netreg_entry_t *e = list_first(bench_head, demux_ctx); e;
+         e = list_first(e->next, demux_ctx)) {
+        ng_netapi_receive(e->pid, pkt);
+    }
+
+    for (ng_netreg_entry_t *e = list_first(bench_head, NG_NETREG_DEMUX_CTX_ALL); e;
+         e = list_first(e->next, NG_NETREG_DEMUX_CTX_ALL)) {
+        ng_netapi_receive(e->pid, pkt);
+    }
+
+    return n;
+}
+
+static int dispatch_hash(uint32_t demux_ctx, ng_pktsnip_t *pkt)
+{
+    return netreg_hash_dispatch(BENCH_TYPE, demux_ctx, pkt, NG_NETAPI_MSG_TYPE_RCV);
+}
+
+static uint32_t bench(int (*dispatch)(uint32_t, ng_pktsnip_t *), ng_pktsnip_t *pkt,
+                      unsigned regs)
+{
+    unsigned found = 0;
+    unsigned received = bench_received;
+    uint32_t start = hwtimer_now();
+
+    for (unsigned i = 0; i < BENCH_ITERATIONS; i++) {
+        /* the dispatch gives away this reference, ours stays */
+        ng_pktbuf_hold(pkt, 1);
+        found += dispatch(BENCH_CTX_BASE + (i % regs), pkt);
+    }
+
+    uint32_t us = HWTIMER_TICKS_TO_US(hwtimer_now() - start);
+
+    /* every packet goes to its port plus the all-context entry */
+    if (found != 2 * BENCH_ITERATIONS || bench_received - received != found) {
+        printf("netreg_bench: %u receivers found, %u packets received, expected %u\n",
+               found, bench_received - received, 2 * BENCH_ITERATIONS);
+    }
+
+    return (uint32_t)((uint64_t)us * 1000 / BENCH_ITERATIONS);
+}
+
+int netreg_hash_cmd(int argc, char **argv)
+{
+    unsigned max = (argc > 1) ? (unsigned)atoi(argv[1]) : NETREG_HASH_BENCH_MAX;
+    unsigned regs = 0;
+    ng_pktsnip_t *pkt;
+
+    if (max == 0 || max > NETREG_HASH_BENCH_MAX) {
+        max = NETREG_HASH_BENCH_MAX;
+    }
+
+    if (bench_pid == KERNEL_PID_UNDEF) {
+        bench_pid = thread_create(bench_stack, sizeof(bench_stack), BENCH_PRIO,
+                                  CREATE_STACKTEST, receiver, NULL, "netreg_bench");
+    }
+
+    pkt = ng_pktbuf_add(NULL, NULL, 8, NG_NETTYPE_UNDEF);
+
+    if (bench_pid <= KERNEL_PID_UNDEF || pkt == NULL) {
+        puts("netreg_bench: no receiver thread or packet buffer");
+        return 1;
+    }
+
+    /* one listener on all contexts, like pktdump; registered first, so
+     * the list walk has to pass all ports to get to it, as in ng_netreg */
+    bench_list[NETREG_HASH_BENCH_MAX].next = NULL;
+    bench_list[NETREG_HASH_BENCH_MAX].pid = bench_pid;
+    bench_list[NETREG_HASH_BENCH_MAX].demux_ctx = NG_NETREG_DEMUX_CTX_ALL;
+    bench_hash[NETREG_HASH_BENCH_MAX] = bench_list[NETREG_HASH_BENCH_MAX];
+    bench_head = &bench_list[NETREG_HASH_BENCH_MAX];
+    netreg_hash_register(BENCH_TYPE, &bench_hash[NETREG_HASH_BENCH_MAX]);
+
+    printf("%13s %14s %14s\n", "registrations", "ng_netreg ns", "hashed ns");
+
+    for (unsigned n = 1; n <= max; n *= 2) {
+        for (; regs < n; regs++) {
+            bench_list[regs].pid = bench_pid;
+            bench_list[regs].demux_ctx = BENCH_CTX_BASE + regs;
+            bench_list[regs].next = bench_head;
+            bench_head = &bench_list[regs];
+            bench_hash[regs] = bench_list[regs];
+            netreg_hash_register(BENCH_TYPE, &bench_hash[regs]);
+        }
+
+        printf("%13u %14lu %14lu\n", n + 1, (unsigned long)bench(dispatch_list, pkt, n),
+               (unsigned long)bench(dispatch_hash, pkt, n));
+    }
+
+    for (unsigned i = 0; i < regs; i++) {
+        netreg_hash_unregister(BENCH_TYPE, &bench_hash[i]);
+    }
+
+    netreg_hash_unregister(BENCH_TYPE, &bench_hash[NETREG_HASH_BENCH_MAX]);
+    bench_head = NULL;
+    ng_pktbuf_release(pkt);
+    return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2014 Sebastian Sontberg <sebastian@sontberg.de>
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser General
+ * Public License v2.1. See the file LICENSE in the top level directory for more
+ * details.
+ */
+
+/**
+ * @file
+ * @brief       Hashed registry with the interface of ng_netreg
+ *
+ * ng_netreg keeps one list per type and walks it for every lookup, so
+ * demultiplexing gets slower with every registered port. This registry
+ * hashes entries on type and demultiplexing context into buckets.
+ * Entries registered with NG_NETREG_DEMUX_CTX_ALL are kept on a separate
+ * list per type, so the fan-out to them stays a walk over only those.
+ * Entries are the same ng_netreg_entry_t, so consumers can move over
+ * without changes.
+ *
+ * Of the senders, only udp_send of this application has so far: ng_udp,
+ * ng_ipv6 and the rest of the stack still register with ng_netreg, so
+ * their entries are copied over with netreg_hash_mirror().
+ */
+
+#ifndef NETREG_HASH_H
+#define NETREG_HASH_H
+
+#include "kernel.h"
+#include "net/ng_netreg.h"
+#include "net/ng_pkt.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief   Buckets per type, must be a power of 2
+ */
+#ifndef NETREG_HASH_BUCKETS
+#define NETREG_HASH_BUCKETS     (32U)
+#endif
+
+/**
+ * @brief   Number of ng_netreg entries that can be mirrored
+ */
+#ifndef NETREG_HASH_MIRROR_MAX
+#define NETREG_HASH_MIRROR_MAX  (4U)
+#endif
+
+/**
+ * @brief   Largest number of registrations the benchmark goes up to
+ */
+#ifndef NETREG_HASH_BENCH_MAX
+#define NETREG_HASH_BENCH_MAX   (64U)
+#endif
+
+/**
+ * @brief   Registers @p entry for @p type, see ng_netreg_register()
+ *
+ * @return  0 on success
+ * @return  -EINVAL if @p type is out of range
+ */
+int netreg_hash_register(ng_nettype_t type, ng_netreg_entry_t *entry);
+
+/**
+ * @brief   Removes @p entry, see ng_netreg_unregister()
+ */
+void netreg_hash_unregister(ng_nettype_t type, ng_netreg_entry_t *entry);
+
+/**
+ * @brief   First entry registered for exactly @p type and @p demux_ctx
+ *
+ * @return  NULL if there is none
+ */
+ng_netreg_entry_t *netreg_hash_lookup(ng_nettype_t type, uint32_t demux_ctx);
+
+/**
+ * @brief   Next entry with the same context as @p entry
+ */
+ng_netreg_entry_t *netreg_hash_getnext(ng_netreg_entry_t *entry);
+
+/**
+ * @brief   Number of entries for @p type and @p demux_ctx
+ */
+int netreg_hash_num(ng_nettype_t type, uint32_t demux_ctx);
+
+/**
+ * @brief   Hands @p pkt to every entry of @p demux_ctx and to every entry
+ *          of NG_NETREG_DEMUX_CTX_ALL
+ *
+ * @param[in] msg_type  NG_NETAPI_MSG_TYPE_RCV or NG_NETAPI_MSG_TYPE_SND.
+ *
+ * @return  Number of receivers, @p pkt is released if it is 0
+ */
+int netreg_hash_dispatch(ng_nettype_t type, uint32_t demux_ctx, ng_pktsnip_t *pkt,
+                         uint16_t msg_type);
+
+/**
+ * @brief   Registers copies of the entries ng_netreg has for @p type and
+ *          @p demux_ctx, for receivers that register with ng_netreg only
+ *
+ * Entries registered with ng_netreg later are not picked up.
+ *
+ * @return  Number of entries copied
+ * @return  -EINVAL if @p type is out of range
+ * @return  -ENOMEM if NETREG_HASH_MIRROR_MAX entries are mirrored already
+ */
+int netreg_hash_mirror(ng_nettype_t type, uint32_t demux_ctx);
+
+/**
+ * @brief   Shell command comparing ns per packet handed to all receivers
+ *          with a lookup, hold and send loop over a single list per type,
+ *          as ng_netreg keeps it, and with netreg_hash_dispatch(), for a
+ *          growing number of registrations
+ *
+ *          All entries belong to a receiver thread that releases the
+ *          packets. They are kept out of ng_netreg, so the stack never
+ *          hands them a packet.
+ *
+ *          `netreg_bench [max registrations]`
+ */
+int netreg_hash_cmd(int argc, char **argv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NETREG_HASH_H */
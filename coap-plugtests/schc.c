@@ -0,0 +1,1165 @@
+/*
+ * Copyright (C) 2014 Sebastian Sontberg <sebastian@sontberg.de>
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser General
+ * Public License v2.1. See the file LICENSE in the top level directory for more
+ * details.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "msg.h"
+#include "thread.h"
+#include "net/ng_netbase.h"
+
+#include "schc.h"
+#include "coap_thread.h"
+
+#define ENABLE_DEBUG (0)
+#include "debug.h"
+
+#define IPV6_HDR_LEN        (40U)
+#define UDP_HDR_LEN         (8U)
+#define COAP_HDR_LEN        (4U)
+#define PROTNUM_UDP         (17U)
+#define OPT_URI_PATH        (11U)
+#define OPT_CONTENT_FORMAT  (12U)
+
+#define SCHC_MAX_PATH       (3U)
+
+/* 127 byte PHY payload, MAC header with long addresses and FCS */
+#define IEEE802154_FRAME_LEN    (127U)
+#define IEEE802154_OVERHEAD     (23U)
+#define SIXLOWPAN_FRAG1_LEN     (4U)
+#define SIXLOWPAN_FRAGN_LEN     (5U)
+
+#define MONITOR_MSG_QUEUE_SIZE  (8U)
+
+/**
+ * @brief   Field identifiers
+ */
+enum {
+    F_IPV6_VER = 0,
+    F_IPV6_TC,
+    F_IPV6_FL,
+    F_IPV6_LEN,
+    F_IPV6_NH,
+    F_IPV6_HL,
+    F_IPV6_SRC_PREFIX,
+    F_IPV6_SRC_IID,
+    F_IPV6_DST_PREFIX,
+    F_IPV6_DST_IID,
+    F_UDP_SRC,
+    F_UDP_DST,
+    F_UDP_LEN,
+    F_UDP_CKSUM,
+    F_COAP_VER,
+    F_COAP_TYPE,
+    F_COAP_TKL,
+    F_COAP_CODE,
+    F_COAP_MID,
+    F_COAP_TOKEN,           /**< TKL bytes long */
+    F_COAP_URI_PATH,        /**< string, one field per segment */
+    F_COAP_CF,
+    F_NUMOF
+};
+
+static const uint8_t field_bits[F_NUMOF] = {
+    4, 8, 20, 16, 8, 8, 64, 64, 64, 64,
+    16, 16, 16, 16,
+    2, 2, 4, 8, 16, 0, 0, 16
+};
+
+/**
+ * @brief   Matching operators
+ */
+enum {
+    MO_EQUAL,
+    MO_IGNORE,
+    MO_MSB,
+    MO_MAPPING,
+};
+
+/**
+ * @brief   Compression/decompression actions
+ */
+enum {
+    CDA_NOT_SENT,
+    CDA_VALUE_SENT,
+    CDA_LSB,
+    CDA_MAPPING_SENT,
+    CDA_COMPUTE,
+};
+
+enum {
+    DIR_DOWN,               /**< towards us: requests */
+    DIR_UP,                 /**< from us: responses */
+};
+
+typedef struct {
+    uint8_t fid;
+    uint8_t pos;                /**< Uri-Path segment (1-based) */
+    uint8_t mo;
+    uint8_t cda;
+    uint8_t msb;                /**< bits compared by MO_MSB and kept by LSB */
+    const uint64_t *tv;         /**< target value, NULL means 0 */
+    const uint64_t *map;        /**< mapping of numeric fields */
+    const char *const *smap;    /**< mapping of Uri-Path segments */
+    uint8_t map_len;
+} field_t;
+
+typedef struct {
+    uint8_t id;
+    uint8_t dir;
+    uint8_t path_num;           /**< number of Uri-Path options */
+    uint8_t has_cf;             /**< Content-Format present */
+    const field_t *fields;
+    uint8_t numof;
+} rule_t;
+
+/**
+ * @brief   A parsed IPv6/UDP/CoAP packet
+ */
+typedef struct {
+    uint64_t f[F_NUMOF];
+    uint8_t path_num;
+    const uint8_t *path[SCHC_MAX_PATH];
+    uint8_t path_len[SCHC_MAX_PATH];
+    uint8_t has_cf;
+    const uint8_t *payload;
+    size_t payload_len;
+} pkt_t;
+
+typedef struct {
+    uint8_t *buf;
+    size_t size;                /**< in bits */
+    size_t pos;                 /**< in bits */
+} bitbuf_t;
+
+/* Target values */
+static const uint64_t tv_ipv6 = 6;
+static const uint64_t tv_udp = PROTNUM_UDP;
+static const uint64_t tv_hl = 64;
+static const uint64_t tv_coap_ver = 1;
+static const uint64_t tv_port = COAP_PORT;
+static uint64_t tv_local_iid;
+static uint64_t tv_remote_iid;
+
+/* Both ends use the ULA prefix or link-local addresses */
+static uint64_t map_prefix[] = { 0, 0xfe80000000000000ULL };
+
+static const uint64_t map_req_code[] = { 1, 2, 3, 4 };     /* GET .. DELETE */
+static const uint64_t map_rsp_code[] = {
+    0x00,                                       /* empty ACK */
+    0x41, 0x42, 0x43, 0x44, 0x45,               /* 2.01 .. 2.05 */
+    0x80, 0x84, 0x85, 0x8c,                     /* 4.00 4.04 4.05 4.12 */
+    0xa0,                                       /* 5.00 */
+};
+static const uint64_t map_cf[] = { 0, 40, 41, 50 };
+
+/* Every path segment of the resources in register_handlers() */
+static const char *const map_path[] = {
+    "test", "link1", "link2", "link3", "path", "sub1", "separate",
+    "seg1", "seg2", "seg3", "query", "location-query", "multi-format",
+    "validate", "create1", "large", "threads", ".well-known", "core",
+};
+
+#define NUMOF(a) (sizeof(a) / sizeof((a)[0]))
+
+#define FIELD(fid, mo, cda, tv) { fid, 0, mo, cda, 0, tv, NULL, NULL, 0 }
+#define MAPPED(fid, map) { fid, 0, MO_MAPPING, CDA_MAPPING_SENT, 0, NULL, \
+                           map, NULL, NUMOF(map) }
+#define PATH(pos) { F_COAP_URI_PATH, pos, MO_MAPPING, CDA_MAPPING_SENT, 0, \
+                    NULL, NULL, map_path, NUMOF(map_path) }
+
+#define IPV6_COMMON \
+    FIELD(F_IPV6_VER, MO_EQUAL, CDA_NOT_SENT, &tv_ipv6), \
+    FIELD(F_IPV6_TC, MO_EQUAL, CDA_NOT_SENT, NULL), \
+    FIELD(F_IPV6_FL, MO_IGNORE, CDA_NOT_SENT, NULL), \
+    FIELD(F_IPV6_LEN, MO_IGNORE, CDA_COMPUTE, NULL), \
+    FIELD(F_IPV6_NH, MO_EQUAL, CDA_NOT_SENT, &tv_udp), \
+    FIELD(F_IPV6_HL, MO_IGNORE, CDA_NOT_SENT, &tv_hl), \
+    MAPPED(F_IPV6_SRC_PREFIX, map_prefix)
+
+#define COAP_COMMON(code_map) \
+    FIELD(F_UDP_LEN, MO_IGNORE, CDA_COMPUTE, NULL), \
+    FIELD(F_UDP_CKSUM, MO_IGNORE, CDA_COMPUTE, NULL), \
+    FIELD(F_COAP_VER, MO_EQUAL, CDA_NOT_SENT, &tv_coap_ver), \
+    FIELD(F_COAP_TYPE, MO_IGNORE, CDA_VALUE_SENT, NULL), \
+    FIELD(F_COAP_TKL, MO_IGNORE, CDA_VALUE_SENT, NULL), \
+    MAPPED(F_COAP_CODE, code_map), \
+    FIELD(F_COAP_MID, MO_IGNORE, CDA_VALUE_SENT, NULL), \
+    FIELD(F_COAP_TOKEN, MO_IGNORE, CDA_VALUE_SENT, NULL)
+
+/* Requests from the known peer */
+#define REQ(...) \
+    IPV6_COMMON, \
+    FIELD(F_IPV6_SRC_IID, MO_EQUAL, CDA_NOT_SENT, &tv_remote_iid), \
+    MAPPED(F_IPV6_DST_PREFIX, map_prefix), \
+    FIELD(F_IPV6_DST_IID, MO_EQUAL, CDA_NOT_SENT, &tv_local_iid), \
+    FIELD(F_UDP_SRC, MO_IGNORE, CDA_VALUE_SENT, NULL), \
+    FIELD(F_UDP_DST, MO_EQUAL, CDA_NOT_SENT, &tv_port), \
+    COAP_COMMON(map_req_code), \
+    __VA_ARGS__
+
+/* Responses to the known peer */
+#define RSP(...) \
+    IPV6_COMMON, \
+    FIELD(F_IPV6_SRC_IID, MO_EQUAL, CDA_NOT_SENT, &tv_local_iid), \
+    MAPPED(F_IPV6_DST_PREFIX, map_prefix), \
+    FIELD(F_IPV6_DST_IID, MO_EQUAL, CDA_NOT_SENT, &tv_remote_iid), \
+    FIELD(F_UDP_SRC, MO_EQUAL, CDA_NOT_SENT, &tv_port), \
+    FIELD(F_UDP_DST, MO_IGNORE, CDA_VALUE_SENT, NULL), \
+    COAP_COMMON(map_rsp_code), \
+    __VA_ARGS__
+
+static const field_t req_1[] = { REQ(PATH(1)) };
+static const field_t req_1_cf[] = { REQ(PATH(1), MAPPED(F_COAP_CF, map_cf)) };
+static const field_t req_2[] = { REQ(PATH(1), PATH(2)) };
+static const field_t req_3[] = { REQ(PATH(1), PATH(2), PATH(3)) };
+static const field_t rsp[] = { RSP(FIELD(F_COAP_CF, MO_EQUAL, CDA_NOT_SENT, NULL)) };
+static const field_t rsp_cf[] = { RSP(MAPPED(F_COAP_CF, map_cf)) };
+
+/* Requests from any host on our prefixes */
+static const field_t req_any[] = {
+    IPV6_COMMON,
+    FIELD(F_IPV6_SRC_IID, MO_IGNORE, CDA_VALUE_SENT, NULL),
+    MAPPED(F_IPV6_DST_PREFIX, map_prefix),
+    FIELD(F_IPV6_DST_IID, MO_EQUAL, CDA_NOT_SENT, &tv_local_iid),
+    FIELD(F_UDP_SRC, MO_IGNORE, CDA_VALUE_SENT, NULL),
+    FIELD(F_UDP_DST, MO_EQUAL, CDA_NOT_SENT, &tv_port),
+    COAP_COMMON(map_req_code),
+    PATH(1)
+};
+
+static const rule_t rules[] = {
+    { 1, DIR_DOWN, 1, 0, req_1, NUMOF(req_1) },
+    { 2, DIR_DOWN, 1, 1, req_1_cf, NUMOF(req_1_cf) },
+    { 3, DIR_DOWN, 2, 0, req_2, NUMOF(req_2) },
+    { 4, DIR_DOWN, 3, 0, req_3, NUMOF(req_3) },
+    { 5, DIR_DOWN, 1, 0, req_any, NUMOF(req_any) },
+    { 10, DIR_UP, 0, 0, rsp, NUMOF(rsp) },
+    { 11, DIR_UP, 0, 1, rsp_cf, NUMOF(rsp_cf) },
+};
+
+static schc_stats_t stats[SCHC_DIR_NUMOF];
+static char monitor_stack[SCHC_STACK_SIZE];
+static uint16_t monitor_port;
+static ng_ipv6_addr_t local_addr;
+
+static uint64_t be64(const uint8_t *b)
+{
+    uint64_t v = 0;
+
+    for (int i = 0; i < 8; i++) {
+        v = (v << 8) | b[i];
+    }
+
+    return v;
+}
+
+static void put_be64(uint8_t *b, uint64_t v)
+{
+    for (int i = 7; i >= 0; i--) {
+        b[i] = v & 0xff;
+        v >>= 8;
+    }
+}
+
+static unsigned map_bits(unsigned n)
+{
+    unsigned b = 0;
+
+    while ((1U << b) < n) {
+        b++;
+    }
+
+    return b;
+}
+
+static int put_bits(bitbuf_t *bb, uint64_t v, unsigned n)
+{
+    if (bb->pos + n > bb->size) {
+        return -1;
+    }
+
+    while (n--) {
+        uint8_t bit = (v >> n) & 1;
+        uint8_t mask = 0x80 >> (bb->pos & 7);
+
+        if (bit) {
+            bb->buf[bb->pos >> 3] |= mask;
+        }
+        else {
+            bb->buf[bb->pos >> 3] &= ~mask;
+        }
+
+        bb->pos++;
+    }
+
+    return 0;
+}
+
+static int get_bits(bitbuf_t *bb, uint64_t *v, unsigned n)
+{
+    if (bb->pos + n > bb->size) {
+        return -1;
+    }
+
+    *v = 0;
+
+    while (n--) {
+        *v = (*v << 1) | ((bb->buf[bb->pos >> 3] >> (7 - (bb->pos & 7))) & 1);
+        bb->pos++;
+    }
+
+    return 0;
+}
+
+static unsigned bits_of(const pkt_t *p, uint8_t fid)
+{
+    return (fid == F_COAP_TOKEN) ? p->f[F_COAP_TKL] * 8 : field_bits[fid];
+}
+
+static size_t opt_hdr(uint8_t *b, unsigned delta, size_t len)
+{
+    size_t n = 1;
+    uint8_t nib_d, nib_l;
+
+    nib_d = (delta < 13) ? delta : (delta < 269) ? 13 : 14;
+    nib_l = (len < 13) ? len : (len < 269) ? 13 : 14;
+    b[0] = (nib_d << 4) | nib_l;
+
+    if (nib_d == 13) {
+        b[n++] = delta - 13;
+    }
+    else if (nib_d == 14) {
+        b[n++] = (delta - 269) >> 8;
+        b[n++] = (delta - 269) & 0xff;
+    }
+
+    if (nib_l == 13) {
+        b[n++] = len - 13;
+    }
+    else if (nib_l == 14) {
+        b[n++] = (len - 269) >> 8;
+        b[n++] = (len - 269) & 0xff;
+    }
+
+    return n;
+}
+
+/* Reads an extended option delta or length */
+static int opt_ext(const uint8_t *b, size_t *pos, size_t end, unsigned nib,
+                   unsigned *val)
+{
+    if (nib < 13) {
+        *val = nib;
+    }
+    else if (nib == 13 && *pos < end) {
+        *val = 13 + b[(*pos)++];
+    }
+    else if (nib == 14 && *pos + 1 < end) {
+        *val = 269 + ((b[*pos] << 8) | b[*pos + 1]);
+        *pos += 2;
+    }
+    else {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int parse(const uint8_t *b, size_t len, pkt_t *p)
+{
+    const uint8_t *c = b + IPV6_HDR_LEN + UDP_HDR_LEN;
+    size_t clen = len - IPV6_HDR_LEN - UDP_HDR_LEN;
+    size_t pos;
+    unsigned last = 0;
+
+    if (len < IPV6_HDR_LEN + UDP_HDR_LEN + COAP_HDR_LEN) {
+        return -1;
+    }
+
+    memset(p, 0, sizeof(*p));
+
+    p->f[F_IPV6_VER] = b[0] >> 4;
+    p->f[F_IPV6_TC] = ((b[0] & 0x0f) << 4) | (b[1] >> 4);
+    p->f[F_IPV6_FL] = ((uint32_t)(b[1] & 0x0f) << 16) | (b[2] << 8) | b[3];
+    p->f[F_IPV6_LEN] = (b[4] << 8) | b[5];
+    p->f[F_IPV6_NH] = b[6];
+    p->f[F_IPV6_HL] = b[7];
+    p->f[F_IPV6_SRC_PREFIX] = be64(b + 8);
+    p->f[F_IPV6_SRC_IID] = be64(b + 16);
+    p->f[F_IPV6_DST_PREFIX] = be64(b + 24);
+    p->f[F_IPV6_DST_IID] = be64(b + 32);
+
+    b += IPV6_HDR_LEN;
+    p->f[F_UDP_SRC] = (b[0] << 8) | b[1];
+    p->f[F_UDP_DST] = (b[2] << 8) | b[3];
+    p->f[F_UDP_LEN] = (b[4] << 8) | b[5];
+    p->f[F_UDP_CKSUM] = (b[6] << 8) | b[7];
+
+    if (p->f[F_IPV6_NH] != PROTNUM_UDP ||
+        p->f[F_IPV6_LEN] != len - IPV6_HDR_LEN ||
+        p->f[F_UDP_LEN] != len - IPV6_HDR_LEN) {
+        return -1;
+    }
+
+    p->f[F_COAP_VER] = c[0] >> 6;
+    p->f[F_COAP_TYPE] = (c[0] >> 4) & 0x3;
+    p->f[F_COAP_TKL] = c[0] & 0x0f;
+    p->f[F_COAP_CODE] = c[1];
+    p->f[F_COAP_MID] = (c[2] << 8) | c[3];
+    pos = COAP_HDR_LEN;
+
+    if (p->f[F_COAP_TKL] > 8 || pos + p->f[F_COAP_TKL] > clen) {
+        return -1;
+    }
+
+    for (unsigned i = 0; i < p->f[F_COAP_TKL]; i++) {
+        p->f[F_COAP_TOKEN] = (p->f[F_COAP_TOKEN] << 8) | c[pos++];
+    }
+
+    while (pos < clen && c[pos] != 0xff) {
+        unsigned delta, olen;
+        uint8_t nib = c[pos++];
+
+        if (opt_ext(c, &pos, clen, nib >> 4, &delta) < 0 ||
+            opt_ext(c, &pos, clen, nib & 0x0f, &olen) < 0 ||
+            pos + olen > clen) {
+            return -1;
+        }
+
+        last += delta;
+
+        if (last == OPT_URI_PATH && p->path_num < SCHC_MAX_PATH) {
+            p->path[p->path_num] = c + pos;
+            p->path_len[p->path_num] = olen;
+            p->path_num++;
+        }
+        else if (last == OPT_CONTENT_FORMAT && olen <= 2) {
+            p->has_cf = 1;
+
+            for (unsigned i = 0; i < olen; i++) {
+                p->f[F_COAP_CF] = (p->f[F_COAP_CF] << 8) | c[pos + i];
+            }
+        }
+        else {
+            /* no rule covers this option */
+            return -1;
+        }
+
+        pos += olen;
+    }
+
+    if (pos < clen) {
+        /* payload marker followed by the payload */
+        p->payload = c + pos + 1;
+        p->payload_len = clen - pos - 1;
+
+        if (p->payload_len == 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static uint16_t cksum_add(uint32_t sum, const uint8_t *b, size_t len)
+{
+    for (size_t i = 0; i + 1 < len; i += 2) {
+        sum += (b[i] << 8) | b[i + 1];
+    }
+
+    if (len & 1) {
+        sum += b[len - 1] << 8;
+    }
+
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+
+    return sum;
+}
+
+/* Fills in the UDP checksum of the packet @p b with @p plen bytes of UDP */
+static void udp_cksum(uint8_t *b, size_t plen)
+{
+    uint8_t pseudo[8];
+    uint16_t sum;
+
+    b[IPV6_HDR_LEN + 6] = 0;
+    b[IPV6_HDR_LEN + 7] = 0;
+
+    /* pseudo header: addresses, upper layer length, next header */
+    memset(pseudo, 0, sizeof(pseudo));
+    pseudo[2] = plen >> 8;
+    pseudo[3] = plen & 0xff;
+    pseudo[7] = PROTNUM_UDP;
+    sum = cksum_add(0, b + 8, 32);
+    sum = cksum_add(sum, pseudo, sizeof(pseudo));
+    sum = ~cksum_add(sum, b + IPV6_HDR_LEN, plen);
+
+    if (sum == 0) {
+        sum = 0xffff;
+    }
+
+    b[IPV6_HDR_LEN + 6] = sum >> 8;
+    b[IPV6_HDR_LEN + 7] = sum & 0xff;
+}
+
+/* Assembles the packet and computes lengths and the UDP checksum */
+static int build(const pkt_t *p, uint8_t *out, size_t out_len)
+{
+    uint8_t *c = out + IPV6_HDR_LEN + UDP_HDR_LEN;
+    size_t pos = COAP_HDR_LEN;
+    size_t plen;
+    unsigned last = 0;
+
+    /* generous bound for header, token and option headers */
+    if (out_len < IPV6_HDR_LEN + UDP_HDR_LEN + COAP_HDR_LEN + 8 + 16 +
+        p->path_num * 3 + p->payload_len + 1) {
+        return -1;
+    }
+
+    c[0] = (p->f[F_COAP_VER] << 6) | (p->f[F_COAP_TYPE] << 4) | p->f[F_COAP_TKL];
+    c[1] = p->f[F_COAP_CODE];
+    c[2] = p->f[F_COAP_MID] >> 8;
+    c[3] = p->f[F_COAP_MID] & 0xff;
+
+    for (int i = p->f[F_COAP_TKL] - 1; i >= 0; i--) {
+        c[pos++] = (p->f[F_COAP_TOKEN] >> (8 * i)) & 0xff;
+    }
+
+    for (unsigned i = 0; i < p->path_num; i++) {
+        if (pos + 3 + p->path_len[i] > out_len - IPV6_HDR_LEN - UDP_HDR_LEN) {
+            return -1;
+        }
+
+        pos += opt_hdr(c + pos, OPT_URI_PATH - last, p->path_len[i]);
+        memcpy(c + pos, p->path[i], p->path_len[i]);
+        pos += p->path_len[i];
+        last = OPT_URI_PATH;
+    }
+
+    if (p->has_cf) {
+        uint64_t cf = p->f[F_COAP_CF];
+        size_t n = (cf == 0) ? 0 : (cf < 256) ? 1 : 2;
+
+        pos += opt_hdr(c + pos, OPT_CONTENT_FORMAT - last, n);
+
+        while (n--) {
+            c[pos++] = (cf >> (8 * n)) & 0xff;
+        }
+    }
+
+    if (p->payload_len) {
+        if (IPV6_HDR_LEN + UDP_HDR_LEN + pos + 1 + p->payload_len > out_len) {
+            return -1;
+        }
+
+        c[pos++] = 0xff;
+        memcpy(c + pos, p->payload, p->payload_len);
+        pos += p->payload_len;
+    }
+
+    plen = UDP_HDR_LEN + pos;
+
+    out[0] = (p->f[F_IPV6_VER] << 4) | (p->f[F_IPV6_TC] >> 4);
+    out[1] = ((p->f[F_IPV6_TC] & 0x0f) << 4) | ((p->f[F_IPV6_FL] >> 16) & 0x0f);
+    out[2] = (p->f[F_IPV6_FL] >> 8) & 0xff;
+    out[3] = p->f[F_IPV6_FL] & 0xff;
+    out[4] = plen >> 8;
+    out[5] = plen & 0xff;
+    out[6] = p->f[F_IPV6_NH];
+    out[7] = p->f[F_IPV6_HL];
+    put_be64(out + 8, p->f[F_IPV6_SRC_PREFIX]);
+    put_be64(out + 16, p->f[F_IPV6_SRC_IID]);
+    put_be64(out + 24, p->f[F_IPV6_DST_PREFIX]);
+    put_be64(out + 32, p->f[F_IPV6_DST_IID]);
+
+    out[40] = p->f[F_UDP_SRC] >> 8;
+    out[41] = p->f[F_UDP_SRC] & 0xff;
+    out[42] = p->f[F_UDP_DST] >> 8;
+    out[43] = p->f[F_UDP_DST] & 0xff;
+    out[44] = plen >> 8;
+    out[45] = plen & 0xff;
+    udp_cksum(out, plen);
+
+    return IPV6_HDR_LEN + plen;
+}
+
+static bool field_matches(const pkt_t *p, const field_t *fd)
+{
+    uint64_t v, tv = fd->tv ? *fd->tv : 0;
+    unsigned bits;
+
+    if (fd->fid == F_COAP_URI_PATH) {
+        const uint8_t *seg = p->path[fd->pos - 1];
+        size_t len = p->path_len[fd->pos - 1];
+
+        if (fd->mo == MO_IGNORE) {
+            return true;
+        }
+
+        for (unsigned i = 0; i < fd->map_len; i++) {
+            if (strlen(fd->smap[i]) == len && !memcmp(fd->smap[i], seg, len)) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    v = p->f[fd->fid];
+    bits = bits_of(p, fd->fid);
+
+    switch (fd->mo) {
+        case MO_EQUAL:
+            return v == tv;
+
+        case MO_IGNORE:
+            return true;
+
+        case MO_MSB:
+            return (v >> (bits - fd->msb)) == (tv >> (bits - fd->msb));
+
+        case MO_MAPPING:
+            for (unsigned i = 0; i < fd->map_len; i++) {
+                if (fd->map[i] == v) {
+                    return true;
+                }
+            }
+
+            return false;
+    }
+
+    return false;
+}
+
+static int emit_field(bitbuf_t *bb, const pkt_t *p, const field_t *fd)
+{
+    unsigned bits = bits_of(p, fd->fid);
+    uint64_t v = p->f[fd->fid];
+
+    switch (fd->cda) {
+        case CDA_NOT_SENT:
+        case CDA_COMPUTE:
+            return 0;
+
+        case CDA_VALUE_SENT:
+            if (fd->fid == F_COAP_URI_PATH) {
+                const uint8_t *seg = p->path[fd->pos - 1];
+                size_t len = p->path_len[fd->pos - 1];
+
+                if (len > 15 || put_bits(bb, len, 4) < 0) {
+                    return -1;
+                }
+
+                for (size_t i = 0; i < len; i++) {
+                    if (put_bits(bb, seg[i], 8) < 0) {
+                        return -1;
+                    }
+                }
+
+                return 0;
+            }
+
+            return put_bits(bb, v, bits);
+
+        case CDA_LSB:
+            return put_bits(bb, v, bits - fd->msb);
+
+        case CDA_MAPPING_SENT:
+            for (unsigned i = 0; i < fd->map_len; i++) {
+                if ((fd->fid == F_COAP_URI_PATH) ?
+                    (strlen(fd->smap[i]) == p->path_len[fd->pos - 1] &&
+                     !memcmp(fd->smap[i], p->path[fd->pos - 1], p->path_len[fd->pos - 1])) :
+                    (fd->map[i] == v)) {
+                    return put_bits(bb, i, map_bits(fd->map_len));
+                }
+            }
+
+            return -1;
+    }
+
+    return -1;
+}
+
+static int compress_rule(const rule_t *r, const pkt_t *p, uint8_t *out, size_t out_len)
+{
+    bitbuf_t bb = { out, out_len * 8, 0 };
+
+    for (unsigned i = 0; i < r->numof; i++) {
+        if (!field_matches(p, &r->fields[i])) {
+            return -1;
+        }
+    }
+
+    memset(out, 0, out_len);
+
+    if (put_bits(&bb, r->id, 8) < 0) {
+        return -1;
+    }
+
+    for (unsigned i = 0; i < r->numof; i++) {
+        if (emit_field(&bb, p, &r->fields[i]) < 0) {
+            return -1;
+        }
+    }
+
+    /* payload directly follows the residue, padded to full bytes */
+    for (size_t i = 0; i < p->payload_len; i++) {
+        if (put_bits(&bb, p->payload[i], 8) < 0) {
+            return -1;
+        }
+    }
+
+    return (bb.pos + 7) / 8;
+}
+
+int schc_compress(const uint8_t *pkt, size_t len, uint8_t *out, size_t out_len)
+{
+    pkt_t p;
+
+    if (parse(pkt, len, &p) == 0) {
+        uint8_t dir = (p.f[F_UDP_DST] == COAP_PORT) ? DIR_DOWN : DIR_UP;
+
+        for (unsigned i = 0; i < NUMOF(rules); i++) {
+            const rule_t *r = &rules[i];
+            int res;
+
+            if (r->dir != dir || r->path_num != p.path_num ||
+                r->has_cf != p.has_cf) {
+                continue;
+            }
+
+            res = compress_rule(r, &p, out, out_len);
+
+            if (res > 0) {
+                return res;
+            }
+        }
+    }
+
+    if (len + 1 > out_len) {
+        return -1;
+    }
+
+    out[0] = SCHC_RULE_UNCOMPRESSED;
+    memcpy(out + 1, pkt, len);
+    return len + 1;
+}
+
+int schc_decompress(const uint8_t *in, size_t len, uint8_t *out, size_t out_len)
+{
+    bitbuf_t bb = { (uint8_t *)in, len * 8, 0 };
+    static uint8_t payload[SCHC_MAX_PKT];
+    static uint8_t path[SCHC_MAX_PATH][16];
+    const rule_t *r = NULL;
+    pkt_t p;
+
+    if (len < 1) {
+        return -1;
+    }
+
+    if (in[0] == SCHC_RULE_UNCOMPRESSED) {
+        if (len - 1 > out_len) {
+            return -1;
+        }
+
+        memcpy(out, in + 1, len - 1);
+        return len - 1;
+    }
+
+    for (unsigned i = 0; i < NUMOF(rules); i++) {
+        if (rules[i].id == in[0]) {
+            r = &rules[i];
+        }
+    }
+
+    if (!r) {
+        return -1;
+    }
+
+    memset(&p, 0, sizeof(p));
+    p.path_num = r->path_num;
+    p.has_cf = r->has_cf;
+    bb.pos = 8;
+
+    for (unsigned i = 0; i < r->numof; i++) {
+        const field_t *fd = &r->fields[i];
+        uint64_t v = fd->tv ? *fd->tv : 0;
+        uint64_t res;
+
+        switch (fd->cda) {
+            case CDA_NOT_SENT:
+                if (fd->fid == F_COAP_URI_PATH) {
+                    p.path[fd->pos - 1] = (const uint8_t *)fd->smap[0];
+                    p.path_len[fd->pos - 1] = strlen(fd->smap[0]);
+                }
+
+                break;
+
+            case CDA_COMPUTE:
+                break;
+
+            case CDA_VALUE_SENT:
+                if (fd->fid == F_COAP_URI_PATH) {
+                    uint64_t seg_len, ch;
+
+                    if (get_bits(&bb, &seg_len, 4) < 0) {
+                        return -1;
+                    }
+
+                    for (unsigned j = 0; j < seg_len; j++) {
+                        if (get_bits(&bb, &ch, 8) < 0) {
+                            return -1;
+                        }
+
+                        path[fd->pos - 1][j] = ch;
+                    }
+
+                    p.path[fd->pos - 1] = path[fd->pos - 1];
+                    p.path_len[fd->pos - 1] = seg_len;
+                    break;
+                }
+
+                if (get_bits(&bb, &v, bits_of(&p, fd->fid)) < 0) {
+                    return -1;
+                }
+
+                break;
+
+            case CDA_LSB:
+                if (get_bits(&bb, &res, bits_of(&p, fd->fid) - fd->msb) < 0) {
+                    return -1;
+                }
+
+                v = ((v >> (bits_of(&p, fd->fid) - fd->msb)) <<
+                     (bits_of(&p, fd->fid) - fd->msb)) | res;
+                break;
+
+            case CDA_MAPPING_SENT:
+                if (get_bits(&bb, &res, map_bits(fd->map_len)) < 0 ||
+                    res >= fd->map_len) {
+                    return -1;
+                }
+
+                if (fd->fid == F_COAP_URI_PATH) {
+                    p.path[fd->pos - 1] = (const uint8_t *)fd->smap[res];
+                    p.path_len[fd->pos - 1] = strlen(fd->smap[res]);
+                }
+                else {
+                    v = fd->map[res];
+                }
+
+                break;
+        }
+
+        if (fd->fid != F_COAP_URI_PATH) {
+            p.f[fd->fid] = v;
+        }
+    }
+
+    /* whatever full bytes remain are the payload, the rest is padding */
+    p.payload_len = (bb.size - bb.pos) / 8;
+    p.payload = payload;
+
+    for (size_t i = 0; i < p.payload_len; i++) {
+        uint64_t byte;
+        get_bits(&bb, &byte, 8);
+        payload[i] = byte;
+    }
+
+    return build(&p, out, out_len);
+}
+
+unsigned schc_frames(size_t len)
+{
+    const size_t room = IEEE802154_FRAME_LEN - IEEE802154_OVERHEAD;
+    const size_t first = (room - SIXLOWPAN_FRAG1_LEN) & ~7U;
+    const size_t next = (room - SIXLOWPAN_FRAGN_LEN) & ~7U;
+
+    if (len <= room) {
+        return 1;
+    }
+
+    return 1 + (len - first + next - 1) / next;
+}
+
+void schc_account(schc_dir_t dir, const uint8_t *pkt, size_t len)
+{
+    schc_stats_t *st = &stats[dir];
+    static uint8_t schc[SCHC_MAX_PKT + 1];
+    static uint8_t restored[SCHC_MAX_PKT];
+    static uint8_t expected[SCHC_MAX_PKT];
+    int clen, rlen;
+
+    if (len > SCHC_MAX_PKT) {
+        return;
+    }
+
+    clen = schc_compress(pkt, len, schc, sizeof(schc));
+
+    if (clen < 0) {
+        return;
+    }
+
+    st->packets++;
+    /* uncompressed IPv6 behind the 6LoWPAN IPv6 dispatch */
+    st->raw_bytes += len + 1;
+    st->raw_frames += schc_frames(len + 1);
+    st->schc_bytes += clen;
+    st->schc_frames += schc_frames(clen);
+
+    if (schc[0] == SCHC_RULE_UNCOMPRESSED) {
+        st->uncompressed++;
+        return;
+    }
+
+    /* flow label and hop limit are not transmitted */
+    memcpy(expected, pkt, len);
+    expected[1] &= 0xf0;
+    expected[2] = 0;
+    expected[3] = 0;
+    expected[7] = tv_hl;
+
+    rlen = schc_decompress(schc, clen, restored, sizeof(restored));
+
+    if (rlen != (int)len || memcmp(restored, expected, len)) {
+        DEBUG("schc: rule %u doesn't restore the packet\n", schc[0]);
+        st->mismatches++;
+    }
+}
+
+const schc_stats_t *schc_stats(schc_dir_t dir)
+{
+    return &stats[dir];
+}
+
+void schc_set_local(const ng_ipv6_addr_t *local)
+{
+    local_addr = *local;
+    map_prefix[0] = be64(local->u8);
+    tv_local_iid = be64(local->u8 + 8);
+}
+
+void schc_set_remote(const ng_ipv6_addr_t *remote)
+{
+    tv_remote_iid = be64(remote->u8 + 8);
+}
+
+/* UDP port of @p b, offset 0 for the source and 2 for the destination */
+static uint16_t udp_port(const uint8_t *b, unsigned offset)
+{
+    return (b[IPV6_HDR_LEN + offset] << 8) | b[IPV6_HDR_LEN + offset + 1];
+}
+
+/*
+ * Packets handed to ng_udp for sending lack what ng_udp and ng_ipv6 fill
+ * in further down: lengths, the UDP checksum and possibly the source
+ * address, which becomes our global one for the peers the rules know.
+ */
+static void complete(uint8_t *b, size_t len)
+{
+    size_t plen = len - IPV6_HDR_LEN;
+
+    b[4] = plen >> 8;
+    b[5] = plen & 0xff;
+    b[IPV6_HDR_LEN + 4] = plen >> 8;
+    b[IPV6_HDR_LEN + 5] = plen & 0xff;
+
+    if (ng_ipv6_addr_is_unspecified((ng_ipv6_addr_t *)(b + 8))) {
+        memcpy(b + 8, &local_addr, sizeof(local_addr));
+    }
+
+    udp_cksum(b, plen);
+}
+
+/* Copies the snips of @p pkt except the netif header into @p flat, in
+ * order or from the last to the first */
+static size_t flatten(ng_pktsnip_t *pkt, uint8_t *flat, size_t size, bool reverse)
+{
+    ng_pktsnip_t *snips[4];
+    unsigned n = 0;
+    size_t len = 0;
+
+    for (ng_pktsnip_t *s = pkt; s; s = s->next) {
+        if (s->type == NG_NETTYPE_NETIF) {
+            continue;
+        }
+
+        if (n == 4) {
+            return 0;
+        }
+
+        snips[n++] = s;
+    }
+
+    for (unsigned i = 0; i < n; i++) {
+        ng_pktsnip_t *s = snips[reverse ? n - 1 - i : i];
+
+        if (len + s->size > size) {
+            return 0;
+        }
+
+        memcpy(flat + len, s->data, s->size);
+        len += s->size;
+    }
+
+    return len;
+}
+
+static void *monitor(void *arg)
+{
+    (void)arg;
+    msg_t msg, msg_queue[MONITOR_MSG_QUEUE_SIZE];
+    static uint8_t flat[SCHC_MAX_PKT];
+
+    msg_init_queue(msg_queue, MONITOR_MSG_QUEUE_SIZE);
+
+    while (1) {
+        ng_pktsnip_t *pkt;
+        size_t len;
+
+        msg_receive(&msg);
+
+        if (msg.type != NG_NETAPI_MSG_TYPE_RCV && msg.type != NG_NETAPI_MSG_TYPE_SND) {
+            continue;
+        }
+
+        pkt = (ng_pktsnip_t *)msg.content.ptr;
+
+        if (msg.type == NG_NETAPI_MSG_TYPE_RCV) {
+            /* from ng_ipv6, the snips run from the payload down to the
+             * IPv6 header */
+            len = flatten(pkt, flat, sizeof(flat), true);
+
+            if (len >= IPV6_HDR_LEN + UDP_HDR_LEN && udp_port(flat, 2) == monitor_port) {
+                schc_account(SCHC_RX, flat, len);
+            }
+        }
+        else {
+            /* to ng_udp, from the IPv6 header up to the payload */
+            len = flatten(pkt, flat, sizeof(flat), false);
+
+            if (len >= IPV6_HDR_LEN + UDP_HDR_LEN && udp_port(flat, 0) == monitor_port) {
+                complete(flat, len);
+                schc_account(SCHC_TX, flat, len);
+            }
+        }
+
+        ng_pktbuf_release(pkt);
+    }
+
+    /* never reached */
+    return NULL;
+}
+
+kernel_pid_t schc_monitor_init(uint16_t port)
+{
+    static ng_netreg_entry_t entry;
+
+    monitor_port = port;
+    entry.pid = thread_create(monitor_stack, sizeof(monitor_stack), SCHC_PRIO,
+                              CREATE_STACKTEST, monitor, NULL, "schc");
+
+    if (entry.pid > KERNEL_PID_UNDEF) {
+        /* next to ng_udp: datagrams ng_ipv6 received and the ones sent */
+        entry.demux_ctx = NG_NETREG_DEMUX_CTX_ALL;
+        ng_netreg_register(NG_NETTYPE_UDP, &entry);
+    }
+
+    return entry.pid;
+}
+
+static int hex_nibble(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+
+    return -1;
+}
+
+static void print_stats(const char *name, const schc_stats_t *st)
+{
+    printf("%-9s %8lu  %8lu  %8lu  %8lu  %8lu  %8lu  %8lu\n", name,
+           (unsigned long)st->packets, (unsigned long)st->uncompressed,
+           (unsigned long)st->mismatches, (unsigned long)st->raw_bytes,
+           (unsigned long)st->schc_bytes, (unsigned long)st->raw_frames,
+           (unsigned long)st->schc_frames);
+}
+
+int schc_cmd(int argc, char **argv)
+{
+    static uint8_t pkt[SCHC_MAX_PKT];
+    static uint8_t schc[SCHC_MAX_PKT + 1];
+    size_t len = 0;
+    int hi = -1;
+    int clen;
+
+    if (argc == 1) {
+        const schc_stats_t *rx = &stats[SCHC_RX], *tx = &stats[SCHC_TX];
+
+        printf("           packets  uncompr.  mismatch     bytes  schc byt    frames  schc frm\n");
+        print_stats("requests", rx);
+        print_stats("responses", tx);
+
+        if (rx->packets) {
+            printf("per request %lu -> %lu bytes, %lu -> %lu frames both ways\n",
+                   (unsigned long)((rx->raw_bytes + tx->raw_bytes) / rx->packets),
+                   (unsigned long)((rx->schc_bytes + tx->schc_bytes) / rx->packets),
+                   (unsigned long)((rx->raw_frames + tx->raw_frames) / rx->packets),
+                   (unsigned long)((rx->schc_frames + tx->schc_frames) / rx->packets));
+        }
+
+        return 0;
+    }
+
+    /* concatenate all arguments, skipping anything that isn't hex */
+    for (int i = 1; i < argc; i++) {
+        for (char *c = argv[i]; *c; c++) {
+            int nib = hex_nibble(*c);
+
+            if (nib < 0) {
+                continue;
+            }
+
+            if (hi < 0) {
+                hi = nib;
+            }
+            else if (len < sizeof(pkt)) {
+                pkt[len++] = (hi << 4) | nib;
+                hi = -1;
+            }
+        }
+    }
+
+    clen = schc_compress(pkt, len, schc, sizeof(schc));
+
+    if (clen < 0) {
+        puts("schc: packet too large");
+        return 1;
+    }
+
+    printf("rule %u: %u -> %d bytes, %u -> %u frames\n", schc[0],
+           (unsigned)len + 1, clen, schc_frames(len + 1), schc_frames(clen));
+    /* a datagram to our port is a request */
+    schc_account((len >= IPV6_HDR_LEN + UDP_HDR_LEN && udp_port(pkt, 2) == monitor_port) ?
+                 SCHC_RX : SCHC_TX, pkt, len);
+
+    return 0;
+}
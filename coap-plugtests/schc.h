@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2014 Sebastian Sontberg <sebastian@sontberg.de>
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser General
+ * Public License v2.1. See the file LICENSE in the top level directory for more
+ * details.
+ */
+
+/**
+ * @file
+ * @brief       Static Context Header Compression for IPv6/UDP/CoAP
+ *
+ * Implements the compression and decompression of RFC 8724 with a static
+ * rule set derived from the plugtest resources, the CoAP port and the
+ * configured addresses (ULA_PREFIX, REMOTE_IP). Packets no rule matches
+ * are carried uncompressed behind rule 0.
+ *
+ * Fields not covered: the flow label is not transmitted and restored as
+ * zero, and only Uri-Path and Content-Format options are compressed.
+ * Packets carrying other options use rule 0.
+ */
+
+#ifndef SCHC_H
+#define SCHC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kernel.h"
+#include "net/ng_ipv6/addr.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief   Rule ID of packets sent uncompressed
+ */
+#define SCHC_RULE_UNCOMPRESSED  (0U)
+
+/**
+ * @brief   Largest packet that is compressed or decompressed
+ */
+#ifndef SCHC_MAX_PKT
+#define SCHC_MAX_PKT            (1280U)
+#endif
+
+/**
+ * @brief   Priority of the thread accounting received CoAP traffic
+ */
+#ifndef SCHC_PRIO
+#define SCHC_PRIO               (PRIORITY_MAIN - 2)
+#endif
+
+#ifndef SCHC_STACK_SIZE
+#define SCHC_STACK_SIZE         (KERNEL_CONF_STACKSIZE_DEFAULT)
+#endif
+
+/**
+ * @brief   Direction of an accounted datagram
+ */
+typedef enum {
+    SCHC_RX = 0,                /**< received, requests */
+    SCHC_TX,                    /**< sent, responses */
+    SCHC_DIR_NUMOF              /**< number of directions */
+} schc_dir_t;
+
+/**
+ * @brief   Bytes on air of the accounted packets, with and without SCHC
+ */
+typedef struct {
+    uint32_t packets;           /**< packets accounted */
+    uint32_t uncompressed;      /**< packets that fell back to rule 0 */
+    uint32_t raw_bytes;         /**< L2 payload bytes without SCHC */
+    uint32_t schc_bytes;        /**< L2 payload bytes with SCHC */
+    uint32_t raw_frames;        /**< 802.15.4 frames needed without SCHC */
+    uint32_t schc_frames;       /**< 802.15.4 frames needed with SCHC */
+    uint32_t mismatches;        /**< decompression didn't restore the packet */
+} schc_stats_t;
+
+/**
+ * @brief   Sets our global (ULA) address for the rules
+ *
+ *          The prefix is compressed to one bit (ULA or link-local), the
+ *          interface identifier is elided.
+ */
+void schc_set_local(const ng_ipv6_addr_t *local);
+
+/**
+ * @brief   Sets the address of the peer we usually talk to
+ *
+ *          Packets from or to other peers carry their interface identifier
+ *          inline.
+ */
+void schc_set_remote(const ng_ipv6_addr_t *remote);
+
+/**
+ * @brief   Compresses the IPv6 packet @p pkt
+ *
+ * @param[in] pkt       IPv6 header, UDP header and CoAP message.
+ * @param[in] len       Length of @p pkt.
+ * @param[out] out      Buffer for the SCHC packet.
+ * @param[in] out_len   Size of @p out.
+ *
+ * @return  Length of the SCHC packet
+ * @return  -1 if @p out is too small
+ */
+int schc_compress(const uint8_t *pkt, size_t len, uint8_t *out, size_t out_len);
+
+/**
+ * @brief   Restores the IPv6 packet from the SCHC packet @p in
+ *
+ * @return  Length of the restored packet
+ * @return  -1 on unknown rule, truncated residue or too small @p out
+ */
+int schc_decompress(const uint8_t *in, size_t len, uint8_t *out, size_t out_len);
+
+/**
+ * @brief   Number of 802.15.4 frames a packet of @p len bytes needs
+ *
+ *          Assumes a MAC header with long addresses and 6LoWPAN
+ *          fragmentation headers.
+ */
+unsigned schc_frames(size_t len);
+
+/**
+ * @brief   Compresses @p pkt for the statistics of @p dir and checks the
+ *          round trip
+ */
+void schc_account(schc_dir_t dir, const uint8_t *pkt, size_t len);
+
+/**
+ * @brief   Starts a thread that accounts every CoAP datagram received on
+ *          @p port and every one sent from it
+ */
+kernel_pid_t schc_monitor_init(uint16_t port);
+
+/**
+ * @brief   Gets the statistics of direction @p dir
+ */
+const schc_stats_t *schc_stats(schc_dir_t dir);
+
+/**
+ * @brief   Shell command printing the statistics, or compressing a hex
+ *          encoded IPv6 packet (e.g. a response copied from pktdump)
+ */
+int schc_cmd(int argc, char **argv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SCHC_H */
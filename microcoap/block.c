@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2015 HAW Hamburg
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @{
+ *
+ * @file
+ * @brief       Stateless block-wise transfers for writer endpoints
+ *
+ * @}
+ */
+
+#include "block.h"
+
+#define ENABLE_DEBUG    (0)
+#include "debug.h"
+
+/* Option header, up to 3 bytes of value and the payload marker */
+#define BLOCK_OVERHEAD  (5)
+#define SIZE2_OVERHEAD  (5)
+#define CT_OVERHEAD     (3)
+
+#define BLOCK_SIZE(szx) (16U << (szx))
+
+typedef struct {
+    uint32_t num;
+    uint8_t szx;
+    bool more;
+} block_t;
+
+/* Reads Block1 or Block2 of @p pkt, returns false if it has none */
+static bool get_block(const coap_packet_t *pkt, uint8_t num, block_t *block)
+{
+    uint8_t count;
+    const coap_option_t *opt = coap_findOptions(pkt, num, &count);
+    uint32_t v = 0;
+
+    if (!opt || opt->buf.len > 3) {
+        return false;
+    }
+
+    for (size_t i = 0; i < opt->buf.len; i++) {
+        v = (v << 8) | opt->buf.p[i];
+    }
+
+    block->num = v >> 4;
+    block->more = (v >> 3) & 1;
+    block->szx = v & 0x07;
+    return true;
+}
+
+static uint32_t block_value(const block_t *block)
+{
+    return (block->num << 4) | (block->more << 3) | block->szx;
+}
+
+int block2_respond(coap_writer_t *w, const coap_packet_t *inpkt, uint16_t ct,
+                   size_t size, block_read_t read)
+{
+    block_t block = { 0, BLOCK_SZX_MAX, false };
+    size_t offset, room, len;
+    uint8_t *payload;
+
+    if (get_block(inpkt, COAP_OPTION_BLOCK2, &block) && block.szx > BLOCK_SZX_MAX) {
+        /* a client may ask for 1024 bytes; answer with what fits */
+        block.num = (block.num << block.szx) >> BLOCK_SZX_MAX;
+        block.szx = BLOCK_SZX_MAX;
+    }
+
+    offset = block.num * BLOCK_SIZE(block.szx);
+
+    if (offset >= size && size > 0) {
+        writer_code(w, MAKE_RSPCODE(4, 2));
+        return -1;
+    }
+
+    /* shrink the block until it fits next to the options */
+    room = w->size - w->pos - CT_OVERHEAD - BLOCK_OVERHEAD - (block.num ? 0 : SIZE2_OVERHEAD);
+
+    while (block.szx > 0 && BLOCK_SIZE(block.szx) > room) {
+        block.num <<= 1;
+        block.szx--;
+    }
+
+    len = size - offset;
+
+    if (len > BLOCK_SIZE(block.szx)) {
+        len = BLOCK_SIZE(block.szx);
+        block.more = true;
+    }
+    else {
+        block.more = false;
+    }
+
+    DEBUG("block2: %lu bytes at %lu\n", (unsigned long)len, (unsigned long)offset);
+
+    writer_option_uint(w, COAP_OPTION_CONTENT_FORMAT, ct);
+    writer_option_uint(w, COAP_OPTION_BLOCK2, block_value(&block));
+
+    if (block.num == 0) {
+        writer_option_uint(w, COAP_OPTION_SIZE2, size);
+    }
+
+    if (len) {
+        /* straight from the resource into the datagram */
+        if ((payload = writer_payload(w, &room)) == NULL || room < len) {
+            writer_code(w, MAKE_RSPCODE(5, 0));
+            return -1;
+        }
+
+        writer_commit(w, read(offset, payload, len));
+    }
+
+    return 0;
+}
+
+int block1_receive(coap_writer_t *w, const coap_packet_t *inpkt, block_write_t write)
+{
+    block_t block = { 0, BLOCK_SZX_MAX, false };
+    bool blockwise = get_block(inpkt, COAP_OPTION_BLOCK1, &block);
+    uint8_t code;
+
+    /* the payload of a block must fill it, except for the last one */
+    if (blockwise && block.more && inpkt->payload.len != BLOCK_SIZE(block.szx)) {
+        writer_code(w, MAKE_RSPCODE(4, 0));
+        return -1;
+    }
+
+    code = write(block.num * BLOCK_SIZE(block.szx), inpkt->payload.p,
+                 inpkt->payload.len, block.more);
+
+    if (code) {
+        writer_code(w, code);
+        return -1;
+    }
+
+    writer_code(w, block.more ? MAKE_RSPCODE(2, 31) : MAKE_RSPCODE(2, 4));
+
+    if (blockwise) {
+        /* ask for smaller blocks from now on if the client's don't fit */
+        if (block.szx > BLOCK_SZX_MAX) {
+            block.szx = BLOCK_SZX_MAX;
+        }
+
+        writer_option_uint(w, COAP_OPTION_BLOCK1, block_value(&block));
+    }
+
+    return 0;
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2015 HAW Hamburg
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @{
+ *
+ * @file
+ * @brief       Stateless block-wise transfers for writer endpoints
+ *
+ * Representations larger than a datagram are sent as Block2 responses and
+ * received as Block1 requests. The server keeps no state per transfer:
+ * every block is read from or written to the resource at the offset the
+ * request addresses, so memory doesn't grow with the representation.
+ *
+ * @}
+ */
+
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "coap.h"
+#include "writer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define COAP_OPTION_BLOCK2      (23)
+#define COAP_OPTION_BLOCK1      (27)
+#define COAP_OPTION_SIZE2       (28)
+
+/**
+ * @brief   Largest block size exponent, blocks are 16 << SZX bytes
+ */
+#ifndef BLOCK_SZX_MAX
+#define BLOCK_SZX_MAX           (2)
+#endif
+
+/**
+ * @brief   Reads up to @p len bytes at @p offset of a representation into
+ *          @p dst
+ *
+ * @return  bytes read
+ */
+typedef size_t (*block_read_t)(size_t offset, uint8_t *dst, size_t len);
+
+/**
+ * @brief   Writes @p len bytes at @p offset of a representation
+ *
+ * @param[in] more  false for the last block
+ *
+ * @return  0 on success
+ * @return  the response code otherwise, e.g. 4.08 for a missing block
+ */
+typedef uint8_t (*block_write_t)(size_t offset, const uint8_t *data, size_t len, bool more);
+
+/**
+ * @brief   Writes the block of a @p size bytes representation that
+ *          @p inpkt asks for
+ *
+ *          Picks the largest block size that neither exceeds the
+ *          requested one nor the room left in the datagram.
+ *
+ * @param[in] ct    content format of the representation
+ *
+ * @return  0 on success
+ * @return  -1 if the request addresses a block beyond @p size
+ */
+int block2_respond(coap_writer_t *w, const coap_packet_t *inpkt, uint16_t ct,
+                   size_t size, block_read_t read);
+
+/**
+ * @brief   Hands the payload of @p inpkt to @p write at the offset of its
+ *          Block1 option and answers with 2.31 Continue or 2.04 Changed
+ *
+ * @return  0 on success
+ * @return  -1 if @p write failed
+ */
+int block1_receive(coap_writer_t *w, const coap_packet_t *inpkt, block_write_t write);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BLOCK_H */
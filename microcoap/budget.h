@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2015 HAW Hamburg
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @{
+ *
+ * @file
+ * @brief       RAM budget of the microcoap server derived from its endpoints
+ *
+ * Every endpoint declares in ENDPOINT_BUDGETS (endpoints.h) how many bytes
+ * of options and payload its requests and responses carry at most. With
+ * MICROCOAP_BUDGET set, BUFSZ is the largest of these datagrams, the
+ * transports' message queues hold BUDGET_QUEUE requests and the server
+ * threads get BUDGET_STACKSIZE bytes of stack, instead of the defaults made
+ * for native. Static asserts in endpoints.c keep ENDPOINT_BUDGETS in line
+ * with the endpoint tables and with what the handlers write.
+ *
+ * Only the datagram sizes are derived. BUDGET_QUEUE and
+ * BUDGET_HANDLER_STACK are estimates to check under load, and
+ * the stacks of the sampler and of ng_nomac keep their defaults.
+ *
+ * @}
+ */
+
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <stdint.h>
+
+#include "kernel.h"
+#include "msg.h"
+
+#include "coap.h"
+#include "endpoints.h"
+#include "writer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief   Set to 1 to size the server from ENDPOINT_BUDGETS
+ */
+#ifndef MICROCOAP_BUDGET
+#define MICROCOAP_BUDGET        (0)
+#endif
+
+/**
+ * @brief   Bytes for options of requests no endpoint declares, like
+ *          Uri-Host, which the server has to receive but ignores
+ */
+#ifndef BUDGET_SLACK
+#define BUDGET_SLACK            (8U)
+#endif
+
+/**
+ * @brief   Requests queued for the server, a power of 2
+ *
+ *          Set by hand for a few clients polling at once, nothing here
+ *          knows the request rate.
+ */
+#ifndef BUDGET_QUEUE
+#define BUDGET_QUEUE            (4U)
+#endif
+
+/**
+ * @brief   Stack the deepest handler needs for its locals
+ *
+ *          Set by hand from the locals of the handlers in endpoints.c, as
+ *          the compiler doesn't tell. Check the server threads with
+ *          thread_measure_stack_free() after adding a handler.
+ */
+#ifndef BUDGET_HANDLER_STACK
+#define BUDGET_HANDLER_STACK    (192U)
+#endif
+
+/**
+ * @brief   Header and the longest token
+ */
+#define BUDGET_HEADER           (4U + 8U)
+
+#define BUDGET_REQUEST(name, req, rsp_opts, rsp_payload) \
+    uint8_t name[BUDGET_HEADER + BUDGET_SLACK + (req)];
+#define BUDGET_RESPONSE(name, req, rsp_opts, rsp_payload) \
+    uint8_t name[BUDGET_HEADER + (rsp_opts) + 1 + (rsp_payload)];
+#define BUDGET_INDEX(name, req, rsp_opts, rsp_payload) \
+    BUDGET_INDEX_ ## name,
+#define BUDGET_PAYLOAD(name, req, rsp_opts, rsp_payload) \
+    BUDGET_PAYLOAD_ ## name = (rsp_payload),
+
+/* The largest member of each union is the largest datagram */
+union budget_request {
+    ENDPOINT_BUDGETS(BUDGET_REQUEST)
+};
+
+union budget_response {
+    ENDPOINT_BUDGETS(BUDGET_RESPONSE)
+};
+
+enum {
+    ENDPOINT_BUDGETS(BUDGET_INDEX)
+    BUDGET_ENDPOINTS            /**< number of budgets */
+};
+
+/**
+ * @brief   Largest response payload of each endpoint, as
+ *          BUDGET_PAYLOAD_<name>
+ */
+enum {
+    ENDPOINT_BUDGETS(BUDGET_PAYLOAD)
+};
+
+#define BUDGET_REQUEST_SIZE     (sizeof(union budget_request))
+#define BUDGET_RESPONSE_SIZE    (sizeof(union budget_response))
+#define BUDGET_BUFSZ            (BUDGET_REQUEST_SIZE > BUDGET_RESPONSE_SIZE ? \
+                                 BUDGET_REQUEST_SIZE : BUDGET_RESPONSE_SIZE)
+
+/**
+ * @brief   Stack of a server thread: a parsed request and a writer on the
+ *          stack of the deepest handler, the message queue and printf
+ */
+#define BUDGET_STACKSIZE        (KERNEL_CONF_STACKSIZE_DEFAULT + \
+                                 KERNEL_CONF_STACKSIZE_PRINTF + \
+                                 sizeof(coap_packet_t) + sizeof(coap_writer_t) + \
+                                 BUDGET_HANDLER_STACK + BUDGET_QUEUE * sizeof(msg_t))
+
+/**
+ * @brief   Prints the RAM the server reserves statically
+ */
+void budget_report(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BUDGET_H */
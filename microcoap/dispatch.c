@@ -0,0 +1,460 @@
+/*
+ * Copyright (C) 2015 HAW Hamburg
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @{
+ *
+ * @file
+ * @brief       Hashed request dispatch for the microcoap example server
+ *
+ * @}
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "block.h"
+#include "dispatch.h"
+
+#define ENABLE_DEBUG    (0)
+#include "debug.h"
+
+#define EMPTY           (0xffff)
+/* marks indices into the writer endpoints */
+#define WRITER          (0x8000)
+
+#define FNV_OFFSET      (2166136261UL)
+#define FNV_PRIME       (16777619UL)
+
+/* each slot keeps the full hash, so probing rarely compares strings */
+static struct {
+    uint32_t hash;
+    uint16_t ep;
+} table[DISPATCH_SLOTS];
+
+static const coap_endpoint_t *endpoints_base;
+static const writer_endpoint_t *writers_base;
+
+static const coap_endpoint_path_t wellknown_path = {2, {".well-known", "core"}};
+static char wellknown[DISPATCH_CORE_SIZE];
+static size_t wellknown_len;
+
+static uint32_t fnv(uint32_t h, const uint8_t *p, size_t len)
+{
+    while (len--) {
+        h = (h ^ *p++) * FNV_PRIME;
+    }
+
+    return h;
+}
+
+/* A segment's length goes into the hash too, so "ab" "c" and "a" "bc" differ */
+static uint32_t hash_segment(uint32_t h, const uint8_t *p, size_t len)
+{
+    uint8_t l = (uint8_t)len;
+
+    return fnv(fnv(h, &l, 1), p, len);
+}
+
+static uint32_t hash_path(coap_method_t method, const coap_endpoint_path_t *path)
+{
+    uint8_t m = (uint8_t)method;
+    uint32_t h = fnv(FNV_OFFSET, &m, 1);
+
+    for (int i = 0; i < path->count; i++) {
+        h = hash_segment(h, (const uint8_t *)path->elems[i], strlen(path->elems[i]));
+    }
+
+    return h;
+}
+
+static uint32_t hash_request(const coap_packet_t *pkt, const coap_option_t **opt,
+                             uint8_t *count)
+{
+    uint8_t m = pkt->hdr.code;
+    uint32_t h = fnv(FNV_OFFSET, &m, 1);
+
+    *count = 0;
+    *opt = coap_findOptions(pkt, COAP_OPTION_URI_PATH, count);
+
+    for (int i = 0; *opt && i < *count; i++) {
+        h = hash_segment(h, (*opt)[i].buf.p, (*opt)[i].buf.len);
+    }
+
+    return h;
+}
+
+static bool path_equals(const coap_endpoint_path_t *path, const coap_option_t *opt,
+                        uint8_t count)
+{
+    if (path->count != count) {
+        return false;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (opt[i].buf.len != strlen(path->elems[i]) ||
+            memcmp(path->elems[i], opt[i].buf.p, opt[i].buf.len) != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Appends "</seg/seg>;attr" and a separating comma to wellknown */
+static int add_link(const coap_endpoint_path_t *path, const char *core_attr)
+{
+    size_t need = 3;
+
+    for (int i = 0; i < path->count; i++) {
+        need += 1 + strlen(path->elems[i]);
+    }
+
+    if (core_attr) {
+        need += 1 + strlen(core_attr);
+    }
+
+    /* comma and terminating zero */
+    if (wellknown_len + need + 1 >= sizeof(wellknown)) {
+        printf("dispatch: /.well-known/core longer than %u\n", DISPATCH_CORE_SIZE);
+        return -1;
+    }
+
+    if (wellknown_len) {
+        wellknown[wellknown_len++] = ',';
+    }
+
+    wellknown[wellknown_len++] = '<';
+
+    for (int i = 0; i < path->count; i++) {
+        wellknown_len += sprintf(&wellknown[wellknown_len], "/%s", path->elems[i]);
+    }
+
+    wellknown[wellknown_len++] = '>';
+
+    if (core_attr) {
+        wellknown_len += sprintf(&wellknown[wellknown_len], ";%s", core_attr);
+    }
+
+    wellknown[wellknown_len] = '\0';
+    return 0;
+}
+
+/* The same path may be registered for several methods, list it once */
+static bool listed(const coap_endpoint_path_t *path, unsigned eps, unsigned weps)
+{
+    for (unsigned i = 0; i < eps; i++) {
+        if (endpoints_base[i].path == path) {
+            return true;
+        }
+    }
+
+    for (unsigned i = 0; i < weps; i++) {
+        if (writers_base[i].path == path) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static int insert(uint16_t ep, coap_method_t method, const coap_endpoint_path_t *path,
+                  unsigned n)
+{
+    uint32_t h = hash_path(method, path);
+    unsigned slot;
+
+    if (2 * (n + 1) > DISPATCH_SLOTS) {
+        printf("dispatch: more than %u endpoints\n", DISPATCH_SLOTS / 2);
+        return -1;
+    }
+
+    for (slot = h & (DISPATCH_SLOTS - 1); table[slot].ep != EMPTY;
+         slot = (slot + 1) & (DISPATCH_SLOTS - 1)) {}
+
+    table[slot].hash = h;
+    table[slot].ep = ep;
+    return 0;
+}
+
+int dispatch_init(const coap_endpoint_t *eps, const writer_endpoint_t *weps)
+{
+    unsigned n = 0, i;
+
+    memset(table, 0xff, sizeof(table));
+    endpoints_base = eps;
+    writers_base = weps;
+    wellknown_len = 0;
+
+    for (i = 0; eps && eps[i].handler; i++, n++) {
+        if (insert(i, eps[i].method, eps[i].path, n) < 0 ||
+            (!listed(eps[i].path, i, 0) && add_link(eps[i].path, eps[i].core_attr) < 0)) {
+            return -1;
+        }
+    }
+
+    for (unsigned j = 0; weps && weps[j].handler; j++, n++) {
+        if (insert(WRITER | j, weps[j].method, weps[j].path, n) < 0 ||
+            (!listed(weps[j].path, i, j) && add_link(weps[j].path, weps[j].core_attr) < 0)) {
+            return -1;
+        }
+    }
+
+    DEBUG("dispatch: %u endpoints, %s\n", n, wellknown);
+    return n;
+}
+
+/* Index of the endpoint for @p pkt, EMPTY if there is none */
+static uint16_t lookup(const coap_packet_t *pkt)
+{
+    const coap_option_t *opt;
+    uint8_t count;
+    uint32_t h = hash_request(pkt, &opt, &count);
+
+    for (unsigned slot = h & (DISPATCH_SLOTS - 1); table[slot].ep != EMPTY;
+         slot = (slot + 1) & (DISPATCH_SLOTS - 1)) {
+        uint16_t ep = table[slot].ep;
+        coap_method_t method;
+        const coap_endpoint_path_t *path;
+
+        if (table[slot].hash != h) {
+            continue;
+        }
+
+        if (ep & WRITER) {
+            method = writers_base[ep & ~WRITER].method;
+            path = writers_base[ep & ~WRITER].path;
+        }
+        else {
+            method = endpoints_base[ep].method;
+            path = endpoints_base[ep].path;
+        }
+
+        if (method == pkt->hdr.code && path_equals(path, opt, count)) {
+            return ep;
+        }
+    }
+
+    return EMPTY;
+}
+
+const coap_endpoint_t *dispatch_find(const coap_packet_t *pkt)
+{
+    uint16_t ep = lookup(pkt);
+
+    return (ep == EMPTY || (ep & WRITER)) ? NULL : &endpoints_base[ep];
+}
+
+static size_t etag_encode(uint32_t version, uint8_t *etag)
+{
+    size_t len = (version > 0xffffff) ? 4 : (version > 0xffff) ? 3 : (version > 0xff) ? 2 : 1;
+
+    for (size_t i = 0; i < len; i++) {
+        etag[i] = version >> (8 * (len - 1 - i));
+    }
+
+    return len;
+}
+
+/* A request may list several ETags it has */
+static bool etag_matches(const coap_packet_t *pkt, const uint8_t *etag, size_t len)
+{
+    for (int i = 0; i < pkt->numopts; i++) {
+        const coap_option_t *opt = &pkt->opts[i];
+
+        if (opt->num == COAP_OPTION_ETAG && opt->buf.len == len &&
+            memcmp(opt->buf.p, etag, len) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Answers conditional requests without the handler, returns true then */
+static bool validate(coap_writer_t *w, const writer_endpoint_t *ep, const coap_packet_t *pkt)
+{
+    uint8_t etag[4], count;
+    uint32_t version = ep->version(pkt);
+    size_t len = etag_encode(version, etag);
+
+    if (pkt->hdr.code == COAP_METHOD_PUT) {
+        if (version && coap_findOptions(pkt, COAP_OPTION_IF_NONE_MATCH, &count)) {
+            writer_code(w, MAKE_RSPCODE(4, 12));
+            return true;
+        }
+
+        return false;
+    }
+
+    if (pkt->hdr.code != COAP_METHOD_GET || version == 0) {
+        return false;
+    }
+
+    writer_option(w, COAP_OPTION_ETAG, etag, len);
+
+    if (etag_matches(pkt, etag, len)) {
+        writer_code(w, MAKE_RSPCODE(2, 3));
+        return true;
+    }
+
+    /* the handler continues after the ETag */
+    return false;
+}
+
+static bool is_wellknown(const coap_packet_t *pkt)
+{
+    const coap_option_t *opt;
+    uint8_t count;
+
+    if (pkt->hdr.code != COAP_METHOD_GET) {
+        return false;
+    }
+
+    opt = coap_findOptions(pkt, COAP_OPTION_URI_PATH, &count);
+    return opt && path_equals(&wellknown_path, opt, count);
+}
+
+static size_t read_wellknown(size_t offset, uint8_t *dst, size_t len)
+{
+    memcpy(dst, &wellknown[offset], len);
+    return len;
+}
+
+int dispatch_write(coap_writer_t *w, const coap_packet_t *pkt)
+{
+    uint16_t ep = lookup(pkt);
+    const writer_endpoint_t *wep;
+
+    /* outgrows a datagram quickly, so it is sent block-wise */
+    if (ep == EMPTY && is_wellknown(pkt)) {
+        block2_respond(w, pkt, COAP_CONTENTTYPE_APPLICATION_LINKFORMAT, wellknown_len,
+                       read_wellknown);
+        return 1;
+    }
+
+    if (ep == EMPTY || !(ep & WRITER)) {
+        return 0;
+    }
+
+    wep = &writers_base[ep & ~WRITER];
+
+    if (!wep->version || !validate(w, wep, pkt)) {
+        wep->handler(w, pkt);
+    }
+
+    return 1;
+}
+
+int dispatch_handle_req(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt,
+                        coap_packet_t *outpkt)
+{
+    const coap_endpoint_t *ep = dispatch_find(inpkt);
+
+    if (ep) {
+        return ep->handler(scratch, inpkt, outpkt, inpkt->hdr.id[0], inpkt->hdr.id[1]);
+    }
+
+    return coap_make_response(scratch, outpkt, NULL, 0, inpkt->hdr.id[0], inpkt->hdr.id[1],
+                              &inpkt->tok, COAP_RSPCODE_NOT_FOUND, COAP_CONTENTTYPE_NONE);
+}
+
+size_t dispatch_ram(void)
+{
+    return sizeof(table) + sizeof(wellknown);
+}
+
+#ifdef DISPATCH_BENCH
+#include "hwtimer.h"
+
+#define BENCH_ITERATIONS    (1000U)
+
+static int bench_handler(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt,
+                         coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
+{
+    (void)scratch; (void)inpkt; (void)outpkt; (void)id_hi; (void)id_lo;
+    return 0;
+}
+
+static char bench_names[DISPATCH_SLOTS / 2][6];
+static coap_endpoint_path_t bench_paths[DISPATCH_SLOTS / 2];
+static coap_endpoint_t bench_eps[DISPATCH_SLOTS / 2 + 1];
+
+/* What coap_handle_req() does */
+static const coap_endpoint_t *find_linear(const coap_packet_t *pkt)
+{
+    const coap_option_t *opt;
+    uint8_t count;
+
+    for (const coap_endpoint_t *ep = bench_eps; ep->handler; ep++) {
+        if (ep->method == pkt->hdr.code &&
+            (opt = coap_findOptions(pkt, COAP_OPTION_URI_PATH, &count)) &&
+            path_equals(ep->path, opt, count)) {
+            return ep;
+        }
+    }
+
+    return NULL;
+}
+
+static uint32_t bench(const coap_endpoint_t *(*find)(const coap_packet_t *),
+                      const coap_packet_t *pkt, const coap_endpoint_t *expect)
+{
+    uint32_t start = hwtimer_now();
+
+    for (unsigned i = 0; i < BENCH_ITERATIONS; i++) {
+        if (find(pkt) != expect) {
+            printf("dispatch_bench: lookup failed\n");
+            return 0;
+        }
+    }
+
+    return (uint32_t)((uint64_t)HWTIMER_TICKS_TO_US(hwtimer_now() - start) * 1000
+                      / BENCH_ITERATIONS);
+}
+
+void dispatch_bench(unsigned max)
+{
+    coap_packet_t pkt;
+
+    if (max == 0 || max > DISPATCH_SLOTS / 2) {
+        max = DISPATCH_SLOTS / 2;
+    }
+
+    printf("%9s %9s %9s\n", "endpoints", "linear ns", "hashed ns");
+
+    for (unsigned n = 1; n <= max; n = (n * 2 > max && n < max) ? max : n * 2) {
+        for (unsigned i = 0; i < n; i++) {
+            sprintf(bench_names[i], "e%u", i);
+            bench_paths[i].count = 2;
+            bench_paths[i].elems[0] = "bench";
+            bench_paths[i].elems[1] = bench_names[i];
+            bench_eps[i] = (coap_endpoint_t) {COAP_METHOD_GET, bench_handler,
+                                              &bench_paths[i], "ct=0"};
+        }
+
+        bench_eps[n] = (coap_endpoint_t) {(coap_method_t)0, NULL, NULL, NULL};
+        dispatch_init(bench_eps, NULL);
+
+        /* the last endpoint is the worst case of the linear scan */
+        memset(&pkt, 0, sizeof(pkt));
+        pkt.hdr.code = COAP_METHOD_GET;
+        pkt.numopts = 2;
+        pkt.opts[0].num = COAP_OPTION_URI_PATH;
+        pkt.opts[0].buf.p = (const uint8_t *)"bench";
+        pkt.opts[0].buf.len = 5;
+        pkt.opts[1].num = COAP_OPTION_URI_PATH;
+        pkt.opts[1].buf.p = (const uint8_t *)bench_names[n - 1];
+        pkt.opts[1].buf.len = strlen(bench_names[n - 1]);
+
+        printf("%9u %9lu %9lu\n", n, (unsigned long)bench(find_linear, &pkt, &bench_eps[n - 1]),
+               (unsigned long)bench(dispatch_find, &pkt, &bench_eps[n - 1]));
+    }
+}
+#endif
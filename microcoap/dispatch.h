@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2015 HAW Hamburg
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @{
+ *
+ * @file
+ * @brief       Hashed request dispatch for the microcoap example server
+ *
+ * coap_handle_req() compares method and every Uri-Path segment of each
+ * entry in endpoints[] until one matches. dispatch_init() hashes method and
+ * path of every endpoint once into an open addressed table, so a request
+ * costs one hash over its own path and one compare with the endpoint found.
+ * It also renders /.well-known/core from the endpoints' attributes, which
+ * dispatch_write() then answers block-wise from that buffer.
+ *
+ * @}
+ */
+
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "coap.h"
+#include "writer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief   Slots of the table, a power of 2 and at least twice the number
+ *          of endpoints
+ */
+#ifndef DISPATCH_SLOTS
+#define DISPATCH_SLOTS          (32U)
+#endif
+
+/**
+ * @brief   Size of the precomputed /.well-known/core
+ */
+#ifndef DISPATCH_CORE_SIZE
+#define DISPATCH_CORE_SIZE      (256U)
+#endif
+
+/**
+ * @brief   Builds the table and /.well-known/core from @p eps and @p weps
+ *
+ * @param[in] eps   endpoints, terminated by an entry without handler
+ * @param[in] weps  writer endpoints, terminated the same way, may be NULL
+ *
+ * @return  number of endpoints
+ * @return  -1 if they don't fit into DISPATCH_SLOTS or DISPATCH_CORE_SIZE
+ */
+int dispatch_init(const coap_endpoint_t *eps, const writer_endpoint_t *weps);
+
+/**
+ * @brief   Finds the endpoint for method and Uri-Path of @p pkt
+ *
+ * @return  NULL if there is none or it is a writer endpoint
+ */
+const coap_endpoint_t *dispatch_find(const coap_packet_t *pkt);
+
+/**
+ * @brief   Lets the writer endpoint for @p pkt write its response with @p w
+ *
+ *          Conditional requests are answered here if the endpoint has a
+ *          version callback, see writer_endpoint_t.
+ *
+ * @return  1 if there was one
+ * @return  0 if the request is left to dispatch_handle_req()
+ */
+int dispatch_write(coap_writer_t *w, const coap_packet_t *pkt);
+
+/**
+ * @brief   Drop-in replacement of coap_handle_req()
+ */
+int dispatch_handle_req(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt,
+                        coap_packet_t *outpkt);
+
+/**
+ * @brief   Prints the time per lookup of dispatch_find() and of a linear
+ *          scan for 1 up to @p max generated endpoints
+ *
+ *          Only available with DISPATCH_BENCH defined, uses the table,
+ *          so call dispatch_init() again afterwards.
+ */
+void dispatch_bench(unsigned max);
+
+/**
+ * @brief   Bytes of RAM the table and /.well-known/core take
+ */
+size_t dispatch_ram(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DISPATCH_H */
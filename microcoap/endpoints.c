@@ -19,16 +19,296 @@
 
 #include <stdbool.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <string.h>
 #include "coap.h"
+#include "writer.h"
+#include "block.h"
+#include "budget.h"
+#include "endpoints.h"
+#include "sampler.h"
+#include "senml.h"
 
 #define ENABLE_DEBUG    (0)
 #include "debug.h"
 
-#define MAX_RESPONSE_LEN 1500
-static uint8_t response[MAX_RESPONSE_LEN] = "";
+/* Set to 0 to answer /foo/bar through coap_make_response() and
+ * coap_build() again */
+#ifndef MICROCOAP_WRITER
+#define MICROCOAP_WRITER 1
+#endif
+
+/* Size of /log, made up on the fly, so it can be larger than the RAM */
+#ifndef LOG_SIZE
+#define LOG_SIZE (32768U)
+#endif
+
+#define LOG_LINE 16
 
 static const coap_endpoint_path_t path = {2, {"foo", "bar"}};
+static const coap_endpoint_path_t log_path = {1, {"log"}};
+static const coap_endpoint_path_t blob_path = {1, {"blob"}};
+static const coap_endpoint_path_t value_path = {1, {"value"}};
+
+static const coap_endpoint_path_t light_path = {2, {"sensors", "light"}};
+static const coap_endpoint_path_t pressure_path = {2, {"sensors", "pressure"}};
+static const coap_endpoint_path_t temperature_path = {2, {"sensors", "temperature"}};
+static const coap_endpoint_path_t gyro_path = {2, {"sensors", "gyro"}};
+static const coap_endpoint_path_t senml_path = {1, {"senml"}};
+
+static uint32_t value;
+static uint32_t value_version = 1;
+
+/* Adler-32 of what was PUT to /blob so far */
+static struct {
+    size_t len;
+    uint32_t a, b;
+} blob;
+
+/* Line n of /log reads "%04x riot block\n" */
+static size_t read_log(size_t offset, uint8_t *dst, size_t len)
+{
+    char line[LOG_LINE + 1];
+    size_t done = 0;
+
+    while (done < len && offset < LOG_SIZE) {
+        size_t col = offset % LOG_LINE;
+        size_t n = LOG_LINE - col;
+
+        if (n > len - done) {
+            n = len - done;
+        }
+
+        snprintf(line, sizeof(line), "%04x riot block\n", (unsigned)(offset / LOG_LINE) & 0xffff);
+        memcpy(dst + done, line + col, n);
+        done += n;
+        offset += n;
+    }
+
+    return done;
+}
+
+static int write_get_log(coap_writer_t *w, const coap_packet_t *inpkt)
+{
+    DEBUG("[endpoints]  %s()\n",  __func__);
+    return block2_respond(w, inpkt, COAP_CONTENTTYPE_TEXT_PLAIN, LOG_SIZE, read_log);
+}
+
+/* Only the checksum is kept, so blocks have to arrive in order */
+static uint8_t write_blob(size_t offset, const uint8_t *data, size_t len, bool more)
+{
+    if (offset == 0) {
+        blob.len = 0;
+        blob.a = 1;
+        blob.b = 0;
+    }
+
+    if (offset != blob.len) {
+        return MAKE_RSPCODE(4, 8);
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        blob.a = (blob.a + data[i]) % 65521;
+        blob.b = (blob.b + blob.a) % 65521;
+    }
+
+    blob.len += len;
+
+    if (!more) {
+        printf("blob: %lu bytes, adler32 %08lx\n", (unsigned long)blob.len,
+               (unsigned long)((blob.b << 16) | blob.a));
+    }
+
+    return 0;
+}
+
+static int write_put_blob(coap_writer_t *w, const coap_packet_t *inpkt)
+{
+    DEBUG("[endpoints]  %s()\n",  __func__);
+    return block1_receive(w, inpkt, write_blob);
+}
+
+/* For resources that never change */
+static uint32_t const_version(const coap_packet_t *inpkt)
+{
+    (void)inpkt;
+    return 1;
+}
+
+void endpoints_set_value(uint32_t v)
+{
+    if (v != value) {
+        value = v;
+        value_version++;
+    }
+}
+
+static uint32_t get_value_version(const coap_packet_t *inpkt)
+{
+    (void)inpkt;
+    return value_version;
+}
+
+static int write_get_value(coap_writer_t *w, const coap_packet_t *inpkt)
+{
+    size_t room;
+    uint8_t *payload;
+    int len;
+
+    (void)inpkt;
+    DEBUG("[endpoints]  %s()\n",  __func__);
+
+    writer_option_uint(w, COAP_OPTION_CONTENT_FORMAT, COAP_CONTENTTYPE_TEXT_PLAIN);
+
+    if ((payload = writer_payload(w, &room)) == NULL ||
+        (len = snprintf((char *)payload, room, "%lu", (unsigned long)value)) >= (int)room) {
+        writer_code(w, MAKE_RSPCODE(5, 0));
+        return -1;
+    }
+
+    writer_commit(w, len);
+    return 0;
+}
+
+/* The sensor named by the last Uri-Path segment */
+static int sensor_of(const coap_packet_t *inpkt)
+{
+    uint8_t count;
+    const coap_option_t *opt = coap_findOptions(inpkt, COAP_OPTION_URI_PATH, &count);
+
+    if (!opt || count == 0) {
+        return -1;
+    }
+
+    return sampler_find((const char *)opt[count - 1].buf.p, opt[count - 1].buf.len);
+}
+
+static uint32_t get_sensor_version(const coap_packet_t *inpkt)
+{
+    sampler_value_t v;
+    int idx = sensor_of(inpkt);
+
+    return (idx < 0 || sampler_get(idx, &v) < 0) ? 0 : v.version;
+}
+
+/* Answers from the sampler's cache, never waits for the sensor */
+static int write_get_sensor(coap_writer_t *w, const coap_packet_t *inpkt)
+{
+    sampler_value_t v;
+    size_t room;
+    uint8_t *payload;
+    int len, idx = sensor_of(inpkt);
+
+    DEBUG("[endpoints]  %s()\n",  __func__);
+
+    if (idx < 0) {
+        writer_code(w, COAP_RSPCODE_NOT_FOUND);
+        return -1;
+    }
+
+    if (sampler_get(idx, &v) < 0) {
+        /* not sampled yet */
+        writer_code(w, MAKE_RSPCODE(5, 3));
+        return -1;
+    }
+
+    writer_option_uint(w, COAP_OPTION_CONTENT_FORMAT, COAP_CONTENTTYPE_TEXT_PLAIN);
+    writer_option_uint(w, COAP_OPTION_MAX_AGE, (sensors[idx].period_ms + 999) / 1000);
+
+    if ((payload = writer_payload(w, &room)) == NULL ||
+        (len = snprintf((char *)payload, room, "%ld %s", (long)v.value,
+                        sensors[idx].unit)) >= (int)room) {
+        writer_code(w, MAKE_RSPCODE(5, 0));
+        return -1;
+    }
+
+    writer_commit(w, len);
+    return 0;
+}
+
+/* The recent samples of all sensors in one SenML pack, as many as fit */
+static int write_get_senml(coap_writer_t *w, const coap_packet_t *inpkt)
+{
+    sampler_sample_t hist[SAMPLER_HISTORY];
+    senml_format_t fmt = SENML_JSON;
+    senml_t s;
+    uint8_t count;
+    const coap_option_t *opt = coap_findOptions(inpkt, COAP_OPTION_ACCEPT, &count);
+    uint32_t now = sampler_now_ms();
+    int n;
+
+    DEBUG("[endpoints]  %s()\n",  __func__);
+
+    if (opt && opt->buf.len == 1 && opt->buf.p[0] == SENML_CONTENTTYPE_JSON) {
+        fmt = SENML_JSON;
+    }
+    else if (opt && opt->buf.len == 1 && opt->buf.p[0] == SENML_CONTENTTYPE_CBOR) {
+        fmt = SENML_CBOR;
+    }
+    else if (opt) {
+        writer_code(w, MAKE_RSPCODE(4, 6));
+        return -1;
+    }
+
+    for (unsigned i = 0; (n = sampler_history(i, hist, 1)) == 0; i++) {
+        /* up to the first sensor with a sample */
+    }
+
+    if (n < 0) {
+        /* nothing sampled yet */
+        writer_code(w, MAKE_RSPCODE(5, 3));
+        return -1;
+    }
+
+    writer_option_uint(w, COAP_OPTION_CONTENT_FORMAT,
+                       (fmt == SENML_CBOR) ? SENML_CONTENTTYPE_CBOR : SENML_CONTENTTYPE_JSON);
+
+    if (senml_start(&s, w, fmt) < 0) {
+        writer_code(w, MAKE_RSPCODE(5, 0));
+        return -1;
+    }
+
+    for (unsigned i = 0; (n = sampler_history(i, hist, SAMPLER_HISTORY)) >= 0; i++) {
+        if (senml_samples(&s, sensors[i].name, sensors[i].unit, hist, n, now) < (unsigned)n) {
+            break;
+        }
+    }
+
+    senml_finish(&s);
+    return 0;
+}
+
+#if MICROCOAP_WRITER
+/* The handler which handles the path /foo/bar, writing into the datagram */
+static int write_get_response(coap_writer_t *w, const coap_packet_t *inpkt)
+{
+    size_t room;
+    uint8_t *payload;
+
+    (void)inpkt;
+    DEBUG("[endpoints]  %s()\n",  __func__);
+
+    writer_option_uint(w, COAP_OPTION_CONTENT_FORMAT, COAP_CONTENTTYPE_TEXT_PLAIN);
+
+    if ((payload = writer_payload(w, &room)) == NULL || room < 4) {
+        writer_code(w, MAKE_RSPCODE(5, 0));
+        return -1;
+    }
+
+    payload[0] = '1';
+    payload[1] = '3';
+    payload[2] = '3';
+    payload[3] = '7';
+    writer_commit(w, 4);
+    return 0;
+}
+#else
+#if MICROCOAP_BUDGET
+#define MAX_RESPONSE_LEN (BUDGET_PAYLOAD_foo_bar + 1)
+#else
+#define MAX_RESPONSE_LEN 1500
+#endif
+static uint8_t response[MAX_RESPONSE_LEN] = "";
 
 void create_response_payload(const uint8_t *buffer)
 {
@@ -45,9 +325,45 @@ static int handle_get_response(coap_rw_buffer_t *scratch, const coap_packet_t *i
     return coap_make_response(scratch, outpkt, response, strlen((char*)response),
                               id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_TEXT_PLAIN);
 }
+#endif
 
 const coap_endpoint_t endpoints[] =
 {
+#if !MICROCOAP_WRITER
     {COAP_METHOD_GET, handle_get_response, &path, "ct=0"},
+#endif
     {(coap_method_t)0, NULL, NULL, NULL} /* marks the end of the endpoints array */
 };
+
+const writer_endpoint_t writer_endpoints[] =
+{
+#if MICROCOAP_WRITER
+    {COAP_METHOD_GET, write_get_response, &path, "ct=0", const_version},
+#endif
+    {COAP_METHOD_GET, write_get_log, &log_path, "ct=0;sz=32768", const_version},
+    {COAP_METHOD_PUT, write_put_blob, &blob_path, "ct=0", NULL},
+    {COAP_METHOD_GET, write_get_value, &value_path, "ct=0", get_value_version},
+    {COAP_METHOD_GET, write_get_sensor, &light_path, "ct=0", get_sensor_version},
+    {COAP_METHOD_GET, write_get_sensor, &pressure_path, "ct=0", get_sensor_version},
+    {COAP_METHOD_GET, write_get_sensor, &temperature_path, "ct=0", get_sensor_version},
+    {COAP_METHOD_GET, write_get_sensor, &gyro_path, "ct=0", get_sensor_version},
+    {COAP_METHOD_GET, write_get_senml, &senml_path, "ct=\"110 112\"", NULL},
+    {(coap_method_t)0, NULL, NULL, NULL, NULL} /* marks the end of the endpoints array */
+};
+
+#define NUM(eps) (sizeof(eps) / sizeof((eps)[0]) - 1)
+
+/* One budget for each endpoint and one for /.well-known/core */
+_Static_assert(NUM(endpoints) + NUM(writer_endpoints) + 1 == BUDGET_ENDPOINTS,
+               "ENDPOINT_BUDGETS doesn't list every endpoint");
+
+/* The longest payloads the handlers write */
+_Static_assert(BUDGET_PAYLOAD_foo_bar >= sizeof("1337") - 1, "budget of /foo/bar");
+_Static_assert(BUDGET_PAYLOAD_value >= sizeof("4294967295") - 1, "budget of /value");
+_Static_assert(BUDGET_PAYLOAD_light >= sizeof("-2147483648 mbar") - 1, "budget of /sensors/*, the same for each");
+
+#if MICROCOAP_BUDGET
+_Static_assert((BUDGET_QUEUE & (BUDGET_QUEUE - 1)) == 0, "BUDGET_QUEUE is no power of 2");
+/* IPv6 minimum MTU less IPv6 and UDP header */
+_Static_assert(BUDGET_BUFSZ <= 1280 - 40 - 8, "datagrams don't fit the minimum MTU");
+#endif
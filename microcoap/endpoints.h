@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2015 HAW Hamburg
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @{
+ *
+ * @file
+ * @brief       microcoap example server endpoints
+ *
+ * @}
+ */
+
+#ifndef ENDPOINTS_H
+#define ENDPOINTS_H
+
+#include <stdint.h>
+
+#include "block.h"
+#include "writer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief   Bytes of an option with a value of @p len bytes at most,
+ *          including an extended delta
+ */
+#define BUDGET_OPT(len)         (2U + (len) + ((len) > 12) + ((len) > 268))
+
+/**
+ * @brief   Payload of a block, with its marker
+ */
+#define BUDGET_BLOCK            (1U + (16U << BLOCK_SZX_MAX))
+
+/**
+ * @brief   What every endpoint and /.well-known/core send and receive at
+ *          most, see budget.h
+ *
+ *          Rows are name, options and payload of a request, options of a
+ *          response and its payload. Requests are counted without Uri-Path
+ *          options the server doesn't know, responses with an ETag where
+ *          the endpoint has a version.
+ */
+#define ENDPOINT_BUDGETS(X) \
+    X(foo_bar, BUDGET_OPT(3) + BUDGET_OPT(3) + BUDGET_OPT(4), \
+      BUDGET_OPT(4) + BUDGET_OPT(1), 4) \
+    X(wellknown, BUDGET_OPT(11) + BUDGET_OPT(4) + BUDGET_OPT(3), \
+      BUDGET_OPT(1) + BUDGET_OPT(3) + BUDGET_OPT(2), BUDGET_BLOCK) \
+    X(log, BUDGET_OPT(3) + BUDGET_OPT(4) + BUDGET_OPT(3), \
+      BUDGET_OPT(4) + BUDGET_OPT(1) + BUDGET_OPT(3) + BUDGET_OPT(2), BUDGET_BLOCK) \
+    X(blob, BUDGET_OPT(4) + BUDGET_OPT(0) + BUDGET_OPT(3) + BUDGET_BLOCK, \
+      BUDGET_OPT(3), 0) \
+    X(value, BUDGET_OPT(5) + BUDGET_OPT(4), \
+      BUDGET_OPT(4) + BUDGET_OPT(1), 10) \
+    X(light, BUDGET_OPT(7) + BUDGET_OPT(5) + BUDGET_OPT(4), \
+      BUDGET_OPT(4) + BUDGET_OPT(1) + BUDGET_OPT(2), 16) \
+    X(pressure, BUDGET_OPT(7) + BUDGET_OPT(8) + BUDGET_OPT(4), \
+      BUDGET_OPT(4) + BUDGET_OPT(1) + BUDGET_OPT(2), 16) \
+    X(temperature, BUDGET_OPT(7) + BUDGET_OPT(11) + BUDGET_OPT(4), \
+      BUDGET_OPT(4) + BUDGET_OPT(1) + BUDGET_OPT(2), 16) \
+    X(gyro, BUDGET_OPT(7) + BUDGET_OPT(4) + BUDGET_OPT(4), \
+      BUDGET_OPT(4) + BUDGET_OPT(1) + BUDGET_OPT(2), 16) \
+    X(senml, BUDGET_OPT(5) + BUDGET_OPT(1), \
+      BUDGET_OPT(1), SENML_BUDGET)
+
+/**
+ * @brief   Payload of /senml, which packs as many samples as fit
+ */
+#ifndef SENML_BUDGET
+#define SENML_BUDGET            (96U)
+#endif
+
+extern const writer_endpoint_t writer_endpoints[];
+
+/**
+ * @brief   Sets what /value returns, a new value gets a new ETag
+ */
+void endpoints_set_value(uint32_t v);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ENDPOINTS_H */
@@ -19,125 +19,189 @@
 
 #include <stdio.h>
 
-#include "udp.h"
-#include "net_help.h"
-#include "net_if.h"
-#include "periph/cpuid.h" 
-#include "board_uart0.h"
-#include "thread.h"
-#include "posix_io.h"
 #include <coap.h>
-#include "hashes.h"
+#include "hwtimer.h"
+
+#include "dispatch.h"
+#include "endpoints.h"
+#include "sampler.h"
+#include "senml.h"
+#include "server.h"
+#include "writer.h"
 
 #define ENABLE_DEBUG    (1)
 #include "debug.h"
 
-#define PORT 5683
-#define BUFSZ 128
-
-#define RCV_MSG_Q_SIZE      (64)
-
-static void *_microcoap_server_thread(void *arg);
-
-msg_t msg_q[RCV_MSG_Q_SIZE];
-char _rcv_stack_buf[KERNEL_CONF_STACKSIZE_MAIN];
-
-static ipv6_addr_t prefix;
-int sock_rcv, if_id;
-sockaddr6_t sa_rcv;
-uint8_t buf[BUFSZ];
 uint8_t scratch_raw[BUFSZ];
 coap_rw_buffer_t scratch_buf = {scratch_raw, sizeof(scratch_raw)};
 
-static void _init_tlayer(void);
-static uint16_t get_hw_addr(void);
+server_stats_t server_stats;
+
+static void _print_stats(void);
 
 int main(void)
 {
 
     DEBUG("Starting example microcoap server...\n");
 
-    _init_tlayer();
-    thread_create(_rcv_stack_buf, KERNEL_CONF_STACKSIZE_MAIN, PRIORITY_MAIN, CREATE_STACKTEST, _microcoap_server_thread, NULL ,"_microcoap_server_thread");
+#ifdef PARSE_BENCH
+    parse_bench();
+#endif
 
-    DEBUG("Ready to receive requests.\n");
+#ifdef DISPATCH_BENCH
+    dispatch_bench(0);
+#endif
 
-    return 0;
-}
+    if (dispatch_init(endpoints, writer_endpoints) < 0) {
+        return 1;
+    }
 
-static uint16_t get_hw_addr(void)
-{
-    return sysconfig.id;
-}
+#ifdef POLL_BENCH
+    poll_bench(1000, 5);
+#endif
 
-/* init transport layer & routing stuff*/
-static void _init_tlayer(void)
-{
-    msg_init_queue(msg_q, RCV_MSG_Q_SIZE);
+#ifdef SENML_BENCH
+    senml_bench(SAMPLER_HISTORY);
+#endif
+
+    if (sampler_init() < 0) {
+        return 1;
+    }
 
-    net_if_set_hardware_address(0, get_hw_addr());
-    DEBUG("set hawddr to: %d\n", get_hw_addr());
+    if (server_transport_init() < 0) {
+        return 1;
+    }
 
-    printf("initializing 6LoWPAN...\n");
+#if MICROCOAP_BUDGET
+    budget_report();
+#endif
 
-    ipv6_addr_init(&prefix, 0xABCD, 0xEF12, 0, 0, 0, 0, 0, 0);
-    if_id = 0; /* having more than one interface isn't supported anyway */
+    DEBUG("Ready to receive requests.\n");
 
-    sixlowpan_lowpan_init_interface(if_id);
+    return 0;
 }
 
-static void *_microcoap_server_thread(void *arg)
+/* The handler fills its own buffer, then coap_build() copies all of it */
+static int _build(coap_packet_t *pkt, uint8_t *rsp, size_t rsp_size)
 {
-    (void)arg; /* make the compiler shut up about unused variables */
+    int rc;
+    size_t rsplen = rsp_size;
+    coap_packet_t rsppkt;
 
-    printf("initializing receive socket...\n");
+    dispatch_handle_req(&scratch_buf, pkt, &rsppkt);
 
-    sa_rcv = (sockaddr6_t) { .sin6_family = AF_INET6,
-               .sin6_port = HTONS(PORT) };
+    if (0 != (rc = coap_build(rsp, &rsplen, &rsppkt))) {
+        printf("coap_build failed rc=%d\n", rc);
+        return -1;
+    }
 
-    sock_rcv = socket_base_socket(PF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+#if MICROCOAP_DUMP
+    printf("content:\n");
+    coap_dumpPacket(&rsppkt);
+#endif
+    /* the payload was written once by the handler */
+    server_stats.copied += rsplen + rsppkt.payload.len;
+    return rsplen;
+}
 
-    if (-1 == socket_base_bind(sock_rcv, &sa_rcv, sizeof(sa_rcv))) {
-        printf("Error: bind to receive socket failed!\n");
-        socket_base_close(sock_rcv);
+void server_received(void)
+{
+    if (server_stats.received++ == 0) {
+        server_stats.start = hwtimer_now();
     }
+}
 
-    printf("Ready to receive requests.\n");
-
-    while(1)
+int server_handle(const uint8_t *req, size_t n, uint8_t *rsp, size_t rsp_size)
+{
+    int rc;
+    coap_packet_t pkt;
+
+#if MICROCOAP_DUMP
+    printf("Received packet: ");
+    coap_dump(req, n, true);
+    printf("\n");
+#endif
+
+    if (0 != (rc = coap_parse(&pkt, req, n))) {
+        printf("Bad packet rc=%d\n", rc);
+        server_stats.bad++;
+        rc = -1;
+    }
+    else
     {
-        int n, rc;
-        socklen_t len = sizeof(sa_rcv);
-        coap_packet_t pkt;
+        coap_writer_t w;
+        uint32_t start;
+#if MICROCOAP_DUMP
+        printf("content:\n");
+        coap_dumpPacket(&pkt);
+#endif
+        start = hwtimer_now();
+        writer_init(&w, rsp, rsp_size, &pkt);
+
+        if (dispatch_write(&w, &pkt)) {
+            rc = writer_finish(&w);
+            server_stats.copied += w.copied;
+        }
+        else {
+            rc = _build(&pkt, rsp, rsp_size);
+        }
 
-        n = socket_base_recvfrom(sock_rcv, buf, sizeof(buf), 0, &sa_rcv, &len);
-        printf("Received packet: ");
-        coap_dump(buf, n, true);
-        printf("\n");
+        server_stats.build_ticks += hwtimer_now() - start;
 
-        if (0 != (rc = coap_parse(&pkt, buf, n)))
-            printf("Bad packet rc=%d\n", rc);
+        if (rc < 0)
+            printf("building the response failed\n");
+#if MICROCOAP_DUMP
         else
         {
-            size_t rsplen = sizeof(buf);
-            coap_packet_t rsppkt;
-            printf("content:\n");
-            coap_dumpPacket(&pkt);
-            coap_handle_req(&scratch_buf, &pkt, &rsppkt);
-
-            if (0 != (rc = coap_build(buf, &rsplen, &rsppkt)))
-                printf("coap_build failed rc=%d\n", rc);
-            else
-            {
-                printf("Sending packet: ");
-                coap_dump(buf, rsplen, true);
-                printf("\n");
-                printf("content:\n");
-                coap_dumpPacket(&rsppkt);
-                socket_base_sendto(sock_rcv, buf, rsplen, 0, &sa_rcv, sizeof(sa_rcv));
-            }
+            printf("Sending packet: ");
+            coap_dump(rsp, rc, true);
+            printf("\n");
         }
+#endif
+    }
+
+    if (++server_stats.handled % MICROCOAP_STATS_EVERY == 0) {
+        _print_stats();
+    }
+
+    return rc;
+}
+
+#if MICROCOAP_BUDGET
+void budget_report(void)
+{
+    size_t transport = server_transport_ram(), dispatch = dispatch_ram();
+    size_t sampler = sampler_ram();
+
+    printf("microcoap: RAM budget for %u endpoints\n", BUDGET_ENDPOINTS);
+    printf("  datagrams: %u bytes (requests %u, responses %u)\n", (unsigned)BUFSZ,
+           (unsigned)BUDGET_REQUEST_SIZE, (unsigned)BUDGET_RESPONSE_SIZE);
+    printf("  queues:    %u messages, stacks: %u bytes\n", BUDGET_QUEUE,
+           (unsigned)MICROCOAP_STACKSIZE);
+    printf("  transport %u + scratch %u + dispatch %u + sampler %u = %u bytes\n",
+           (unsigned)transport, (unsigned)sizeof(scratch_raw), (unsigned)dispatch,
+           (unsigned)sampler, (unsigned)(transport + sizeof(scratch_raw) + dispatch + sampler));
+}
+#endif
+
+static void _print_stats(void)
+{
+    server_stats_t *s = &server_stats;
+    uint32_t ms = HWTIMER_TICKS_TO_US(hwtimer_now() - s->start) / 1000;
+
+    printf("microcoap: %lu received, %lu handled, %lu dropped, %lu bad",
+           (unsigned long)s->received, (unsigned long)s->handled,
+           (unsigned long)s->dropped, (unsigned long)s->bad);
+
+    if (ms) {
+        printf(", %lu req/s", (unsigned long)((uint64_t)s->handled * 1000 / ms));
     }
 
-    return NULL;
+    printf(", %lu bytes copied and %lu us per response",
+           (unsigned long)(s->copied / s->handled),
+           (unsigned long)(HWTIMER_TICKS_TO_US(s->build_ticks) / s->handled));
+
+    /* the transport adds this after sending, so it lags one request */
+    printf(", %lu us from receiving to sending\n",
+           (unsigned long)(HWTIMER_TICKS_TO_US(s->busy_ticks) / s->handled));
 }
@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2015 HAW Hamburg
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @{
+ *
+ * @file
+ * @brief       microcoap example server over netapi (STACK=ng)
+ *
+ * Requests are parsed where ng_udp left them in the packet buffer. The
+ * response is written into a packet buffer allocation, which becomes the
+ * payload snip handed to ng_udp. Neither is copied by the server.
+ *
+ * @}
+ */
+
+#ifdef MODULE_NG_UDP
+
+#include <stdio.h>
+#include <string.h>
+
+#include "byteorder.h"
+#include "hwtimer.h"
+#include "kernel.h"
+#include "thread.h"
+#include "net/ng_netbase.h"
+#include "net/ng_nomac.h"
+#include "net/ng_netdev_eth.h"
+#include "net/ng_ipv6.h"
+#include "net/ng_ipv6/hdr.h"
+#include "net/ng_udp.h"
+#include "net/dev_eth.h"
+#include "dev_eth_tap.h"
+
+#include "server.h"
+
+#define ENABLE_DEBUG    (1)
+#include "debug.h"
+
+#define MAC_PRIO            (PRIORITY_MAIN - 4)
+#define SERVER_PRIO         (PRIORITY_MAIN - 1)
+
+/* Requests waiting in the packet buffer, a power of 2 */
+#if MICROCOAP_BUDGET
+#define RCV_MSG_Q_SIZE      (BUDGET_QUEUE)
+#else
+#define RCV_MSG_Q_SIZE      (16)
+#endif
+
+static char nomac_stack[KERNEL_CONF_STACKSIZE_DEFAULT];
+static char server_stack[MICROCOAP_STACKSIZE];
+
+/* Link-local address from the MAC, like the plugtest server does */
+static int _init_netif(void)
+{
+    kernel_pid_t netif;
+    size_t num_netif;
+    ng_ipv6_addr_t link_local;
+    uint8_t eui64[8] = {0, 0, 0, 0xFF, 0xFE, 0, 0, 0};
+
+    ng_netif_init();
+    ng_ipv6_netif_init();
+    ng_netdev_eth_init(&ng_netdev_eth, (dev_eth_t *)&dev_eth_tap);
+
+    if (ng_nomac_init(nomac_stack, sizeof(nomac_stack), MAC_PRIO, "eth_mac",
+                      (ng_netdev_t *)&ng_netdev_eth) < 0) {
+        printf("Error: starting nomac thread failed\n");
+        return -1;
+    }
+
+    netif = *(ng_netif_get(&num_netif));
+
+    if (num_netif == 0) {
+        printf("Error: no active interfaces\n");
+        return -1;
+    }
+
+    memcpy(&eui64[0], &dev_eth_tap.addr[0], 3);
+    memcpy(&eui64[5], &dev_eth_tap.addr[3], 3);
+    eui64[0] ^= 1 << 1;
+
+    ng_ipv6_netif_reset_addr(netif);
+    ng_ipv6_addr_set_link_local_prefix(&link_local);
+    ng_ipv6_addr_set_aiid(&link_local, &eui64[0]);
+
+    if (ng_ipv6_netif_add_addr(netif, &link_local, 64, false) != 0) {
+        printf("Error: setting link-local address failed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static void _send(ng_pktsnip_t *pkt)
+{
+    ng_netreg_entry_t *sendto = ng_netreg_lookup(NG_NETTYPE_UDP, NG_NETREG_DEMUX_CTX_ALL);
+
+    if (sendto == NULL) {
+        DEBUG("microcoap: no UDP thread to send to\n");
+        ng_pktbuf_release(pkt);
+        return;
+    }
+
+    ng_pktbuf_hold(pkt, ng_netreg_num(NG_NETTYPE_UDP, NG_NETREG_DEMUX_CTX_ALL) - 1);
+
+    while (sendto != NULL) {
+        ng_netapi_send(sendto->pid, pkt);
+        sendto = ng_netreg_getnext(sendto);
+    }
+}
+
+/* Answers the request in @p pkt, whose first snip is the CoAP message */
+static void _handle(ng_pktsnip_t *pkt, uint32_t start)
+{
+    ng_pktsnip_t *ip = NULL, *udp = NULL, *rsp, *hdr;
+    uint16_t src_port = PORT, dst_port;
+    int rsplen;
+
+    for (ng_pktsnip_t *s = pkt; s; s = s->next) {
+        if (s->type == NG_NETTYPE_IPV6) {
+            ip = s;
+        }
+        else if (s->type == NG_NETTYPE_UDP) {
+            udp = s;
+        }
+    }
+
+    if (!ip || !udp) {
+        ng_pktbuf_release(pkt);
+        return;
+    }
+
+    server_received();
+
+    if ((rsp = ng_pktbuf_add(NULL, NULL, BUFSZ, NG_NETTYPE_UNDEF)) == NULL) {
+        DEBUG("microcoap: packet buffer full\n");
+        server_stats.dropped++;
+        ng_pktbuf_release(pkt);
+        return;
+    }
+
+    rsplen = server_handle(pkt->data, pkt->size, rsp->data, rsp->size);
+
+    if (rsplen < 0 || ng_pktbuf_realloc_data(rsp, rsplen) != 0) {
+        ng_pktbuf_release(rsp);
+        ng_pktbuf_release(pkt);
+        return;
+    }
+
+    dst_port = byteorder_ntohs(((ng_udp_hdr_t *)udp->data)->src_port);
+    hdr = ng_netreg_hdr_build(NG_NETTYPE_UDP, rsp, (uint8_t *)&src_port, sizeof(uint16_t),
+                              (uint8_t *)&dst_port, sizeof(uint16_t));
+    hdr = hdr ? ng_netreg_hdr_build(NG_NETTYPE_IPV6, hdr, NULL, 0,
+                                    ((ng_ipv6_hdr_t *)ip->data)->src.u8,
+                                    sizeof(ng_ipv6_addr_t)) : NULL;
+
+    /* the request is only referenced until here */
+    ng_pktbuf_release(pkt);
+
+    if (hdr == NULL) {
+        DEBUG("microcoap: building headers failed\n");
+        ng_pktbuf_release(rsp);
+        server_stats.dropped++;
+        return;
+    }
+
+    _send(hdr);
+    server_stats.busy_ticks += hwtimer_now() - start;
+}
+
+static void *_microcoap_server_thread(void *arg)
+{
+    (void)arg;
+    msg_t msg, msg_q[RCV_MSG_Q_SIZE];
+    ng_netreg_entry_t reg;
+
+    msg_init_queue(msg_q, RCV_MSG_Q_SIZE);
+
+    reg.demux_ctx = PORT;
+    reg.pid = thread_getpid();
+    ng_netreg_register(NG_NETTYPE_UDP, &reg);
+
+    printf("Ready to receive requests.\n");
+
+    while (1) {
+        msg_receive(&msg);
+
+        switch (msg.type) {
+            case NG_NETAPI_MSG_TYPE_RCV:
+                _handle((ng_pktsnip_t *)msg.content.ptr, hwtimer_now());
+                break;
+
+            case NG_NETAPI_MSG_TYPE_SND:
+                ng_pktbuf_release((ng_pktsnip_t *)msg.content.ptr);
+                break;
+
+            default:
+                DEBUG("microcoap: received unidentified message\n");
+                break;
+        }
+    }
+
+    return NULL;
+}
+
+int server_transport_init(void)
+{
+    if (_init_netif() < 0) {
+        return -1;
+    }
+
+    thread_create(server_stack, sizeof(server_stack), SERVER_PRIO, CREATE_STACKTEST,
+                  _microcoap_server_thread, NULL, "_microcoap_server_thread");
+    return 0;
+}
+
+size_t server_transport_ram(void)
+{
+    /* requests and responses live in the packet buffer */
+    return sizeof(nomac_stack) + sizeof(server_stack);
+}
+
+#endif /* MODULE_NG_UDP */
@@ -0,0 +1,314 @@
+/*
+ * Copyright (C) 2015 HAW Hamburg
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @{
+ *
+ * @file
+ * @brief       Timing and fuzzing of coap_parse() and coap_build()
+ *
+ * With PARSE_BENCH, parse_bench() times both for packets with 0 to MAXOPT
+ * options and up to 1 KiB of payload, then feeds them mutated. With
+ * PARSE_FUZZ, this file is a libFuzzer target of its own, see README.md.
+ *
+ * @}
+ */
+
+#if defined(PARSE_BENCH) || defined(PARSE_FUZZ)
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coap.h"
+
+#define PKT_MAX         (1100U)
+
+/* Parses @p data, builds what was parsed and parses that again. Returns 0
+ * if @p data was rejected, 1 if both parses agree and -1 if they don't. */
+static int roundtrip(const uint8_t *data, size_t size)
+{
+    static uint8_t out[2 * PKT_MAX];
+    coap_packet_t pkt, again;
+    size_t len = sizeof(out);
+
+    if (coap_parse(&pkt, data, size) != 0) {
+        return 0;
+    }
+
+    if (coap_build(out, &len, &pkt) != 0) {
+        /* everything that parses has to build again */
+        return -1;
+    }
+
+    if (coap_parse(&again, out, len) != 0 ||
+        again.hdr.code != pkt.hdr.code ||
+        again.tok.len != pkt.tok.len ||
+        again.numopts != pkt.numopts ||
+        again.payload.len != pkt.payload.len) {
+        return -1;
+    }
+
+    for (unsigned i = 0; i < pkt.numopts; i++) {
+        if (again.opts[i].num != pkt.opts[i].num ||
+            again.opts[i].buf.len != pkt.opts[i].buf.len ||
+            memcmp(again.opts[i].buf.p, pkt.opts[i].buf.p, pkt.opts[i].buf.len) != 0) {
+            return -1;
+        }
+    }
+
+    return 1;
+}
+
+#ifdef PARSE_FUZZ
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    /* the rebuilt packet has to fit into roundtrip()'s buffer */
+    if (size > PKT_MAX) {
+        return 0;
+    }
+
+    if (roundtrip(data, size) < 0) {
+        abort();
+    }
+
+    return 0;
+}
+#endif /* PARSE_FUZZ */
+
+#ifdef PARSE_BENCH
+#include <stdio.h>
+
+#include "hwtimer.h"
+
+#include "server.h"
+
+#define ITERATIONS      (1000U)
+#define MUTATIONS       (2000U)
+
+static const unsigned opt_counts[] = {0, 1, 2, 4, 8, MAXOPT};
+static const size_t payload_sizes[] = {0, 16, 64, 256, 1024};
+
+#define NUM_OPTS        (sizeof(opt_counts) / sizeof(opt_counts[0]))
+#define NUM_PAYLOADS    (sizeof(payload_sizes) / sizeof(payload_sizes[0]))
+
+/* What the example server gets to see */
+static const uint8_t get_foo_bar[] = {
+    0x42, 0x01, 0x12, 0x34, 0xbe, 0xef, 0xb3, 'f', 'o', 'o', 0x03, 'b', 'a', 'r'
+};
+static const uint8_t get_core[] = {
+    0x42, 0x01, 0x12, 0x35, 0xbe, 0xef, 0xbb, '.', 'w', 'e', 'l', 'l', '-', 'k', 'n',
+    'o', 'w', 'n', 0x04, 'c', 'o', 'r', 'e'
+};
+static const uint8_t get_log_block2[] = {
+    0x42, 0x01, 0x12, 0x36, 0xbe, 0xef, 0xb3, 'l', 'o', 'g', 0xc1, 0x32
+};
+static const uint8_t put_blob_block1[] = {
+    0x42, 0x03, 0x12, 0x37, 0xbe, 0xef, 0xb4, 'b', 'l', 'o', 'b', 0xd1, 0x03, 0x0a,
+    0xff, 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o', 'p'
+};
+static const uint8_t get_value_etag[] = {
+    0x42, 0x01, 0x12, 0x38, 0xbe, 0xef, 0x44, 0x00, 0x00, 0x00, 0x07, 0x75, 'v', 'a',
+    'l', 'u', 'e'
+};
+static const uint8_t get_senml_cbor[] = {
+    0x42, 0x01, 0x12, 0x39, 0xbe, 0xef, 0xb5, 's', 'e', 'n', 'm', 'l', 0x61, 0x70
+};
+static const uint8_t content_1337[] = {
+    0x62, 0x45, 0x12, 0x34, 0xbe, 0xef, 0xc0, 0xff, '1', '3', '3', '7'
+};
+
+static const struct {
+    const uint8_t *data;
+    size_t len;
+} corpus[] = {
+    {get_foo_bar, sizeof(get_foo_bar)},
+    {get_core, sizeof(get_core)},
+    {get_log_block2, sizeof(get_log_block2)},
+    {put_blob_block1, sizeof(put_blob_block1)},
+    {get_value_etag, sizeof(get_value_etag)},
+    {get_senml_cbor, sizeof(get_senml_cbor)},
+    {content_1337, sizeof(content_1337)},
+};
+
+#define NUM_CORPUS      (sizeof(corpus) / sizeof(corpus[0]))
+
+static uint8_t pkt_buf[PKT_MAX];
+static uint8_t build_buf[PKT_MAX];
+static uint32_t seed = 1;
+
+static uint32_t rand32(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+/* A GET or, with payload, a PUT of /s0/s1/... with @p opts segments */
+static size_t make_packet(uint8_t *buf, unsigned opts, size_t payload)
+{
+    size_t pos = 0;
+
+    buf[pos++] = (1 << 6) | (COAP_TYPE_CON << 4) | 2;
+    buf[pos++] = payload ? COAP_METHOD_PUT : COAP_METHOD_GET;
+    buf[pos++] = 0x12;
+    buf[pos++] = 0x34;
+    buf[pos++] = 0xbe;
+    buf[pos++] = 0xef;
+
+    for (unsigned i = 0; i < opts; i++) {
+        int len = sprintf((char *)&buf[pos + 1], "s%u", i);
+
+        buf[pos] = ((i ? 0 : COAP_OPTION_URI_PATH) << 4) | len;
+        pos += 1 + len;
+    }
+
+    if (payload) {
+        buf[pos++] = 0xff;
+        memset(&buf[pos], 'x', payload);
+        pos += payload;
+    }
+
+    return pos;
+}
+
+static uint32_t ns_per(uint32_t ticks, unsigned n)
+{
+    return (uint32_t)((uint64_t)HWTIMER_TICKS_TO_US(ticks) * 1000 / n);
+}
+
+static void bench_cell(unsigned opts, size_t payload, uint32_t *parse_ns, uint32_t *build_ns)
+{
+    size_t n = make_packet(pkt_buf, opts, payload);
+    coap_packet_t pkt;
+    uint32_t start;
+
+    start = hwtimer_now();
+
+    for (unsigned i = 0; i < ITERATIONS; i++) {
+        if (coap_parse(&pkt, pkt_buf, n) != 0) {
+            printf("parse_bench: %u options, %u bytes payload don't parse\n",
+                   opts, (unsigned)payload);
+            *parse_ns = *build_ns = 0;
+            return;
+        }
+    }
+
+    *parse_ns = ns_per(hwtimer_now() - start, ITERATIONS);
+    start = hwtimer_now();
+
+    for (unsigned i = 0; i < ITERATIONS; i++) {
+        size_t len = sizeof(build_buf);
+
+        coap_build(build_buf, &len, &pkt);
+    }
+
+    *build_ns = ns_per(hwtimer_now() - start, ITERATIONS);
+}
+
+/* Changes one thing about the packet in @p buf, returns the new length */
+static size_t mutate(uint8_t *buf, size_t len)
+{
+    size_t at = rand32() % len;
+
+    switch (rand32() % 4) {
+        case 0:
+            buf[at] ^= 1 << (rand32() % 8);
+            return len;
+        case 1:
+            buf[at] = rand32();
+            return len;
+        case 2:
+            /* truncated */
+            return at;
+        default:
+            /* extended or reserved option delta or length */
+            buf[at] = (buf[at] & 0x0f) | ((13 + rand32() % 3) << 4);
+            return len;
+    }
+}
+
+static void fuzz(void)
+{
+    unsigned accepted = 0, mismatched = 0;
+    uint32_t slowest = 0, slowest_len = 0;
+
+    seed = 1;
+
+    for (unsigned i = 0; i < MUTATIONS; i++) {
+        size_t n = corpus[i % NUM_CORPUS].len;
+        uint32_t start, ticks;
+        int rc;
+
+        memcpy(pkt_buf, corpus[i % NUM_CORPUS].data, n);
+
+        /* up to three mutations on top of each other */
+        for (unsigned m = rand32() % 3; m < 3 && n; m++) {
+            n = mutate(pkt_buf, n);
+        }
+
+        start = hwtimer_now();
+        rc = roundtrip(pkt_buf, n);
+        ticks = hwtimer_now() - start;
+
+        if (rc < 0) {
+            mismatched++;
+            printf("parse_bench: round trip differs: ");
+            coap_dump(pkt_buf, n, true);
+            printf("\n");
+        }
+
+        accepted += (rc != 0);
+
+        if (ticks > slowest) {
+            slowest = ticks;
+            slowest_len = n;
+        }
+    }
+
+    printf("parse_bench: %u mutated packets, %u accepted, %u round trips differ,\n"
+           "  slowest round trip %lu ns for %lu bytes\n", MUTATIONS, accepted, mismatched,
+           (unsigned long)ns_per(slowest, 1), (unsigned long)slowest_len);
+}
+
+void parse_bench(void)
+{
+    uint32_t parse_ns[NUM_OPTS][NUM_PAYLOADS], build_ns[NUM_OPTS][NUM_PAYLOADS];
+
+    for (unsigned o = 0; o < NUM_OPTS; o++) {
+        for (unsigned p = 0; p < NUM_PAYLOADS; p++) {
+            bench_cell(opt_counts[o], payload_sizes[p], &parse_ns[o][p], &build_ns[o][p]);
+        }
+    }
+
+    for (unsigned table = 0; table < 2; table++) {
+        printf("parse_bench: ns per %s, options down, payload bytes across\n",
+               table ? "coap_build()" : "coap_parse()");
+        printf("%7s", "");
+
+        for (unsigned p = 0; p < NUM_PAYLOADS; p++) {
+            printf(" %7u", (unsigned)payload_sizes[p]);
+        }
+
+        printf("\n");
+
+        for (unsigned o = 0; o < NUM_OPTS; o++) {
+            printf("%7u", opt_counts[o]);
+
+            for (unsigned p = 0; p < NUM_PAYLOADS; p++) {
+                printf(" %7lu", (unsigned long)(table ? build_ns[o][p] : parse_ns[o][p]));
+            }
+
+            printf("\n");
+        }
+    }
+
+    fuzz();
+}
+#endif /* PARSE_BENCH */
+
+#endif /* PARSE_BENCH || PARSE_FUZZ */
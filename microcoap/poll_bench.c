@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2015 HAW Hamburg
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @{
+ *
+ * @file
+ * @brief       Bytes on air of polling /value with and without ETags
+ *
+ * @}
+ */
+
+#ifdef POLL_BENCH
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "coap.h"
+
+#include "dispatch.h"
+#include "endpoints.h"
+#include "server.h"
+
+static uint32_t seed = 1;
+
+/* writer_endpoints without version callbacks, for the baseline */
+static writer_endpoint_t unversioned[DISPATCH_SLOTS];
+
+/* Same sequence on every run */
+static unsigned rand_pct(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) % 100;
+}
+
+/* A confirmable GET of /value, listing @p etag if there is one */
+static size_t build_get(uint8_t *buf, uint16_t id, const uint8_t *etag, size_t etag_len)
+{
+    size_t pos = 0;
+    unsigned last = 0;
+
+    buf[pos++] = (1 << 6) | (COAP_TYPE_CON << 4) | 2;
+    buf[pos++] = COAP_METHOD_GET;
+    buf[pos++] = id >> 8;
+    buf[pos++] = id & 0xff;
+    buf[pos++] = 0xbe;
+    buf[pos++] = 0xef;
+
+    if (etag_len) {
+        buf[pos++] = (COAP_OPTION_ETAG << 4) | etag_len;
+        memcpy(&buf[pos], etag, etag_len);
+        pos += etag_len;
+        last = COAP_OPTION_ETAG;
+    }
+
+    buf[pos++] = ((COAP_OPTION_URI_PATH - last) << 4) | 5;
+    memcpy(&buf[pos], "value", 5);
+    return pos + 5;
+}
+
+/* server_handle() without its counters and dumps, /value is a writer endpoint */
+static int handle(const uint8_t *req, size_t n, uint8_t *rsp, size_t rsp_size)
+{
+    coap_packet_t pkt;
+    coap_writer_t w;
+
+    if (coap_parse(&pkt, req, n) != 0) {
+        return -1;
+    }
+
+    writer_init(&w, rsp, rsp_size, &pkt);
+    return dispatch_write(&w, &pkt) ? writer_finish(&w) : -1;
+}
+
+/* Polls @p polls times, returns the bytes of all requests and responses */
+static uint32_t run(unsigned polls, unsigned change_pct, bool validate, unsigned *valid)
+{
+    uint8_t req[BUFSZ], rsp[BUFSZ], etag[8];
+    size_t etag_len = 0;
+    uint32_t bytes = 0, v = 0;
+
+    seed = 1;
+    *valid = 0;
+
+    for (unsigned i = 0; i < polls; i++) {
+        coap_packet_t pkt;
+        const coap_option_t *opt;
+        uint8_t count;
+        size_t n;
+        int rsplen;
+
+        if (rand_pct() < change_pct) {
+            endpoints_set_value(++v);
+        }
+
+        n = build_get(req, i, etag, validate ? etag_len : 0);
+        rsplen = handle(req, n, rsp, sizeof(rsp));
+
+        if (rsplen < 0 || coap_parse(&pkt, rsp, rsplen) != 0) {
+            printf("poll_bench: no response to poll %u\n", i);
+            return 0;
+        }
+
+        if (pkt.hdr.code == MAKE_RSPCODE(2, 3)) {
+            (*valid)++;
+        }
+        else if ((opt = coap_findOptions(&pkt, COAP_OPTION_ETAG, &count)) &&
+                 opt->buf.len <= sizeof(etag)) {
+            memcpy(etag, opt->buf.p, opt->buf.len);
+            etag_len = opt->buf.len;
+        }
+
+        bytes += n + rsplen;
+    }
+
+    return bytes;
+}
+
+void poll_bench(unsigned polls, unsigned change_pct)
+{
+    unsigned valid, i;
+    uint32_t plain = 0, etag;
+
+    /* without version callbacks responses carry no ETag either */
+    for (i = 0; writer_endpoints[i].handler && i < DISPATCH_SLOTS - 1; i++) {
+        unversioned[i] = writer_endpoints[i];
+        unversioned[i].version = NULL;
+    }
+
+    memset(&unversioned[i], 0, sizeof(unversioned[i]));
+
+    if (dispatch_init(endpoints, unversioned) >= 0) {
+        plain = run(polls, change_pct, false, &valid);
+    }
+
+    dispatch_init(endpoints, writer_endpoints);
+    etag = run(polls, change_pct, true, &valid);
+
+    printf("poll_bench: %u polls of /value, %u%% changes\n", polls, change_pct);
+    printf("  without ETag: %lu bytes of CoAP\n", (unsigned long)plain);
+    printf("  with ETag:    %lu bytes of CoAP, %u answered with 2.03\n",
+           (unsigned long)etag, valid);
+
+    /* the ETags in requests can outweigh what 2.03 saves on tiny payloads */
+    if (plain) {
+        printf("  saved:        %ld bytes (%ld%%), headers below CoAP are the same\n",
+               (long)plain - (long)etag, ((long)plain - (long)etag) * 100 / (long)plain);
+    }
+}
+
+#endif /* POLL_BENCH */
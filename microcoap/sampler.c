@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2015 HAW Hamburg
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @{
+ *
+ * @file
+ * @brief       Background sensor sampling with a latest-value cache
+ *
+ * @}
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "thread.h"
+#include "vtimer.h"
+
+#include "sampler.h"
+
+#define ENABLE_DEBUG    (0)
+#include "debug.h"
+
+/* Keeps the compiler from moving accesses across the sequence updates */
+#define BARRIER()       __asm__ volatile ("" ::: "memory")
+
+typedef struct {
+    volatile uint32_t seq;
+    sampler_value_t v;
+    sampler_sample_t hist[SAMPLER_HISTORY];
+    uint8_t head;               /* where the next sample goes */
+    uint8_t count;
+} slot_t;
+
+static slot_t cache[SAMPLER_MAX];
+static uint32_t due[SAMPLER_MAX];
+static unsigned num;
+
+static char sampler_stack[KERNEL_CONF_STACKSIZE_MAIN];
+
+uint32_t sampler_now_ms(void)
+{
+    timex_t now;
+
+    vtimer_now(&now);
+    return now.seconds * 1000 + now.microseconds / 1000;
+}
+
+static void publish(unsigned idx, int32_t value, uint32_t time_ms)
+{
+    slot_t *slot = &cache[idx];
+
+    slot->seq++;
+    BARRIER();
+
+    if (slot->v.version == 0 || slot->v.value != value) {
+        slot->v.version++;
+    }
+
+    slot->v.value = value;
+    slot->v.time_ms = time_ms;
+
+    slot->hist[slot->head].value = value;
+    slot->hist[slot->head].time_ms = time_ms;
+    slot->head = (slot->head + 1) % SAMPLER_HISTORY;
+
+    if (slot->count < SAMPLER_HISTORY) {
+        slot->count++;
+    }
+
+    BARRIER();
+    slot->seq++;
+}
+
+int sampler_get(unsigned idx, sampler_value_t *out)
+{
+    uint32_t seq;
+
+    if (idx >= num) {
+        return -1;
+    }
+
+    do {
+        seq = cache[idx].seq;
+        BARRIER();
+        *out = cache[idx].v;
+        BARRIER();
+    } while ((seq & 1) || seq != cache[idx].seq);
+
+    return (out->version == 0) ? -1 : 0;
+}
+
+int sampler_history(unsigned idx, sampler_sample_t *out, unsigned max)
+{
+    slot_t *slot;
+    uint32_t seq;
+    unsigned n;
+
+    if (idx >= num) {
+        return -1;
+    }
+
+    slot = &cache[idx];
+
+    do {
+        unsigned pos;
+
+        seq = slot->seq;
+        BARRIER();
+        n = (slot->count < max) ? slot->count : max;
+        pos = slot->head;
+
+        for (unsigned i = 0; i < n; i++) {
+            pos = (pos + SAMPLER_HISTORY - 1) % SAMPLER_HISTORY;
+            out[i] = slot->hist[pos];
+        }
+
+        BARRIER();
+    } while ((seq & 1) || seq != slot->seq);
+
+    return n;
+}
+
+int sampler_find(const char *name, size_t len)
+{
+    for (unsigned i = 0; i < num; i++) {
+        if (strlen(sensors[i].name) == len && memcmp(sensors[i].name, name, len) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static void *_sampler_thread(void *arg)
+{
+    (void)arg;
+
+    while (1) {
+        uint32_t now = sampler_now_ms();
+        uint32_t next = now + 1000;
+
+        for (unsigned i = 0; i < num; i++) {
+            int32_t value;
+
+            if ((int32_t)(due[i] - now) <= 0) {
+                /* may take a while, readers keep getting the last sample */
+                if (sensors[i].read(sensors[i].arg, &value) == 0) {
+                    publish(i, value, sampler_now_ms());
+                }
+                else {
+                    DEBUG("sampler: reading %s failed\n", sensors[i].name);
+                }
+
+                due[i] += sensors[i].period_ms;
+
+                /* don't try to catch up after a slow read */
+                if ((int32_t)(due[i] - sampler_now_ms()) < 0) {
+                    due[i] = sampler_now_ms() + sensors[i].period_ms;
+                }
+            }
+
+            if ((int32_t)(due[i] - next) < 0) {
+                next = due[i];
+            }
+        }
+
+        now = sampler_now_ms();
+
+        if ((int32_t)(next - now) > 0) {
+            vtimer_usleep((next - now) * 1000);
+        }
+    }
+
+    return NULL;
+}
+
+size_t sampler_ram(void)
+{
+    return sizeof(cache) + sizeof(due) + sizeof(sampler_stack);
+}
+
+int sampler_init(void)
+{
+    uint32_t now = sampler_now_ms();
+
+    if (sensors_init() < 0) {
+        printf("sampler: initializing sensors failed\n");
+        return -1;
+    }
+
+    for (num = 0; sensors[num].name; num++) {
+        if (num == SAMPLER_MAX) {
+            printf("sampler: more than %u sensors\n", SAMPLER_MAX);
+            return -1;
+        }
+
+        due[num] = now;
+    }
+
+    thread_create(sampler_stack, sizeof(sampler_stack), SAMPLER_PRIO, CREATE_STACKTEST,
+                  _sampler_thread, NULL, "sampler");
+    return num;
+}
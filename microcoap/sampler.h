@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2015 HAW Hamburg
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @{
+ *
+ * @file
+ * @brief       Background sensor sampling with a latest-value cache
+ *
+ * A sampler thread reads every sensor of sensors[] at its own period and
+ * publishes the result into a cache slot per sensor. Endpoints read the
+ * slot instead of the sensor, so a request never waits for a slow I2C
+ * transfer. Each slot is a seqlock: the sampler makes the sequence odd,
+ * writes and makes it even again, readers retry while it is odd or has
+ * changed. This only holds while the sampler runs with a higher priority
+ * than every reader, see SAMPLER_PRIO.
+ *
+ * The slot also keeps the last SAMPLER_HISTORY samples, for resources
+ * that report a window of readings at once.
+ *
+ * On native the sensors are simulated with a configurable read latency,
+ * see sensors.c.
+ *
+ * @}
+ */
+
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kernel.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief   Priority of the sampler, above the CoAP server's threads
+ */
+#ifndef SAMPLER_PRIO
+#define SAMPLER_PRIO            (PRIORITY_MAIN - 2)
+#endif
+
+/**
+ * @brief   Maximum number of sensors
+ */
+#ifndef SAMPLER_MAX
+#define SAMPLER_MAX             (8U)
+#endif
+
+/**
+ * @brief   Number of samples kept per sensor
+ */
+#ifndef SAMPLER_HISTORY
+#define SAMPLER_HISTORY         (8U)
+#endif
+
+/**
+ * @brief   Reads a sensor
+ *
+ * @return  0 on success
+ */
+typedef int (*sampler_read_t)(void *arg, int32_t *value);
+
+/**
+ * @brief   A sensor and how often to sample it
+ */
+typedef struct {
+    const char *name;           /**< last Uri-Path segment of its resource */
+    const char *unit;
+    sampler_read_t read;
+    void *arg;                  /**< passed to read */
+    uint32_t period_ms;
+} sampler_sensor_t;
+
+/**
+ * @brief   The last sample of a sensor
+ */
+typedef struct {
+    int32_t value;
+    uint32_t time_ms;           /**< when it was read */
+    uint32_t version;           /**< changes with the value, 0 before the first sample */
+} sampler_value_t;
+
+/**
+ * @brief   A sample in the history of a sensor
+ */
+typedef struct {
+    int32_t value;
+    uint32_t time_ms;
+} sampler_sample_t;
+
+/**
+ * @brief   The sensors of this board, terminated by an entry without name
+ */
+extern const sampler_sensor_t sensors[];
+
+/**
+ * @brief   Initializes the drivers of sensors[], called by sampler_init()
+ *
+ * @return  0 on success
+ */
+int sensors_init(void);
+
+/**
+ * @brief   Initializes the sensors and starts the sampler thread
+ *
+ * @return  number of sensors
+ * @return  -1 on error
+ */
+int sampler_init(void);
+
+/**
+ * @brief   Index of the sensor called @p name of length @p len
+ *
+ * @return  -1 if there is none
+ */
+int sampler_find(const char *name, size_t len);
+
+/**
+ * @brief   Gets the last sample of sensor @p idx without blocking
+ *
+ * @return  0 on success
+ * @return  -1 if there is no sample yet
+ */
+int sampler_get(unsigned idx, sampler_value_t *out);
+
+/**
+ * @brief   Copies up to @p max of the last samples of sensor @p idx to
+ *          @p out, newest first, without blocking
+ *
+ * @return  number of samples copied
+ * @return  -1 if there is no sensor @p idx
+ */
+int sampler_history(unsigned idx, sampler_sample_t *out, unsigned max);
+
+/**
+ * @brief   Bytes of RAM the cache and the sampler's stack take
+ */
+size_t sampler_ram(void);
+
+/**
+ * @brief   Milliseconds since boot, the clock of sampler_value_t::time_ms
+ */
+uint32_t sampler_now_ms(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SAMPLER_H */
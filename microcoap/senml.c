@@ -0,0 +1,486 @@
+/*
+ * Copyright (C) 2015 HAW Hamburg
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @{
+ *
+ * @file
+ * @brief       Streaming SenML encoder writing into the response
+ *
+ * @}
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "senml.h"
+
+#define ENABLE_DEBUG    (0)
+#include "debug.h"
+
+/* CBOR major types */
+#define CBOR_UINT       (0U << 5)
+#define CBOR_NEGINT     (1U << 5)
+#define CBOR_TEXT       (3U << 5)
+#define CBOR_MAP        (5U << 5)
+#define CBOR_FLOAT32    (0xfaU)
+#define CBOR_ARRAY_INDEF (0x9fU)
+#define CBOR_BREAK      (0xffU)
+
+/* Labels of the fields in SenML CBOR */
+#define LABEL_BN        (-2)
+#define LABEL_BT        (-3)
+#define LABEL_BU        (-4)
+#define LABEL_BV        (-5)
+#define LABEL_N         (0)
+#define LABEL_V         (2)
+#define LABEL_T         (6)
+
+static void put(senml_t *s, const void *data, size_t len)
+{
+    if (s->full || s->len + len > s->room) {
+        s->full = true;
+        return;
+    }
+
+    memcpy(s->buf + s->len, data, len);
+    s->len += len;
+}
+
+static void put_byte(senml_t *s, uint8_t b)
+{
+    put(s, &b, 1);
+}
+
+static void cbor_head(senml_t *s, uint8_t major, uint32_t v)
+{
+    uint8_t head[5];
+    size_t len;
+
+    if (v < 24) {
+        head[0] = major | v;
+        len = 1;
+    }
+    else if (v < 0x100) {
+        head[0] = major | 24;
+        head[1] = v;
+        len = 2;
+    }
+    else if (v < 0x10000) {
+        head[0] = major | 25;
+        head[1] = v >> 8;
+        head[2] = v;
+        len = 3;
+    }
+    else {
+        head[0] = major | 26;
+        head[1] = v >> 24;
+        head[2] = v >> 16;
+        head[3] = v >> 8;
+        head[4] = v;
+        len = 5;
+    }
+
+    put(s, head, len);
+}
+
+static void cbor_int(senml_t *s, int32_t v)
+{
+    if (v < 0) {
+        cbor_head(s, CBOR_NEGINT, (uint32_t)(-1 - v));
+    }
+    else {
+        cbor_head(s, CBOR_UINT, v);
+    }
+}
+
+static void cbor_text(senml_t *s, const char *str)
+{
+    size_t len = strlen(str);
+
+    cbor_head(s, CBOR_TEXT, len);
+    put(s, str, len);
+}
+
+/* Whole seconds as integer, everything else as float */
+static void cbor_time(senml_t *s, int32_t ms)
+{
+    float f;
+    uint32_t bits;
+
+    if (ms % 1000 == 0) {
+        cbor_int(s, ms / 1000);
+        return;
+    }
+
+    f = ms / 1000.0f;
+    memcpy(&bits, &f, sizeof(bits));
+    put_byte(s, CBOR_FLOAT32);
+    put_byte(s, bits >> 24);
+    put_byte(s, bits >> 16);
+    put_byte(s, bits >> 8);
+    put_byte(s, bits);
+}
+
+static void json_key(senml_t *s, const char *key, bool first)
+{
+    if (!first) {
+        put_byte(s, ',');
+    }
+
+    put_byte(s, '"');
+    put(s, key, strlen(key));
+    put(s, "\":", 2);
+}
+
+static void json_text(senml_t *s, const char *key, const char *str, bool first)
+{
+    json_key(s, key, first);
+    put_byte(s, '"');
+    put(s, str, strlen(str));
+    put_byte(s, '"');
+}
+
+static void json_int(senml_t *s, const char *key, int32_t v, bool first)
+{
+    char num[12];
+
+    json_key(s, key, first);
+    put(s, num, sprintf(num, "%ld", (long)v));
+}
+
+static void json_time(senml_t *s, const char *key, int32_t ms, bool first)
+{
+    char num[14];
+    uint32_t abs = (ms < 0) ? -(uint32_t)ms : (uint32_t)ms;
+    int len;
+
+    if (ms % 1000 == 0) {
+        json_int(s, key, ms / 1000, first);
+        return;
+    }
+
+    json_key(s, key, first);
+    len = sprintf(num, "%s%lu.%03lu", (ms < 0) ? "-" : "",
+                  (unsigned long)(abs / 1000), (unsigned long)(abs % 1000));
+
+    /* no trailing zeros */
+    while (num[len - 1] == '0') {
+        len--;
+    }
+
+    put(s, num, len);
+}
+
+static void encode_cbor(senml_t *s, const senml_record_t *r)
+{
+    unsigned fields = 1 + (r->bn != NULL) + (r->bu != NULL) + 2 * r->base +
+                      (r->n != NULL) + (r->t_ms != 0);
+
+    cbor_head(s, CBOR_MAP, fields);
+
+    if (r->bn) {
+        cbor_int(s, LABEL_BN);
+        cbor_text(s, r->bn);
+    }
+
+    if (r->base) {
+        cbor_int(s, LABEL_BT);
+        cbor_time(s, r->bt_ms);
+    }
+
+    if (r->bu) {
+        cbor_int(s, LABEL_BU);
+        cbor_text(s, r->bu);
+    }
+
+    if (r->base) {
+        cbor_int(s, LABEL_BV);
+        cbor_int(s, r->bv);
+    }
+
+    if (r->n) {
+        cbor_int(s, LABEL_N);
+        cbor_text(s, r->n);
+    }
+
+    cbor_int(s, LABEL_V);
+    cbor_int(s, r->v);
+
+    if (r->t_ms) {
+        cbor_int(s, LABEL_T);
+        cbor_time(s, r->t_ms);
+    }
+}
+
+static void encode_json(senml_t *s, const senml_record_t *r)
+{
+    bool first = true;
+
+    if (s->records) {
+        put_byte(s, ',');
+    }
+
+    put_byte(s, '{');
+
+    if (r->bn) {
+        json_text(s, "bn", r->bn, first);
+        first = false;
+    }
+
+    if (r->base) {
+        json_time(s, "bt", r->bt_ms, first);
+        first = false;
+    }
+
+    if (r->bu) {
+        json_text(s, "bu", r->bu, first);
+        first = false;
+    }
+
+    if (r->base) {
+        json_int(s, "bv", r->bv, first);
+        first = false;
+    }
+
+    if (r->n) {
+        json_text(s, "n", r->n, first);
+        first = false;
+    }
+
+    json_int(s, "v", r->v, first);
+
+    if (r->t_ms) {
+        json_time(s, "t", r->t_ms, false);
+    }
+
+    put_byte(s, '}');
+}
+
+int senml_start(senml_t *s, coap_writer_t *w, senml_format_t fmt)
+{
+    memset(s, 0, sizeof(*s));
+    s->w = w;
+    s->fmt = fmt;
+
+    /* the end of the pack is always one byte, keep room for it */
+    if ((s->buf = writer_payload(w, &s->room)) == NULL || s->room < 2) {
+        return -1;
+    }
+
+    s->room--;
+    put_byte(s, (fmt == SENML_CBOR) ? CBOR_ARRAY_INDEF : '[');
+    return 0;
+}
+
+int senml_record(senml_t *s, const senml_record_t *r)
+{
+    size_t len = s->len;
+
+    if (!s->buf) {
+        return -1;
+    }
+
+    s->full = false;
+
+    if (s->fmt == SENML_CBOR) {
+        encode_cbor(s, r);
+    }
+    else {
+        encode_json(s, r);
+    }
+
+    if (s->full) {
+        s->len = len;
+        return -1;
+    }
+
+    s->records++;
+    return 0;
+}
+
+unsigned senml_samples(senml_t *s, const char *name, const char *unit,
+                       const sampler_sample_t *samples, unsigned n, uint32_t now_ms)
+{
+    senml_record_t r;
+    unsigned i;
+
+    for (i = 0; i < n; i++) {
+        memset(&r, 0, sizeof(r));
+
+        if (i == 0) {
+            r.bn = name;
+            r.bu = unit;
+            r.base = true;
+            r.bv = samples[0].value;
+            r.bt_ms = -(int32_t)(now_ms - samples[0].time_ms);
+        }
+
+        r.v = samples[i].value - samples[0].value;
+        r.t_ms = (int32_t)(samples[i].time_ms - samples[0].time_ms);
+
+        if (senml_record(s, &r) < 0) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+size_t senml_finish(senml_t *s)
+{
+    if (!s->buf) {
+        return 0;
+    }
+
+    /* always fits, senml_start() kept room for it */
+    s->buf[s->len++] = (s->fmt == SENML_CBOR) ? CBOR_BREAK : ']';
+    writer_commit(s->w, s->len);
+    return s->len;
+}
+
+#ifdef SENML_BENCH
+#include "hwtimer.h"
+
+#include "server.h"
+
+#define BENCH_ITERATIONS    (100U)
+#define BENCH_WINDOW_MAX    (64U)
+#define BENCH_BUFSZ         (2048U)
+
+/* GETs of /sensors/light and /senml with a two byte token */
+#define SINGLE_REQ_LEN      (4 + 2 + 1 + 7 + 1 + 5)
+#define PACK_REQ_LEN        (4 + 2 + 1 + 5)
+
+static sampler_sample_t bench_samples[BENCH_WINDOW_MAX];
+static uint8_t bench_buf[BENCH_BUFSZ];
+
+static void bench_request(coap_packet_t *pkt)
+{
+    static const uint8_t tok[] = {0xbe, 0xef};
+
+    memset(pkt, 0, sizeof(*pkt));
+    pkt->hdr.t = COAP_TYPE_CON;
+    pkt->hdr.code = COAP_METHOD_GET;
+    pkt->hdr.tkl = sizeof(tok);
+    pkt->tok.p = tok;
+    pkt->tok.len = sizeof(tok);
+}
+
+/* What /sensors/light sends for each sample */
+static int bench_single(const coap_packet_t *pkt, const sampler_sample_t *sample)
+{
+    coap_writer_t w;
+    size_t room;
+    uint8_t *payload;
+    int len;
+
+    writer_init(&w, bench_buf, BUFSZ, pkt);
+    writer_option_uint(&w, COAP_OPTION_CONTENT_FORMAT, COAP_CONTENTTYPE_TEXT_PLAIN);
+    writer_option_uint(&w, COAP_OPTION_MAX_AGE, 1);
+
+    if ((payload = writer_payload(&w, &room)) == NULL ||
+        (len = snprintf((char *)payload, room, "%ld %s", (long)sample->value, "lx")) >= (int)room) {
+        return -1;
+    }
+
+    writer_commit(&w, len);
+    return writer_finish(&w);
+}
+
+/* All of the window in one response of @p size bytes at most */
+static int bench_pack(const coap_packet_t *pkt, senml_format_t fmt, size_t size,
+                      unsigned window, unsigned *packed)
+{
+    coap_writer_t w;
+    senml_t s;
+
+    writer_init(&w, bench_buf, size, pkt);
+    writer_option_uint(&w, COAP_OPTION_CONTENT_FORMAT,
+                       (fmt == SENML_CBOR) ? SENML_CONTENTTYPE_CBOR : SENML_CONTENTTYPE_JSON);
+
+    if (senml_start(&s, &w, fmt) < 0) {
+        return -1;
+    }
+
+    *packed = senml_samples(&s, "light", "lx", bench_samples, window,
+                            bench_samples[0].time_ms + 500);
+    senml_finish(&s);
+    return writer_finish(&w);
+}
+
+static void bench_print(const char *name, uint32_t bytes, uint32_t ticks,
+                        unsigned window, unsigned fit)
+{
+    printf("%-14s %9lu %9lu %9u\n", name, (unsigned long)(bytes / window),
+           (unsigned long)((uint64_t)HWTIMER_TICKS_TO_US(ticks) * 1000
+                           / (BENCH_ITERATIONS * window)), fit);
+}
+
+void senml_bench(unsigned window)
+{
+    static const senml_format_t fmts[] = {SENML_JSON, SENML_CBOR};
+    static const char *names[] = {"senml+json", "senml+cbor"};
+    coap_packet_t pkt;
+    uint32_t start, ticks, bytes = 0;
+    unsigned packed;
+    int len;
+
+    if (window == 0 || window > BENCH_WINDOW_MAX) {
+        window = BENCH_WINDOW_MAX;
+    }
+
+    /* one sample a second, newest first, like sampler_history() */
+    for (unsigned i = 0; i < window; i++) {
+        bench_samples[i].value = 300 + (i * 7) % 23;
+        bench_samples[i].time_ms = 100000 - i * 1000;
+    }
+
+    bench_request(&pkt);
+    printf("senml_bench: %u readings of light\n", window);
+    printf("%-14s %9s %9s %9s\n", "", "bytes/rd", "ns/rd", "fit");
+
+    /* one exchange per reading, every one fits in a datagram */
+    start = hwtimer_now();
+
+    for (unsigned n = 0; n < BENCH_ITERATIONS; n++) {
+        for (unsigned i = 0; i < window; i++) {
+            if ((len = bench_single(&pkt, &bench_samples[i])) < 0) {
+                printf("senml_bench: response didn't fit\n");
+                return;
+            }
+
+            if (n == 0) {
+                bytes += SINGLE_REQ_LEN + len;
+            }
+        }
+    }
+
+    bench_print("text/plain", bytes, hwtimer_now() - start, window, 1);
+
+    for (unsigned f = 0; f < sizeof(fmts) / sizeof(fmts[0]); f++) {
+        start = hwtimer_now();
+
+        for (unsigned n = 0; n < BENCH_ITERATIONS; n++) {
+            len = bench_pack(&pkt, fmts[f], sizeof(bench_buf), window, &packed);
+        }
+
+        ticks = hwtimer_now() - start;
+
+        if (len < 0 || packed < window) {
+            printf("senml_bench: pack didn't fit\n");
+            return;
+        }
+
+        /* how many of them a single datagram of the server holds */
+        bytes = PACK_REQ_LEN + len;
+        bench_pack(&pkt, fmts[f], BUFSZ, window, &packed);
+        bench_print(names[f], bytes, ticks, window, packed);
+    }
+}
+#endif /* SENML_BENCH */
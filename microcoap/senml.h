@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2015 HAW Hamburg
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @{
+ *
+ * @file
+ * @brief       Streaming SenML encoder writing into the response
+ *
+ * Encodes a SenML pack as JSON or CBOR record by record, directly into the
+ * payload of a coap_writer_t. A record that doesn't fit anymore is rolled
+ * back, so a handler can add records until senml_record() fails and still
+ * send a complete pack.
+ *
+ * Base fields (bn, bu, bv, bt) apply to every following record until a
+ * record sets them again. Times are given in milliseconds and encoded in
+ * seconds, relative to now when negative.
+ *
+ * @}
+ */
+
+#ifndef SENML_H
+#define SENML_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sampler.h"
+#include "writer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief   Content-Formats of SenML
+ */
+#define SENML_CONTENTTYPE_JSON  (110)
+#define SENML_CONTENTTYPE_CBOR  (112)
+
+typedef enum {
+    SENML_JSON,
+    SENML_CBOR
+} senml_format_t;
+
+/**
+ * @brief   A record, fields set to NULL or 0 are left out, v is always
+ *          there
+ */
+typedef struct {
+    const char *bn;             /**< base name */
+    const char *bu;             /**< base unit */
+    bool base;                  /**< bv and bt are set */
+    int32_t bv;                 /**< base value */
+    int32_t bt_ms;              /**< base time */
+    const char *n;              /**< name, appended to the base name */
+    int32_t v;                  /**< value, added to the base value */
+    int32_t t_ms;               /**< time, added to the base time */
+} senml_record_t;
+
+/**
+ * @brief   A pack under construction
+ */
+typedef struct {
+    coap_writer_t *w;
+    uint8_t *buf;               /**< payload of w */
+    size_t room;                /**< room in buf, less the end of the pack */
+    size_t len;                 /**< bytes encoded */
+    senml_format_t fmt;
+    unsigned records;
+    bool full;                  /**< the last record didn't fit */
+} senml_t;
+
+/**
+ * @brief   Starts a pack in the payload of @p w
+ *
+ * @return  0 on success
+ * @return  -1 if there is no room for an empty pack
+ */
+int senml_start(senml_t *s, coap_writer_t *w, senml_format_t fmt);
+
+/**
+ * @brief   Appends @p r to the pack
+ *
+ * @return  0 on success
+ * @return  -1 if it didn't fit, the pack is left as it was
+ */
+int senml_record(senml_t *s, const senml_record_t *r);
+
+/**
+ * @brief   Appends up to @p n samples, newest first, as records of
+ *          @p name in @p unit
+ *
+ *          The first record sets the base name, unit, value and time, the
+ *          following ones only carry the difference to it. Times are
+ *          relative to @p now_ms.
+ *
+ * @return  number of samples appended before the pack was full
+ */
+unsigned senml_samples(senml_t *s, const char *name, const char *unit,
+                       const sampler_sample_t *samples, unsigned n, uint32_t now_ms);
+
+/**
+ * @brief   Ends the pack and commits it to the writer
+ *
+ * @return  length of the pack
+ */
+size_t senml_finish(senml_t *s);
+
+/**
+ * @brief   Prints payload bytes and encode time per reading of a window of
+ *          @p window readings, packed in one response and sent one per
+ *          response
+ *
+ *          Only available with SENML_BENCH defined.
+ */
+void senml_bench(unsigned window);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SENML_H */
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2015 HAW Hamburg
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @{
+ *
+ * @file
+ * @brief       Sensors sampled by the sampler thread
+ *
+ * The application only builds for native (see BOARD_WHITELIST), so
+ * simulated sensors stand in for the light, pressure and temperature
+ * sensors and the gyroscope of e.g. iot-lab_M3. They take
+ * SENSORS_SIM_LATENCY_US to read.
+ *
+ * @}
+ */
+
+#include <stdint.h>
+
+#include "vtimer.h"
+
+#include "sampler.h"
+
+/**
+ * @brief   Time it takes to read a simulated sensor, like a slow I2C
+ *          transfer or a conversion
+ */
+#ifndef SENSORS_SIM_LATENCY_US
+#define SENSORS_SIM_LATENCY_US  (50000U)
+#endif
+
+typedef struct {
+    int32_t base;
+    int32_t amplitude;
+    uint32_t latency_us;
+    uint32_t n;
+} sim_t;
+
+static sim_t sim_light = {300, 50, SENSORS_SIM_LATENCY_US, 0};
+static sim_t sim_pressure = {1013, 3, SENSORS_SIM_LATENCY_US, 0};
+static sim_t sim_temperature = {21500, 500, SENSORS_SIM_LATENCY_US, 0};
+static sim_t sim_gyro = {0, 250, SENSORS_SIM_LATENCY_US, 0};
+
+/* A triangle wave around base, one period every 64 samples */
+static int read_sim(void *arg, int32_t *value)
+{
+    sim_t *sim = (sim_t *)arg;
+    int32_t step = sim->n++ % 64;
+
+    vtimer_usleep(sim->latency_us);
+
+    step = (step < 32) ? step : 64 - step;
+    *value = sim->base - sim->amplitude + (2 * sim->amplitude * step) / 32;
+    return 0;
+}
+
+const sampler_sensor_t sensors[] = {
+    {"light", "lx", read_sim, &sim_light, 1000},
+    {"pressure", "mbar", read_sim, &sim_pressure, 5000},
+    {"temperature", "mC", read_sim, &sim_temperature, 5000},
+    {"gyro", "dps", read_sim, &sim_gyro, 100},
+    {NULL, NULL, NULL, NULL, 0}
+};
+
+int sensors_init(void)
+{
+    return 0;
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2015 HAW Hamburg
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @{
+ *
+ * @file
+ * @brief       Interface between the microcoap server and its transports
+ *
+ * main.c parses requests and builds responses. The transport receives
+ * datagrams and sends the responses: socket.c over the socket API of the
+ * old stack, ng.c over netapi and the packet buffer of the ng stack. The
+ * Makefile picks one of them with STACK.
+ *
+ * @}
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "budget.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PORT 5683
+
+#if MICROCOAP_BUDGET
+#define BUFSZ BUDGET_BUFSZ
+#define MICROCOAP_STACKSIZE BUDGET_STACKSIZE
+#else
+#define BUFSZ 128
+#define MICROCOAP_STACKSIZE KERNEL_CONF_STACKSIZE_MAIN
+#endif
+
+/* Set to 0 to stop dumping every message, which takes much longer than
+ * handling it */
+#ifndef MICROCOAP_DUMP
+#define MICROCOAP_DUMP      (1)
+#endif
+
+/* Print the counters every that many handled requests */
+#ifndef MICROCOAP_STATS_EVERY
+#define MICROCOAP_STATS_EVERY (100)
+#endif
+
+typedef struct {
+    uint32_t received;
+    uint32_t handled;
+    uint32_t dropped;           /* no room for the request or response */
+    uint32_t bad;
+    uint32_t start;
+    uint32_t copied;            /* bytes copied per request and response */
+    uint32_t build_ticks;       /* spent between parsing and sending */
+    uint32_t busy_ticks;        /* spent from receiving to sending */
+} server_stats_t;
+
+extern server_stats_t server_stats;
+
+/**
+ * @brief   Counts a received datagram, called by the transport
+ */
+void server_received(void);
+
+/**
+ * @brief   Handles the request in @p req, writing the response into @p rsp
+ *
+ * @return  length of the response
+ * @return  -1 if there is none to send
+ */
+int server_handle(const uint8_t *req, size_t n, uint8_t *rsp, size_t rsp_size);
+
+/**
+ * @brief   Starts the transport's threads
+ *
+ * @return  0 on success
+ */
+int server_transport_init(void);
+
+/**
+ * @brief   Bytes of RAM the transport reserves statically
+ */
+size_t server_transport_ram(void);
+
+/**
+ * @brief   Prints the bytes of @p polls GETs of /value and their responses
+ *          with and without ETags, while /value changes on @p change_pct
+ *          percent of the polls
+ *
+ *          Only available with POLL_BENCH defined.
+ */
+void poll_bench(unsigned polls, unsigned change_pct);
+
+/**
+ * @brief   Prints the time per coap_parse() and coap_build() by option count
+ *          and payload size, then round-trips mutated requests
+ *
+ *          Only available with PARSE_BENCH defined.
+ */
+void parse_bench(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SERVER_H */
@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) 2015 HAW Hamburg
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @{
+ *
+ * @file
+ * @brief       microcoap example server over the socket API (STACK=socket)
+ *
+ * @author      Lotte Steenbrink <lotte.steenbrink@haw-hamburg.de>
+ *
+ * @}
+ */
+
+#ifdef MODULE_UDP
+
+#include <stdio.h>
+
+#include "udp.h"
+#include "net_help.h"
+#include "net_if.h"
+#include "periph/cpuid.h"
+#include "board_uart0.h"
+#include "thread.h"
+#include "posix_io.h"
+#include "hashes.h"
+#include "hwtimer.h"
+
+#include "server.h"
+
+#define ENABLE_DEBUG    (1)
+#include "debug.h"
+
+#if MICROCOAP_BUDGET
+#define RCV_MSG_Q_SIZE      (BUDGET_QUEUE)
+#else
+#define RCV_MSG_Q_SIZE      (64)
+#endif
+
+/* Number of request buffers, a power of 2; with 1 the server receives,
+ * handles and sends in one loop */
+#ifndef MICROCOAP_SLOTS
+#define MICROCOAP_SLOTS     (4)
+#endif
+
+#if MICROCOAP_BUDGET && MICROCOAP_SLOTS > BUDGET_QUEUE
+#error "the handler's queue on its stack takes MICROCOAP_SLOTS messages, more than BUDGET_QUEUE"
+#endif
+
+static void *_microcoap_server_thread(void *arg);
+
+msg_t msg_q[RCV_MSG_Q_SIZE];
+char _rcv_stack_buf[MICROCOAP_STACKSIZE];
+
+static ipv6_addr_t prefix;
+int sock_rcv, if_id;
+sockaddr6_t sa_rcv;
+uint8_t buf[BUFSZ];
+/* writer handlers may still read the request while writing the response */
+static uint8_t rsp_buf[BUFSZ];
+
+#if MICROCOAP_SLOTS > 1
+/* A received request and whom to answer */
+typedef struct {
+    sockaddr6_t peer;
+    int len;
+    uint8_t buf[BUFSZ];
+} slot_t;
+
+static slot_t slots[MICROCOAP_SLOTS];
+/* written by the receiving thread only */
+static volatile unsigned slots_head;
+/* written by the handling thread only */
+static volatile unsigned slots_tail;
+static uint8_t drop_buf[BUFSZ];
+static sockaddr6_t drop_peer;
+static msg_t rcv_msg_q[RCV_MSG_Q_SIZE];
+static char _handler_stack_buf[MICROCOAP_STACKSIZE];
+static kernel_pid_t handler_pid;
+
+static void *_microcoap_handler_thread(void *arg);
+#endif
+
+static void _init_tlayer(void);
+static uint16_t get_hw_addr(void);
+
+int server_transport_init(void)
+{
+    _init_tlayer();
+#if MICROCOAP_SLOTS > 1
+    handler_pid = thread_create(_handler_stack_buf, MICROCOAP_STACKSIZE, PRIORITY_MAIN, CREATE_STACKTEST, _microcoap_handler_thread, NULL, "_microcoap_handler_thread");
+    thread_create(_rcv_stack_buf, MICROCOAP_STACKSIZE, PRIORITY_MAIN - 1, CREATE_STACKTEST, _microcoap_server_thread, NULL ,"_microcoap_server_thread");
+#else
+    thread_create(_rcv_stack_buf, MICROCOAP_STACKSIZE, PRIORITY_MAIN, CREATE_STACKTEST, _microcoap_server_thread, NULL ,"_microcoap_server_thread");
+#endif
+    return 0;
+}
+
+size_t server_transport_ram(void)
+{
+    size_t ram = sizeof(msg_q) + sizeof(_rcv_stack_buf) + sizeof(buf) + sizeof(rsp_buf);
+
+#if MICROCOAP_SLOTS > 1
+    ram += sizeof(slots) + sizeof(drop_buf) + sizeof(rcv_msg_q) + sizeof(_handler_stack_buf);
+#endif
+    return ram;
+}
+
+static uint16_t get_hw_addr(void)
+{
+    return sysconfig.id;
+}
+
+/* init transport layer & routing stuff*/
+static void _init_tlayer(void)
+{
+    msg_init_queue(msg_q, RCV_MSG_Q_SIZE);
+
+    net_if_set_hardware_address(0, get_hw_addr());
+    DEBUG("set hawddr to: %d\n", get_hw_addr());
+
+    printf("initializing 6LoWPAN...\n");
+
+    ipv6_addr_init(&prefix, 0xABCD, 0xEF12, 0, 0, 0, 0, 0, 0);
+    if_id = 0; /* having more than one interface isn't supported anyway */
+
+    sixlowpan_lowpan_init_interface(if_id);
+}
+
+static int _bind(void)
+{
+    printf("initializing receive socket...\n");
+
+    sa_rcv = (sockaddr6_t) { .sin6_family = AF_INET6,
+               .sin6_port = HTONS(PORT) };
+
+    sock_rcv = socket_base_socket(PF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+
+    if (-1 == socket_base_bind(sock_rcv, &sa_rcv, sizeof(sa_rcv))) {
+        printf("Error: bind to receive socket failed!\n");
+        socket_base_close(sock_rcv);
+        return -1;
+    }
+
+    printf("Ready to receive requests.\n");
+    return 0;
+}
+
+/* Handles the request in @p req and sends the response to @p peer */
+static void _handle(uint8_t *req, int n, sockaddr6_t *peer, uint32_t start)
+{
+    int rsplen = server_handle(req, n, rsp_buf, sizeof(rsp_buf));
+
+    if (rsplen >= 0) {
+        socket_base_sendto(sock_rcv, rsp_buf, rsplen, 0, peer, sizeof(*peer));
+        /* recvfrom copied the request out of the stack, sendto the
+         * response into it */
+        server_stats.copied += n + rsplen;
+    }
+
+    server_stats.busy_ticks += hwtimer_now() - start;
+}
+
+#if MICROCOAP_SLOTS > 1
+/* Receives into the next free slot while the handler thread is busy with
+ * the previous ones. Runs with a higher priority, so bursts end up in the
+ * ring instead of being dropped below the socket. */
+static void *_microcoap_server_thread(void *arg)
+{
+    (void)arg; /* make the compiler shut up about unused variables */
+
+    msg_init_queue(rcv_msg_q, RCV_MSG_Q_SIZE);
+
+    if (_bind() < 0) {
+        return NULL;
+    }
+
+    while(1)
+    {
+        socklen_t len = sizeof(sockaddr6_t);
+
+        if (slots_head - slots_tail == MICROCOAP_SLOTS) {
+            /* all slots taken, read the datagram to drop it */
+            socket_base_recvfrom(sock_rcv, drop_buf, sizeof(drop_buf), 0, &drop_peer, &len);
+            server_received();
+            server_stats.dropped++;
+            continue;
+        }
+
+        slot_t *slot = &slots[slots_head % MICROCOAP_SLOTS];
+        slot->len = socket_base_recvfrom(sock_rcv, slot->buf, sizeof(slot->buf), 0,
+                                         &slot->peer, &len);
+
+        if (slot->len <= 0) {
+            continue;
+        }
+
+        server_received();
+        slots_head++;
+
+        msg_t m;
+        m.type = 0;
+        msg_try_send(&m, handler_pid);
+    }
+
+    return NULL;
+}
+
+/* Parses, handles and answers the requests in order of arrival */
+static void *_microcoap_handler_thread(void *arg)
+{
+    (void)arg;
+    msg_t m, q[MICROCOAP_SLOTS];
+
+    msg_init_queue(q, MICROCOAP_SLOTS);
+
+    while (1) {
+        msg_receive(&m);
+
+        /* a wakeup may have been lost while the queue was full */
+        while (slots_tail != slots_head) {
+            slot_t *slot = &slots[slots_tail % MICROCOAP_SLOTS];
+            _handle(slot->buf, slot->len, &slot->peer, hwtimer_now());
+            slots_tail++;
+        }
+    }
+
+    return NULL;
+}
+#else
+/* The single-buffer loop: the next datagram is only read once the
+ * response to the current one is sent */
+static void *_microcoap_server_thread(void *arg)
+{
+    (void)arg; /* make the compiler shut up about unused variables */
+
+    if (_bind() < 0) {
+        return NULL;
+    }
+
+    while(1)
+    {
+        int n;
+        socklen_t len = sizeof(sa_rcv);
+
+        n = socket_base_recvfrom(sock_rcv, buf, sizeof(buf), 0, &sa_rcv, &len);
+
+        if (n <= 0) {
+            continue;
+        }
+
+        server_received();
+        _handle(buf, n, &sa_rcv, hwtimer_now());
+    }
+
+    return NULL;
+}
+#endif
+
+#endif /* MODULE_UDP */
@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2015 HAW Hamburg
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @{
+ *
+ * @file
+ * @brief       Writes responses straight into the outgoing datagram
+ *
+ * @}
+ */
+
+#include <string.h>
+
+#include "writer.h"
+
+#define ENABLE_DEBUG    (0)
+#include "debug.h"
+
+#define HEADER_LEN      (4)
+#define PAYLOAD_MARKER  (0xff)
+
+void writer_init(coap_writer_t *w, uint8_t *buf, size_t size, const coap_packet_t *inpkt)
+{
+    uint8_t type = (inpkt->hdr.t == COAP_TYPE_CON) ? COAP_TYPE_ACK : COAP_TYPE_NONCON;
+
+    memset(w, 0, sizeof(*w));
+    w->buf = buf;
+    w->size = size;
+    w->code = COAP_RSPCODE_CONTENT;
+
+    if (size < HEADER_LEN + inpkt->tok.len) {
+        w->failed = true;
+        return;
+    }
+
+    buf[0] = (1 << 6) | (type << 4) | inpkt->tok.len;
+    buf[2] = inpkt->hdr.id[0];
+    buf[3] = inpkt->hdr.id[1];
+    memmove(buf + HEADER_LEN, inpkt->tok.p, inpkt->tok.len);
+    w->pos = HEADER_LEN + inpkt->tok.len;
+    w->copied = inpkt->tok.len;
+}
+
+/* Bytes following the first for an option delta or length of @p v */
+static size_t ext_len(unsigned v)
+{
+    return (v < 13) ? 0 : (v < 269) ? 1 : 2;
+}
+
+static uint8_t nibble(unsigned v)
+{
+    return (v < 13) ? v : (v < 269) ? 13 : 14;
+}
+
+static uint8_t *put_ext(uint8_t *p, unsigned v)
+{
+    if (v >= 269) {
+        *p++ = (v - 269) >> 8;
+        *p++ = (v - 269) & 0xff;
+    }
+    else if (v >= 13) {
+        *p++ = v - 13;
+    }
+
+    return p;
+}
+
+/* Writes delta and length of an option, returns where its value goes */
+static uint8_t *option_head(coap_writer_t *w, uint16_t num, size_t len)
+{
+    unsigned delta = num - w->last_opt;
+    uint8_t *p;
+
+    if (w->failed || w->payload || num < w->last_opt ||
+        w->pos + 1 + ext_len(delta) + ext_len(len) + len > w->size) {
+        w->failed = true;
+        return NULL;
+    }
+
+    p = w->buf + w->pos;
+    *p++ = (nibble(delta) << 4) | nibble(len);
+    p = put_ext(p, delta);
+    p = put_ext(p, len);
+
+    w->last_opt = num;
+    w->pos = (p - w->buf) + len;
+    return p;
+}
+
+void writer_option(coap_writer_t *w, uint16_t num, const void *value, size_t len)
+{
+    uint8_t *p = option_head(w, num, len);
+
+    if (p) {
+        memcpy(p, value, len);
+        w->copied += len;
+    }
+}
+
+void writer_option_uint(coap_writer_t *w, uint16_t num, uint32_t value)
+{
+    size_t len = (value > 0xffffff) ? 4 : (value > 0xffff) ? 3 : (value > 0xff) ? 2 :
+                 (value > 0) ? 1 : 0;
+    uint8_t *p = option_head(w, num, len);
+
+    if (p) {
+        while (len--) {
+            *p++ = value >> (8 * len);
+        }
+    }
+}
+
+uint8_t *writer_payload(coap_writer_t *w, size_t *room)
+{
+    size_t start = w->pos + (w->payload ? 0 : 1);
+
+    if (w->failed || start >= w->size) {
+        *room = 0;
+        return NULL;
+    }
+
+    *room = w->size - start;
+    return w->buf + start;
+}
+
+void writer_commit(coap_writer_t *w, size_t len)
+{
+    size_t room;
+
+    if (len == 0) {
+        return;
+    }
+
+    if (!writer_payload(w, &room) || len > room) {
+        w->failed = true;
+        return;
+    }
+
+    if (!w->payload) {
+        w->buf[w->pos++] = PAYLOAD_MARKER;
+        w->payload = true;
+    }
+
+    w->pos += len;
+}
+
+void writer_append(coap_writer_t *w, const void *data, size_t len)
+{
+    size_t room;
+    uint8_t *p = writer_payload(w, &room);
+
+    if (len == 0) {
+        return;
+    }
+
+    if (!p || len > room) {
+        w->failed = true;
+        return;
+    }
+
+    memcpy(p, data, len);
+    w->copied += len;
+    writer_commit(w, len);
+}
+
+int writer_finish(coap_writer_t *w)
+{
+    if (w->failed) {
+        DEBUG("writer: response doesn't fit into %u bytes\n", (unsigned)w->size);
+        return -1;
+    }
+
+    w->buf[1] = w->code;
+    return w->pos;
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2015 HAW Hamburg
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @{
+ *
+ * @file
+ * @brief       Writes responses straight into the outgoing datagram
+ *
+ * With coap_make_response() a handler fills a buffer of its own, whose
+ * pointer coap_build() then copies into the datagram together with
+ * header and options. A writer handler instead appends options and payload
+ * to the datagram buffer itself. Header and token are placed by
+ * writer_init(), the code and type are patched in by writer_finish().
+ * Every call checks the remaining room; once something didn't fit, the
+ * writer stays failed and writer_finish() reports it.
+ *
+ * @}
+ */
+
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "coap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief   A response under construction
+ */
+typedef struct {
+    uint8_t *buf;               /**< the datagram */
+    size_t size;                /**< size of buf */
+    size_t pos;                 /**< bytes written */
+    uint16_t last_opt;          /**< number of the last option written */
+    uint8_t code;               /**< response code, 2.05 by default */
+    bool payload;               /**< payload marker written */
+    bool failed;                /**< something didn't fit */
+    size_t copied;              /**< bytes copied from other buffers */
+} coap_writer_t;
+
+/**
+ * @brief   A handler writing its response with @p w
+ *
+ * @return  0 on success
+ */
+typedef int (*writer_func_t)(coap_writer_t *w, const coap_packet_t *inpkt);
+
+/**
+ * @brief   Current version of the resource @p inpkt addresses, changes
+ *          whenever the resource does
+ *
+ * @return  0 if the resource doesn't exist
+ */
+typedef uint32_t (*writer_version_t)(const coap_packet_t *inpkt);
+
+/**
+ * @brief   Like coap_endpoint_t, with a writer handler
+ *
+ *          With a version callback, GET responses carry the version as
+ *          ETag, and requests for a version the client has are answered
+ *          with 2.03 Valid without running the handler. PUTs with
+ *          If-None-Match fail with 4.12 while the version is not 0.
+ */
+typedef struct {
+    coap_method_t method;
+    writer_func_t handler;
+    const coap_endpoint_path_t *path;
+    const char *core_attr;
+    writer_version_t version;   /**< optional */
+} writer_endpoint_t;
+
+/**
+ * @brief   Starts the response to @p inpkt in @p buf
+ *
+ *          Reserves the header and copies the token.
+ */
+void writer_init(coap_writer_t *w, uint8_t *buf, size_t size, const coap_packet_t *inpkt);
+
+/**
+ * @brief   Sets the response code
+ */
+static inline void writer_code(coap_writer_t *w, uint8_t code)
+{
+    w->code = code;
+}
+
+/**
+ * @brief   Appends option @p num, in ascending order of numbers
+ */
+void writer_option(coap_writer_t *w, uint16_t num, const void *value, size_t len);
+
+/**
+ * @brief   Appends option @p num with the shortest encoding of @p value
+ */
+void writer_option_uint(coap_writer_t *w, uint16_t num, uint32_t value);
+
+/**
+ * @brief   Room for payload after the payload marker
+ *
+ *          Write up to @p room bytes there and commit them with
+ *          writer_commit().
+ *
+ * @return  NULL if not even the marker and one byte fit
+ */
+uint8_t *writer_payload(coap_writer_t *w, size_t *room);
+
+/**
+ * @brief   Commits @p len bytes written to writer_payload()
+ */
+void writer_commit(coap_writer_t *w, size_t len);
+
+/**
+ * @brief   Copies @p len bytes of payload from @p data
+ */
+void writer_append(coap_writer_t *w, const void *data, size_t len);
+
+/**
+ * @brief   Patches the header
+ *
+ * @return  length of the datagram
+ * @return  -1 if the response didn't fit
+ */
+int writer_finish(coap_writer_t *w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WRITER_H */
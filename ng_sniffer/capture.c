@@ -0,0 +1,632 @@
+/*
+ * Copyright (C) 2015 Freie Universität Berlin
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     app_sniffer
+ * @{
+ *
+ * @file
+ * @brief       Capture ring and output thread of the sniffer
+ *
+ * @}
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "thread.h"
+#include "msg.h"
+#include "irq.h"
+#include "hwtimer.h"
+#include "net/ng_netbase.h"
+#include "net/ng_netif/hdr.h"
+
+#include "capture.h"
+
+/**
+ * @brief   Keeps the compiler from moving accesses across index updates
+ */
+#define BARRIER()               __asm__ volatile ("" ::: "memory")
+
+/**
+ * @brief   Message type waking up the output thread
+ */
+#define CAPTURE_MSG_WAKEUP      (0x5301)
+
+/**
+ * @brief   Pending wake ups, one is enough to drain the ring
+ */
+#define CAPTURE_MSG_QUEUE       (2U)
+
+/**
+ * @brief   SLIP special characters (RFC 1055)
+ */
+#define SLIP_END                (0xc0)
+#define SLIP_ESC                (0xdb)
+#define SLIP_ESC_END            (0xdc)
+#define SLIP_ESC_ESC            (0xdd)
+
+/**
+ * @brief   pcap file and record headers
+ */
+typedef struct {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t network;
+} pcap_hdr_t;
+
+typedef struct {
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+} pcap_rec_t;
+
+/**
+ * @brief   TAP header with FCS type, RSS and LQI TLVs, little endian
+ */
+#if CAPTURE_LINKTYPE == CAPTURE_LINKTYPE_TAP
+#define TAP_LEN                 (4U + 3 * 8U)
+#define TAP_TLV_FCS_TYPE        (0U)
+#define TAP_TLV_RSS             (1U)
+#define TAP_TLV_LQI             (10U)
+#else
+#define TAP_LEN                 (0U)
+#endif
+
+/**
+ * @brief   A frame in the ring
+ */
+typedef struct {
+    ng_pktsnip_t *pkt;          /**< received frame, with netif header */
+    uint32_t rx_time;           /**< hwtimer ticks at reception */
+    uint16_t len;               /**< length on air */
+    uint16_t size;              /**< bytes of pktbuf it holds */
+} capture_frame_t;
+
+/**
+ * @brief   Buckets of the latency histogram, bucket n counts latencies
+ *          below 2^n microseconds, the last one everything above
+ */
+#define LATENCY_BUCKETS         (20U)
+
+/**
+ * @brief   Time from reception to output, written by the output thread
+ *          and read by the shell without locking
+ */
+static struct {
+    uint32_t count;
+    uint64_t sum_us;
+    uint32_t max_us;
+    uint32_t hist[LATENCY_BUCKETS];
+} latency;
+
+static capture_frame_t ring[CAPTURE_SLOTS];
+
+/*
+ * Positions in the ring count up and wrap around, a frame at position p is
+ * in ring[p % CAPTURE_SLOTS]. The rawdump thread puts frames at head, the
+ * output thread takes them from tail. rawdump has the higher priority, so
+ * capture_put() always runs to completion before the output thread sees
+ * any of its changes. The output thread takes a frame with interrupts
+ * disabled, so rawdump can't drop it in between.
+ */
+
+/* written by the producer only */
+static volatile unsigned head;
+/* bytes of the frames put into the ring and dropped from it */
+static volatile uint32_t held_in, held_dropped;
+/* written by the output thread only */
+static volatile unsigned tail;
+/* bytes of the frames released after output */
+static volatile uint32_t held_out;
+
+static volatile capture_policy_t policy = CAPTURE_POLICY;
+static volatile unsigned snaplen = CAPTURE_FRAME_MAX;
+
+/* counters, each written by one thread only */
+static volatile capture_stats_t stats;
+
+/**
+ * @brief   LQI and RSSI of @p f, 0 if it came without netif header
+ */
+static void frame_link(const capture_frame_t *f, uint8_t *lqi, int8_t *rssi)
+{
+    *lqi = 0;
+    *rssi = 0;
+
+    for (ng_pktsnip_t *snip = f->pkt; snip; snip = snip->next) {
+        if (snip->type == NG_NETTYPE_NETIF) {
+            ng_netif_hdr_t *hdr = snip->data;
+
+            *lqi = hdr->lqi;
+            *rssi = (int8_t)hdr->rssi;
+            return;
+        }
+    }
+}
+
+/**
+ * @brief   Passes the bytes of @p f to @p write, snip by snip, up to
+ *          @p max of them
+ */
+static void frame_walk(const capture_frame_t *f, size_t max,
+                       void (*write)(const void *, size_t))
+{
+    size_t caplen = 0;
+
+    for (ng_pktsnip_t *snip = f->pkt; snip && caplen < max; snip = snip->next) {
+        size_t n = snip->size;
+
+        if (snip->type == NG_NETTYPE_NETIF) {
+            continue;
+        }
+
+        if (n > max - caplen) {
+            n = max - caplen;
+        }
+
+        write(snip->data, n);
+        caplen += n;
+    }
+}
+
+static kernel_pid_t out_pid = KERNEL_PID_UNDEF;
+static char out_stack[THREAD_STACKSIZE_MAIN];
+
+#ifdef SNIFFER_PCAP
+/**
+ * @brief   Bytes collected for the next fwrite()
+ */
+static uint8_t out_buf[64];
+static size_t out_len;
+
+/**
+ * @brief   Upper bits of the hwtimer ticks since boot, for the pcap time
+ */
+static uint32_t time_hi, time_last;
+
+/**
+ * @brief   Whether the pcap file header is out, the benchmark may write it
+ *          before the output thread runs
+ */
+static uint8_t header_written;
+
+static void out_flush(void)
+{
+    fwrite(out_buf, 1, out_len, stdout);
+    out_len = 0;
+}
+
+static inline void out_byte(uint8_t b)
+{
+    if (out_len == sizeof(out_buf)) {
+        out_flush();
+    }
+
+    out_buf[out_len++] = b;
+}
+
+static void slip_write(const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    for (size_t i = 0; i < len; i++) {
+        switch (p[i]) {
+            case SLIP_END:
+                out_byte(SLIP_ESC);
+                out_byte(SLIP_ESC_END);
+                break;
+            case SLIP_ESC:
+                out_byte(SLIP_ESC);
+                out_byte(SLIP_ESC_ESC);
+                break;
+            default:
+                out_byte(p[i]);
+                break;
+        }
+    }
+}
+
+/**
+ * @brief   SLIP frames start with END as well, so that shell output in
+ *          between ends up in a frame of its own
+ */
+static inline void slip_end(void)
+{
+    out_byte(SLIP_END);
+}
+
+#if CAPTURE_LINKTYPE == CAPTURE_LINKTYPE_TAP
+static void tap_write(uint8_t lqi, int8_t rssi)
+{
+    float rss = rssi;
+    uint8_t tap[TAP_LEN] = {
+        0, 0, TAP_LEN, 0,
+        TAP_TLV_FCS_TYPE, 0, 1, 0, 0, 0, 0, 0,      /* no FCS */
+        TAP_TLV_RSS, 0, 4, 0, 0, 0, 0, 0,           /* dBm as float */
+        TAP_TLV_LQI, 0, 1, 0, lqi, 0, 0, 0,
+    };
+    uint32_t bits;
+
+    memcpy(&bits, &rss, sizeof(bits));
+    tap[16] = bits;
+    tap[17] = bits >> 8;
+    tap[18] = bits >> 16;
+    tap[19] = bits >> 24;
+    slip_write(tap, sizeof(tap));
+}
+#else
+#define tap_write(lqi, rssi)    ((void)(lqi), (void)(rssi))
+#endif
+
+static void emit_header(void)
+{
+    pcap_hdr_t hdr = { 0xa1b2c3d4, 2, 4, 0, 0, TAP_LEN + CAPTURE_FRAME_MAX, CAPTURE_LINKTYPE };
+
+    if (header_written) {
+        return;
+    }
+
+    header_written = 1;
+    slip_end();
+    slip_write(&hdr, sizeof(hdr));
+    slip_end();
+    out_flush();
+    fflush(stdout);
+}
+
+static void emit(const capture_frame_t *f)
+{
+    pcap_rec_t rec;
+    uint64_t ticks, us;
+    unsigned max = snaplen;
+    uint8_t lqi;
+    int8_t rssi;
+
+    /* frames leave the ring in order, so a smaller tick count wrapped
+     * around; extend it before converting, the 32 bit wrap of the ticks
+     * isn't one of the microseconds */
+    if (f->rx_time < time_last) {
+        time_hi++;
+    }
+
+    time_last = f->rx_time;
+    ticks = ((uint64_t)time_hi << 32) | f->rx_time;
+    us = (ticks / HWTIMER_SPEED) * 1000000 +
+         (ticks % HWTIMER_SPEED) * 1000000 / HWTIMER_SPEED;
+    rec.ts_sec = us / 1000000;
+    rec.ts_usec = us % 1000000;
+    rec.incl_len = TAP_LEN + (f->len < max ? f->len : max);
+    rec.orig_len = TAP_LEN + f->len;
+    frame_link(f, &lqi, &rssi);
+    slip_end();
+    slip_write(&rec, sizeof(rec));
+    tap_write(lqi, rssi);
+    frame_walk(f, max, slip_write);
+    slip_end();
+}
+
+static void emit_done(void)
+{
+    out_flush();
+    fflush(stdout);
+}
+#else
+static void emit_header(void)
+{
+}
+
+static void print_bytes(const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    for (size_t i = 0; i < len; i++) {
+        printf("0x%02x ", p[i]);
+    }
+}
+
+/**
+ * @brief   Make a raw dump of the given frame, the way ng_sniffer.py
+ *          expects it
+ */
+static void emit(const capture_frame_t *f)
+{
+    uint8_t lqi;
+    int8_t rssi;
+
+    frame_link(f, &lqi, &rssi);
+    printf("rftest-rx --- len 0x%02x lqi 0x%02x rx_time 0x%08lx\n\n",
+           f->len, lqi, (unsigned long)f->rx_time);
+    frame_walk(f, snaplen, print_bytes);
+    puts("\n");
+}
+
+static void emit_done(void)
+{
+    fflush(stdout);
+}
+#endif
+
+/**
+ * @brief   Drops the oldest frame still in the ring, which is in the slot
+ *          the next one goes to
+ */
+static void drop_oldest(void)
+{
+    capture_frame_t *f = &ring[head % CAPTURE_SLOTS];
+
+    held_dropped += f->size;
+    ng_pktbuf_release(f->pkt);
+    stats.dropped++;
+}
+
+int capture_put(ng_pktsnip_t *pkt, uint32_t rx_time)
+{
+    capture_frame_t *f;
+    unsigned len = 0, size = 0, fill;
+
+    for (ng_pktsnip_t *snip = pkt; snip; snip = snip->next) {
+        size += snip->size;
+
+        if (snip->type != NG_NETTYPE_NETIF) {
+            len += snip->size;
+        }
+    }
+
+    stats.received++;
+
+    /* leave the rest of the packet buffer to the MAC layer */
+    if (held_in - held_dropped - held_out + size > CAPTURE_PKTBUF_BUDGET) {
+        ng_pktbuf_release(pkt);
+        stats.pktbuf_full++;
+        return -1;
+    }
+
+    /* more than CAPTURE_SLOTS if the output thread was lapped */
+    if ((int)(head - tail) >= (int)CAPTURE_SLOTS) {
+        if (policy == CAPTURE_DROP_NEWEST) {
+            ng_pktbuf_release(pkt);
+            stats.dropped++;
+            return -1;
+        }
+
+        drop_oldest();
+    }
+
+    f = &ring[head % CAPTURE_SLOTS];
+    f->pkt = pkt;
+    f->rx_time = rx_time;
+    f->len = len;
+    f->size = size;
+    held_in += size;
+
+    /* the slot is complete before the output thread can see it */
+    BARRIER();
+    head++;
+
+    fill = head - tail;
+
+    if (fill > CAPTURE_SLOTS) {
+        fill = CAPTURE_SLOTS;
+    }
+
+    if (fill > stats.high_water) {
+        stats.high_water = fill;
+    }
+
+    if (out_pid != KERNEL_PID_UNDEF) {
+        msg_t msg;
+
+        msg.type = CAPTURE_MSG_WAKEUP;
+        /* fails if a wake up is pending already, which is fine */
+        msg_try_send(&msg, out_pid);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief   Takes the oldest frame out of the ring into @p f
+ *
+ * rawdump can't run while the slot is copied and tail moved past it, so
+ * the copied frame is still held and from then on the output thread's to
+ * release. Frames rawdump dropped before are skipped.
+ */
+static void take(capture_frame_t *f)
+{
+    unsigned state = disableIRQ();
+    unsigned pos = tail;
+
+    /* the frames rawdump ran over are released and counted already */
+    if ((int)(head - pos) > (int)CAPTURE_SLOTS) {
+        pos = head - CAPTURE_SLOTS;
+    }
+
+    *f = ring[pos % CAPTURE_SLOTS];
+    tail = pos + 1;
+    restoreIRQ(state);
+}
+
+void capture_set_policy(capture_policy_t p)
+{
+    policy = p;
+}
+
+capture_policy_t capture_get_policy(void)
+{
+    return policy;
+}
+
+void capture_set_snaplen(unsigned len)
+{
+    snaplen = (len == 0 || len > CAPTURE_FRAME_MAX) ? CAPTURE_FRAME_MAX : len;
+}
+
+unsigned capture_get_snaplen(void)
+{
+    return snaplen;
+}
+
+void capture_get_stats(capture_stats_t *out)
+{
+    out->received = stats.received;
+    out->written = stats.written;
+    out->dropped = stats.dropped;
+    out->pktbuf_full = stats.pktbuf_full;
+    out->high_water = stats.high_water;
+    out->held = held_in - held_dropped - held_out;
+}
+
+static void count_latency(const capture_frame_t *f)
+{
+    uint32_t us = HWTIMER_TICKS_TO_US(hwtimer_now() - f->rx_time);
+    unsigned bucket = 0;
+
+    while (bucket < LATENCY_BUCKETS - 1 && us >= (1UL << bucket)) {
+        bucket++;
+    }
+
+    latency.count++;
+    latency.sum_us += us;
+    latency.hist[bucket]++;
+
+    if (us > latency.max_us) {
+        latency.max_us = us;
+    }
+}
+
+void capture_print_latency(void)
+{
+    if (latency.count == 0) {
+        puts("no frames captured yet");
+        return;
+    }
+
+    printf("reception to output of %lu frames: avg %lu us, max %lu us\n",
+           (unsigned long)latency.count, (unsigned long)(latency.sum_us / latency.count),
+           (unsigned long)latency.max_us);
+
+    for (unsigned i = 0; i < LATENCY_BUCKETS; i++) {
+        if (latency.hist[i]) {
+            printf("  %s %7lu us: %lu\n", (i < LATENCY_BUCKETS - 1) ? "<" : ">=",
+                   (i < LATENCY_BUCKETS - 1) ? (1UL << i) : (1UL << (i - 1)),
+                   (unsigned long)latency.hist[i]);
+        }
+    }
+}
+
+/**
+ * @brief   Event loop of the output thread
+ *
+ * @param[in] arg   unused parameter
+ */
+static void *capture_output(void *arg)
+{
+    (void)arg;
+    msg_t msg, msg_queue[CAPTURE_MSG_QUEUE];
+
+    msg_init_queue(msg_queue, CAPTURE_MSG_QUEUE);
+    emit_header();
+
+    while (1) {
+        while (tail != head) {
+            capture_frame_t f;
+
+            take(&f);
+            count_latency(&f);
+            emit(&f);
+            ng_pktbuf_release(f.pkt);
+            held_out += f.size;
+            stats.written++;
+        }
+
+        /* only flush when there is time to */
+        emit_done();
+        msg_receive(&msg);
+    }
+
+    /* never reached */
+    return NULL;
+}
+
+kernel_pid_t capture_init(void)
+{
+    out_pid = thread_create(out_stack, sizeof(out_stack), CAPTURE_PRIO,
+                            CREATE_STACKTEST, capture_output, NULL, "capture");
+    return out_pid;
+}
+
+#ifdef SNIFFER_BENCH
+/**
+ * @brief   Air time of a byte at 250 kbit/s in microseconds
+ */
+#define BYTE_AIRTIME_US         (32U)
+
+/**
+ * @brief   Synchronization header, PHY header and the gap between frames
+ *          add about this many bytes of air time per frame
+ */
+#define FRAME_OVERHEAD          (6U + 12U)
+
+static uint8_t bench_data[CAPTURE_FRAME_MAX];
+static ng_pktsnip_t bench_snip = { .data = bench_data, .type = NG_NETTYPE_UNDEF };
+static capture_frame_t bench_frame = { .pkt = &bench_snip };
+
+void capture_bench(unsigned frames, unsigned len)
+{
+    uint32_t start, us;
+
+    if (len > CAPTURE_FRAME_MAX) {
+        len = CAPTURE_FRAME_MAX;
+    }
+
+    for (unsigned i = 0; i < len; i++) {
+        bench_data[i] = i;
+    }
+
+    bench_snip.size = len;
+    bench_frame.len = len;
+
+    /* the records must follow the file header, and the captured frames
+     * must not see the benchmark's timestamps */
+    emit_header();
+#ifdef SNIFFER_PCAP
+    uint32_t saved_hi = time_hi, saved_last = time_last;
+#endif
+    start = hwtimer_now();
+
+    for (unsigned i = 0; i < frames; i++) {
+        bench_frame.rx_time = hwtimer_now();
+        emit(&bench_frame);
+    }
+
+    emit_done();
+    us = HWTIMER_TICKS_TO_US(hwtimer_now() - start);
+#ifdef SNIFFER_PCAP
+    time_hi = saved_hi;
+    time_last = saved_last;
+#endif
+
+    printf("\ncapture_bench: %u frames of %u bytes in %lu us, %lu frames/s%s\n",
+           frames, len, (unsigned long)us,
+           us ? (unsigned long)((uint64_t)frames * 1000000 / us) : 0UL,
+#ifdef SNIFFER_PCAP
+           " as pcap over SLIP"
+#else
+           " as text"
+#endif
+           );
+    printf("capture_bench: a 250 kbit/s radio delivers at most %lu of them per second\n",
+           (unsigned long)(1000000 / ((len + FRAME_OVERHEAD) * BYTE_AIRTIME_US)));
+}
+#endif
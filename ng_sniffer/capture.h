@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2015 Freie Universität Berlin
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     app_sniffer
+ * @{
+ *
+ * @file
+ * @brief       Capture ring and output thread of the sniffer
+ *
+ * The rawdump thread only puts received packets into a ring of capture
+ * slots. A thread with a lower priority takes them out of the ring, writes
+ * them to stdout, either as text for ng_sniffer.py or, with SNIFFER_PCAP
+ * defined, as SLIP framed pcap records, and releases them.
+ *
+ * Frames are dropped, and released right away, when the ring is full or
+ * when the frames in it would take more than CAPTURE_PKTBUF_BUDGET bytes of
+ * the packet buffer. Which frame goes when the ring is full is up to the
+ * drop policy.
+ *
+ * @}
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+
+#include "kernel.h"
+#include "net/ng_pkt.h"
+#include "net/ng_pktbuf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief   Number of capture slots, must be a power of 2
+ */
+#ifndef CAPTURE_SLOTS
+#define CAPTURE_SLOTS           (16U)
+#endif
+
+/**
+ * @brief   Largest frame written out, longer frames are truncated
+ */
+#ifndef CAPTURE_FRAME_MAX
+#ifdef BOARD_NATIVE
+#define CAPTURE_FRAME_MAX       (1514U)
+#else
+#define CAPTURE_FRAME_MAX       (127U)
+#endif
+#endif
+
+/**
+ * @brief   Link type in the pcap header
+ *
+ * Ethernet on native, IEEE 802.15.4 with a TAP header carrying RSSI and
+ * LQI everywhere else. Set it to 230 for plain IEEE 802.15.4 without FCS.
+ */
+#ifndef CAPTURE_LINKTYPE
+#ifdef BOARD_NATIVE
+#define CAPTURE_LINKTYPE        (1U)
+#else
+#define CAPTURE_LINKTYPE        (283U)
+#endif
+#endif
+
+/**
+ * @brief   Link type of IEEE 802.15.4 with TAP header
+ */
+#define CAPTURE_LINKTYPE_TAP    (283U)
+
+/**
+ * @brief   Priority of the output thread, below the shell and rawdump
+ */
+#define CAPTURE_PRIO            (THREAD_PRIORITY_MAIN + 1)
+
+/**
+ * @brief   Bytes of the packet buffer the frames in the ring may hold
+ *
+ * The rest is left to the MAC layer, which drops frames it has no room for
+ * without anyone noticing.
+ */
+#ifndef CAPTURE_PKTBUF_BUDGET
+#define CAPTURE_PKTBUF_BUDGET   (NG_PKTBUF_SIZE / 2)
+#endif
+
+/**
+ * @brief   Which frame is dropped when the ring is full
+ */
+typedef enum {
+    CAPTURE_DROP_NEWEST,        /**< the one just received */
+    CAPTURE_DROP_OLDEST         /**< the one waiting longest for output */
+} capture_policy_t;
+
+/**
+ * @brief   Drop policy at startup
+ */
+#ifndef CAPTURE_POLICY
+#define CAPTURE_POLICY          CAPTURE_DROP_NEWEST
+#endif
+
+/**
+ * @brief   Counters of the capture ring
+ */
+typedef struct {
+    uint32_t received;          /**< frames handed to capture_put() */
+    uint32_t written;           /**< frames written out */
+    uint32_t dropped;           /**< frames dropped because the ring was full */
+    uint32_t pktbuf_full;       /**< frames dropped because of CAPTURE_PKTBUF_BUDGET */
+    uint32_t high_water;        /**< most frames in the ring at once */
+    uint32_t held;              /**< bytes of packet buffer held right now */
+} capture_stats_t;
+
+/**
+ * @brief   Starts the output thread
+ *
+ * In pcap mode the thread writes the pcap file header first.
+ *
+ * @return  PID of the output thread
+ */
+kernel_pid_t capture_init(void);
+
+/**
+ * @brief   Puts the frame in @p pkt into the ring
+ *
+ * All snips of @p pkt but the netif header are written out, in order, LQI
+ * and RSSI are taken from the netif header. Only to be called by one thread
+ * with a higher priority than CAPTURE_PRIO.
+ *
+ * @param[in] pkt       received frame, released by the capture ring
+ * @param[in] rx_time   hwtimer ticks at reception
+ *
+ * @return  0 on success
+ * @return  -1 if @p pkt was dropped
+ */
+int capture_put(ng_pktsnip_t *pkt, uint32_t rx_time);
+
+/**
+ * @brief   Sets which frame is dropped when the ring is full
+ */
+void capture_set_policy(capture_policy_t policy);
+
+/**
+ * @brief   Returns which frame is dropped when the ring is full
+ */
+capture_policy_t capture_get_policy(void);
+
+/**
+ * @brief   Truncates frames to @p len bytes on output
+ *
+ * @param[in] len   0 or more than CAPTURE_FRAME_MAX for CAPTURE_FRAME_MAX
+ */
+void capture_set_snaplen(unsigned len);
+
+/**
+ * @brief   Returns the bytes of a frame written at most
+ */
+unsigned capture_get_snaplen(void);
+
+/**
+ * @brief   Copies the counters of the capture ring to @p stats
+ */
+void capture_get_stats(capture_stats_t *stats);
+
+/**
+ * @brief   Prints how long frames waited between reception and output
+ */
+void capture_print_latency(void);
+
+/**
+ * @brief   Prints how many frames of @p len bytes per second the text and
+ *          the pcap output can write, writing @p frames frames in each
+ *
+ * Only available with SNIFFER_BENCH defined.
+ */
+void capture_bench(unsigned frames, unsigned len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CAPTURE_H */
@@ -0,0 +1,455 @@
+/*
+ * Copyright (C) 2015 Freie Universität Berlin
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     app_sniffer
+ * @{
+ *
+ * @file
+ * @brief       Capture filters of the sniffer
+ *
+ * @}
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "net/ng_netbase.h"
+
+#include "filter.h"
+
+/**
+ * @brief   Keeps the compiler from moving accesses across the swap of the
+ *          active rule set
+ */
+#define BARRIER()               __asm__ volatile ("" ::: "memory")
+
+/**
+ * @brief   IEEE 802.15.4 frame control field, little endian on air
+ */
+#define FCF_TYPE_MASK           (0x0007)
+#define FCF_SECURITY            (0x0008)
+#define FCF_PAN_COMP            (0x0040)
+#define FCF_DST_MODE(fcf)       (((fcf) >> 10) & 0x3)
+#define FCF_SRC_MODE(fcf)       (((fcf) >> 14) & 0x3)
+
+/**
+ * @brief   Addressing modes
+ */
+#define ADDR_MODE_SHORT         (2U)
+#define ADDR_MODE_LONG          (3U)
+
+/**
+ * @brief   A set of rules
+ */
+typedef struct {
+    unsigned count;
+    filter_rule_t rules[FILTER_RULES];
+} filter_set_t;
+
+/**
+ * @brief   Where the fields of a frame are, NULL if it doesn't have them
+ */
+typedef struct {
+    uint8_t type;
+    const uint8_t *dst_pan;
+    const uint8_t *dst;
+    const uint8_t *src_pan;
+    const uint8_t *src;
+    uint8_t dst_len;
+    uint8_t src_len;
+    const uint8_t *payload;
+    size_t payload_len;
+} frame_t;
+
+static const char *type_names[] = { "beacon", "data", "ack", "cmd" };
+static const char *field_names[] = { "type", "pan", "src", "dst", "payload" };
+
+/*
+ * The shell changes the set not in use and then swaps them. The rawdump
+ * thread has the higher priority, so it never sees a set half changed and
+ * always finishes with a set before the shell can touch it again.
+ */
+static filter_set_t sets[2];
+static filter_set_t *volatile active = &sets[0];
+
+/* written by the rawdump thread only */
+static volatile uint32_t passed, rejected;
+
+#ifndef BOARD_NATIVE
+static unsigned addr_len(unsigned mode)
+{
+    return (mode == ADDR_MODE_SHORT) ? 2 : (mode == ADDR_MODE_LONG) ? 8 : 0;
+}
+
+/**
+ * @brief   Finds the fields of the IEEE 802.15.4 frame in @p buf
+ *
+ * @return  0 on success
+ * @return  -1 if @p buf is too short for what its header announces
+ */
+static int parse_frame(const uint8_t *buf, size_t len, frame_t *f)
+{
+    const uint8_t *p = buf + 3, *end = buf + len;
+    uint16_t fcf;
+
+    if (len < 3) {
+        return -1;
+    }
+
+    fcf = buf[0] | (buf[1] << 8);
+    f->type = fcf & FCF_TYPE_MASK;
+    f->dst_len = addr_len(FCF_DST_MODE(fcf));
+    f->src_len = addr_len(FCF_SRC_MODE(fcf));
+    f->dst_pan = f->dst = f->src_pan = f->src = NULL;
+
+    if (f->dst_len) {
+        f->dst_pan = p;
+        f->dst = p + 2;
+        p += 2 + f->dst_len;
+    }
+
+    if (f->src_len) {
+        if (!(fcf & FCF_PAN_COMP) || !f->dst_len) {
+            f->src_pan = p;
+            p += 2;
+        }
+
+        f->src = p;
+        p += f->src_len;
+    }
+
+    if ((fcf & FCF_SECURITY) && p < end) {
+        /* security control, frame counter and key identifier */
+        static const uint8_t key_id_len[] = { 0, 1, 5, 9 };
+
+        p += 1 + 4 + key_id_len[(*p >> 3) & 0x3];
+    }
+
+    if (p > end) {
+        return -1;
+    }
+
+    f->payload = p;
+    f->payload_len = end - p;
+    return 0;
+}
+#endif
+
+static bool compare(const filter_rule_t *r, const uint8_t *field, size_t len)
+{
+    if (field == NULL || len < r->len) {
+        return false;
+    }
+
+    for (unsigned i = 0; i < r->len; i++) {
+        if ((field[i] ^ r->value[i]) & r->mask[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool rule_match(const filter_rule_t *r, const frame_t *f)
+{
+    switch (r->field) {
+        case FILTER_TYPE:
+            return f->type == r->value[0];
+        case FILTER_PAN:
+            return compare(r, f->dst_pan, 2) || compare(r, f->src_pan, 2);
+        case FILTER_SRC:
+            return (f->src_len == r->len) && compare(r, f->src, f->src_len);
+        case FILTER_DST:
+            return (f->dst_len == r->len) && compare(r, f->dst, f->dst_len);
+        default:
+            if (f->payload_len < r->offset) {
+                return false;
+            }
+
+            return compare(r, f->payload + r->offset, f->payload_len - r->offset);
+    }
+}
+
+bool filter_match(ng_pktsnip_t *pkt)
+{
+    const filter_set_t *set = active;
+    frame_t f;
+
+    if (set->count == 0) {
+        passed++;
+        return true;
+    }
+
+    /* in raw mode the frame comes in one snip next to the netif header */
+    while (pkt && pkt->type == NG_NETTYPE_NETIF) {
+        pkt = pkt->next;
+    }
+
+    if (pkt == NULL) {
+        rejected++;
+        return false;
+    }
+
+#ifdef BOARD_NATIVE
+    f.payload = pkt->data;
+    f.payload_len = pkt->size;
+#else
+    if (parse_frame(pkt->data, pkt->size, &f) < 0) {
+        rejected++;
+        return false;
+    }
+#endif
+
+    for (unsigned i = 0; i < set->count; i++) {
+        const filter_rule_t *r = &set->rules[i];
+
+        if (rule_match(r, &f) == r->negate) {
+            rejected++;
+            return false;
+        }
+    }
+
+    passed++;
+    return true;
+}
+
+/**
+ * @brief   Parses hex bytes like 0x1234, 12:34 or 1234 into @p out
+ *
+ * @return  number of bytes
+ * @return  -1 if @p str isn't hex or longer than @p max bytes
+ */
+static int parse_hex(const char *str, uint8_t *out, size_t max)
+{
+    size_t len = 0;
+    char digits[3] = { 0 };
+
+    if (str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+        str += 2;
+    }
+
+    while (*str) {
+        char *end;
+
+        if (*str == ':') {
+            str++;
+            continue;
+        }
+
+        if (len == max || !str[1] || str[1] == ':') {
+            return -1;
+        }
+
+        digits[0] = str[0];
+        digits[1] = str[1];
+        out[len++] = strtoul(digits, &end, 16);
+
+        if (*end) {
+            return -1;
+        }
+
+        str += 2;
+    }
+
+    return len ? (int)len : -1;
+}
+
+/**
+ * @brief   Turns the bytes of a PAN ID or address, written most
+ *          significant first, into on-air order
+ */
+static void reverse(uint8_t *buf, size_t len)
+{
+    for (size_t i = 0; i < len / 2; i++) {
+        uint8_t tmp = buf[i];
+
+        buf[i] = buf[len - 1 - i];
+        buf[len - 1 - i] = tmp;
+    }
+}
+
+static int compile(filter_rule_t *r, int argc, char **argv)
+{
+    int len;
+
+    memset(r, 0, sizeof(*r));
+
+    if (argc > 1 && strcmp(argv[0], "not") == 0) {
+        r->negate = 1;
+        argc--;
+        argv++;
+    }
+
+    if (argc == 3 && strcmp(argv[0], "payload") == 0) {
+        char *mask = strchr(argv[2], '/');
+        unsigned long offset = strtoul(argv[1], NULL, 0);
+
+        if (offset > UINT8_MAX) {
+            return -1;
+        }
+
+        r->field = FILTER_PAYLOAD;
+        r->offset = offset;
+
+        if (mask) {
+            *mask++ = '\0';
+        }
+
+        if ((len = parse_hex(argv[2], r->value, FILTER_VALUE_MAX)) < 0) {
+            return -1;
+        }
+
+        r->len = len;
+        memset(r->mask, 0xff, len);
+
+        if (mask && parse_hex(mask, r->mask, FILTER_VALUE_MAX) != len) {
+            return -1;
+        }
+
+        return 0;
+    }
+
+#ifdef BOARD_NATIVE
+    /* no IEEE 802.15.4 headers to look at */
+    return -1;
+#else
+    if (argc != 2) {
+        return -1;
+    }
+
+    if (strcmp(argv[0], "type") == 0) {
+        r->field = FILTER_TYPE;
+        r->len = 1;
+
+        for (unsigned i = 0; i < sizeof(type_names) / sizeof(type_names[0]); i++) {
+            if (strcmp(argv[1], type_names[i]) == 0) {
+                r->value[0] = i;
+                return 0;
+            }
+        }
+
+        return -1;
+    }
+
+    if (strcmp(argv[0], "pan") == 0) {
+        r->field = FILTER_PAN;
+        len = parse_hex(argv[1], r->value, 2);
+
+        if (len == 1) {
+            /* 0x23 is 0x0023 */
+            r->value[1] = r->value[0];
+            r->value[0] = 0;
+            len = 2;
+        }
+    }
+    else if (strcmp(argv[0], "src") == 0) {
+        r->field = FILTER_SRC;
+        len = parse_hex(argv[1], r->value, FILTER_VALUE_MAX);
+    }
+    else if (strcmp(argv[0], "dst") == 0) {
+        r->field = FILTER_DST;
+        len = parse_hex(argv[1], r->value, FILTER_VALUE_MAX);
+    }
+    else {
+        return -1;
+    }
+
+    if (len != 2 && len != 8) {
+        return -1;
+    }
+
+    r->len = len;
+    reverse(r->value, len);
+    memset(r->mask, 0xff, len);
+    return 0;
+#endif
+}
+
+/**
+ * @brief   Makes @p set the one filter_match() uses
+ */
+static void swap(filter_set_t *set)
+{
+    BARRIER();
+    active = set;
+    BARRIER();
+}
+
+int filter_add(int argc, char **argv)
+{
+    filter_set_t *next = (active == &sets[0]) ? &sets[1] : &sets[0];
+
+    if (active->count == FILTER_RULES) {
+        return -1;
+    }
+
+    *next = *active;
+
+    if (compile(&next->rules[next->count], argc, argv) < 0) {
+        return -1;
+    }
+
+    next->count++;
+    swap(next);
+    return 0;
+}
+
+void filter_clear(void)
+{
+    filter_set_t *next = (active == &sets[0]) ? &sets[1] : &sets[0];
+
+    next->count = 0;
+    swap(next);
+}
+
+void filter_print(void)
+{
+    const filter_set_t *set = active;
+
+    if (set->count == 0) {
+        puts("no filter, every frame passes");
+    }
+
+    for (unsigned i = 0; i < set->count; i++) {
+        const filter_rule_t *r = &set->rules[i];
+
+        printf("%s%s ", r->negate ? "not " : "", field_names[r->field]);
+
+        if (r->field == FILTER_TYPE) {
+            printf("%s\n", type_names[r->value[0] & 0x3]);
+            continue;
+        }
+
+        if (r->field == FILTER_PAYLOAD) {
+            printf("%u ", r->offset);
+
+            for (unsigned j = 0; j < r->len; j++) {
+                printf("%02x", r->value[j]);
+            }
+
+            putchar('/');
+
+            for (unsigned j = 0; j < r->len; j++) {
+                printf("%02x", r->mask[j]);
+            }
+        }
+        else {
+            /* most significant byte first, as entered */
+            for (unsigned j = r->len; j > 0; j--) {
+                printf("%02x", r->value[j - 1]);
+            }
+        }
+
+        putchar('\n');
+    }
+
+    printf("%lu frames passed, %lu filtered out\n",
+           (unsigned long)passed, (unsigned long)rejected);
+}
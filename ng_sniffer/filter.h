@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2015 Freie Universität Berlin
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     app_sniffer
+ * @{
+ *
+ * @file
+ * @brief       Capture filters of the sniffer
+ *
+ * Rules on the IEEE 802.15.4 frame type, PAN ID, source and destination
+ * address and on payload bytes are compiled from shell arguments into
+ * byte comparisons in on-air byte order. The rawdump thread runs them on
+ * every frame before it goes into the capture ring, a frame is kept if it
+ * passes all rules. On native, where frames are Ethernet, only payload
+ * rules exist and their offsets count from the start of the frame.
+ *
+ * @}
+ */
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "net/ng_pkt.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief   Maximum number of rules
+ */
+#ifndef FILTER_RULES
+#define FILTER_RULES            (8U)
+#endif
+
+/**
+ * @brief   Longest value a rule compares, an extended address
+ */
+#define FILTER_VALUE_MAX        (8U)
+
+/**
+ * @brief   What a rule looks at
+ */
+typedef enum {
+    FILTER_TYPE,                /**< frame type, beacon, data, ack or cmd */
+    FILTER_PAN,                 /**< destination or source PAN ID */
+    FILTER_SRC,                 /**< source address, short or extended */
+    FILTER_DST,                 /**< destination address, short or extended */
+    FILTER_PAYLOAD              /**< bytes at an offset into the payload */
+} filter_field_t;
+
+/**
+ * @brief   A compiled rule
+ */
+typedef struct {
+    uint8_t field;              /**< a filter_field_t */
+    uint8_t negate;             /**< frames matching the rule are dropped */
+    uint8_t offset;             /**< into the payload */
+    uint8_t len;                /**< bytes in value and mask */
+    uint8_t value[FILTER_VALUE_MAX];   /**< in on-air byte order */
+    uint8_t mask[FILTER_VALUE_MAX];    /**< bits of value that count */
+} filter_rule_t;
+
+/**
+ * @brief   Compiles a rule from shell arguments and adds it
+ *
+ *          [not] type beacon|data|ack|cmd
+ *          [not] pan <pan id>
+ *          [not] src|dst <address>
+ *          [not] payload <offset> <hex bytes>[/<hex mask>]
+ *
+ * Numbers are hex, with or without 0x, bytes may be separated by colons.
+ *
+ * @return  0 on success
+ * @return  -1 if the arguments don't make a rule or all rules are taken
+ */
+int filter_add(int argc, char **argv);
+
+/**
+ * @brief   Removes all rules, every frame passes
+ */
+void filter_clear(void);
+
+/**
+ * @brief   Checks @p pkt against the rules
+ *
+ * Only to be called by one thread with a higher priority than the shell.
+ *
+ * @return  true if @p pkt is to be captured
+ */
+bool filter_match(ng_pktsnip_t *pkt);
+
+/**
+ * @brief   Prints the rules and how many frames they let through
+ */
+void filter_print(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FILTER_H */
@@ -20,6 +20,8 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "thread.h"
 #include "hwtimer.h"
@@ -33,6 +35,9 @@
 #endif
 #include "net/ng_netbase.h"
 
+#include "capture.h"
+#include "filter.h"
+
 /**
  * @brief   Buffer size used by the shell
  */
@@ -40,8 +45,17 @@
 
 /**
  * @brief   Priority of the RAW dump thread
+ *
+ * Above the MAC threads started by auto_init, so that a received frame is
+ * timestamped as soon as the MAC layer hands it over. It only puts frames
+ * into the capture ring.
+ */
+#define RAWDUMP_PRIO            (THREAD_PRIORITY_MAIN - 5)
+
+/**
+ * @brief   Messages queued for the raw dump thread, a power of 2
  */
-#define RAWDUMP_PRIO            (THREAD_PRIORITY_MAIN - 1)
+#define RAWDUMP_MSG_QUEUE       (8U)
 
 /**
  * @brief   Stack for the raw dump thread
@@ -49,24 +63,20 @@
 static char rawdmp_stack[THREAD_STACKSIZE_MAIN];
 
 /**
- * @brief   Make a raw dump of the given packet contents
+ * @brief   Hand the given packet to the output thread
+ *
+ * Frames the filter rules out are released right away. Printing and
+ * releasing the others is left to the output thread, frames that don't fit
+ * are dropped and counted by the capture ring.
  */
-void dump_pkt(ng_pktsnip_t *pkt)
+void dump_pkt(ng_pktsnip_t *pkt, uint32_t rx_time)
 {
-    ng_pktsnip_t *snip = pkt;
-
-    printf("rftest-rx --- len 0x%02x lqi 0x%02x rx_time 0x%08lx\n\n",
-           ng_pkt_len(pkt), 0, hwtimer_now());
-
-    while (snip) {
-        for (size_t i = 0; i < snip->size; i++) {
-            printf("0x%02x ", ((uint8_t *)(snip->data))[i]);
-        }
-        snip = snip->next;
+    if (!filter_match(pkt)) {
+        ng_pktbuf_release(pkt);
+        return;
     }
-    puts("\n");
 
-    ng_pktbuf_release(pkt);
+    capture_put(pkt, rx_time);
 }
 
 /**
@@ -77,14 +87,25 @@ void dump_pkt(ng_pktsnip_t *pkt)
 void *rawdump(void *arg)
 {
     (void)arg;
-    msg_t msg;
+    msg_t msg, msg_queue[RAWDUMP_MSG_QUEUE];
+
+    /* frames arriving while rawdump is busy are queued, not lost */
+    msg_init_queue(msg_queue, RAWDUMP_MSG_QUEUE);
 
     while (1) {
+        uint32_t rx_time;
+
         msg_receive(&msg);
+        /* before anything else */
+        rx_time = hwtimer_now();
 
         switch (msg.type) {
             case NG_NETAPI_MSG_TYPE_RCV:
-                dump_pkt((ng_pktsnip_t *)msg.content.ptr);
+                dump_pkt((ng_pktsnip_t *)msg.content.ptr, rx_time);
+                break;
+            case NG_NETAPI_MSG_TYPE_SND:
+                /* not ours to send, but ours to release */
+                ng_pktbuf_release((ng_pktsnip_t *)msg.content.ptr);
                 break;
             default:
                 /* do nothing */
@@ -96,6 +117,81 @@ void *rawdump(void *arg)
     return NULL;
 }
 
+static int _latency(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    capture_print_latency();
+    return 0;
+}
+
+static int _capture(int argc, char **argv)
+{
+    capture_stats_t stats;
+
+    if (argc > 1) {
+        if (strcmp(argv[1], "oldest") == 0) {
+            capture_set_policy(CAPTURE_DROP_OLDEST);
+        }
+        else if (strcmp(argv[1], "newest") == 0) {
+            capture_set_policy(CAPTURE_DROP_NEWEST);
+        }
+        else {
+            printf("usage: %s [oldest|newest]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    capture_get_stats(&stats);
+    printf("received %lu, written %lu, dropped %lu (ring full, %s first), "
+           "%lu (pktbuf full)\n",
+           (unsigned long)stats.received, (unsigned long)stats.written,
+           (unsigned long)stats.dropped,
+           (capture_get_policy() == CAPTURE_DROP_OLDEST) ? "oldest" : "newest",
+           (unsigned long)stats.pktbuf_full);
+    printf("ring high water %lu of %u slots, holding %lu of %u bytes of pktbuf\n",
+           (unsigned long)stats.high_water, CAPTURE_SLOTS,
+           (unsigned long)stats.held, (unsigned)CAPTURE_PKTBUF_BUDGET);
+    return 0;
+}
+
+static int _filter(int argc, char **argv)
+{
+    if (argc == 2 && strcmp(argv[1], "clear") == 0) {
+        filter_clear();
+    }
+    else if (argc > 1 && filter_add(argc - 1, &argv[1]) < 0) {
+        printf("usage: %s [clear | [not] type beacon|data|ack|cmd | [not] pan <pan id> |\n"
+               "       [not] src|dst <address> | [not] payload <offset> <hex>[/<mask>]]\n",
+               argv[0]);
+        return 1;
+    }
+
+    filter_print();
+    return 0;
+}
+
+static int _snaplen(int argc, char **argv)
+{
+    if (argc > 1) {
+        capture_set_snaplen(atoi(argv[1]));
+    }
+
+    printf("frames are written up to %u bytes\n", capture_get_snaplen());
+    return 0;
+}
+
+/**
+ * @brief   Commands of the sniffer, next to the default ones
+ */
+static const shell_command_t shell_commands[] = {
+    { "capture", "capture counters, [oldest|newest] sets what to drop", _capture },
+    { "filter", "add a capture filter rule, or clear them", _filter },
+    { "snaplen", "bytes of a frame to write out at most", _snaplen },
+    { "latency", "time from reception to output", _latency },
+    { NULL, NULL, NULL }
+};
+
 /**
  * @brief   Maybe you are a golfer?!
  */
@@ -106,6 +202,13 @@ int main(void)
 
     puts("RIOT sniffer application");
 
+#ifdef SNIFFER_BENCH
+    capture_bench(1000, 127);
+#endif
+
+    /* start the output thread before anything gets captured */
+    capture_init();
+
     /* start and register rawdump thread */
     puts("Run the rawdump thread and register it");
     dump.pid = thread_create(rawdmp_stack, sizeof(rawdmp_stack), RAWDUMP_PRIO,
@@ -117,9 +220,9 @@ int main(void)
     puts("All ok, starting the shell now");
 #ifndef MODULE_NEWLIB
     (void) posix_open(uart0_handler_pid, 0);
-    shell_init(&shell, NULL, SHELL_BUFSIZE, uart0_readc, uart0_putc);
+    shell_init(&shell, shell_commands, SHELL_BUFSIZE, uart0_readc, uart0_putc);
 #else
-    shell_init(&shell, NULL, SHELL_BUFSIZE, getchar, putchar);
+    shell_init(&shell, shell_commands, SHELL_BUFSIZE, getchar, putchar);
 #endif
     shell_run(&shell);
 